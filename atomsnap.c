@@ -36,6 +36,33 @@
  *
  * - Consumer (Alloc): Uses 'atomic_exchange' to detach the entire stack from
  * 'top_handle' (Batch Steal).
+ *
+ * Hazard Mode (ATOMSNAP_GATE_HAZARD):
+ *
+ * Readers do not touch the control block's reference count. Instead, a reader
+ * publishes the handle it is about to use in one of its thread_context hazard
+ * slots and re-reads the control block to validate it. Writers push detached
+ * versions onto a per-gate retire stack and, once enough have accumulated,
+ * scan every registered thread's hazard slots. Versions that are not
+ * protected by any hazard slot are finalized; the rest stay retired.
+ *
+ * QSBR Mode (ATOMSNAP_GATE_QSBR):
+ *
+ * Readers only load the control block and never write shared memory. Each
+ * thread_context carries an epoch word that the thread refreshes from the
+ * global epoch whenever it reports a quiescent state (0 means offline).
+ * A writer stamps every replaced version with a newly advanced global epoch
+ * and appends it to its own limbo list. A version is reclaimed once every
+ * online thread has reported an epoch at least as new as its stamp.
+ *
+ * Replicated Mode (ATOMSNAP_GATE_REPLICATED):
+ *
+ * Every control block of the gate holds the same version. Readers pick the
+ * replica of their current CPU, so the outer refcount fetch_add stays on a
+ * mostly core-local cache line. Writers are serialized by a per-gate lock and
+ * swap all replicas in one call; the outer refcounts collected from every
+ * replica are summed and subtracted from the old version's inner counter at
+ * once, exactly as if it had been published in a single control block.
  */
 
 #define _GNU_SOURCE
@@ -47,47 +74,103 @@
 #include <assert.h>
 #include <inttypes.h>
 #include <stdbool.h>
+#include <sched.h>
+#include <time.h>
+#include <errno.h>
 #include <sys/mman.h>
 
+/* The library itself always provides the out-of-line definitions */
+#undef ATOMSNAP_INLINE
+
 #include "atomsnap.h"
+#include "atomsnap_inline.h"
 
 #define PAGE_SIZE             (4096)
 
+#define ALIGN_UP(x, a)        (((x) + (a) - 1) & ~((size_t)(a) - 1))
+
 /*
- * MAX_THREADS: 1,048,576 (2^20)
- * Kept for global thread ID and context management.
+ * MAX_THREADS: 4,194,304 (2^22), the kernel's PID_MAX_LIMIT. IDs are
+ * recycled when threads exit, so live threads never run out of them.
+ * Thread contexts are found through a directory of TID_CHUNK-sized chunks
+ * that are allocated as IDs are first handed out.
  */
-#define MAX_THREADS           (1048576)
+#define MAX_THREADS           (4194304)
+#define TID_CHUNK_BITS        (10)
+#define TID_CHUNK             (1 << TID_CHUNK_BITS)
+#define TID_DIR_SIZE          (MAX_THREADS / TID_CHUNK)
+
+/* Internal layout shared with the inline fast paths */
+#define MAX_ARENAS            ATOMSNAP_MAX_ARENAS
+#define SLOTS_PER_ARENA       ATOMSNAP_SLOTS_PER_ARENA
+
+/* Bit layout for the 32-bit handle */
+#define HANDLE_SLOT_BITS      ATOMSNAP_HANDLE_SLOT_BITS
+#define HANDLE_ARENA_BITS     ATOMSNAP_HANDLE_ARENA_BITS
 
 /*
- * MAX_ARENAS: 1,048,576 (2^20)
- * Corresponds to the 20-bit Arena Index.
+ * ATOMSNAP_HAZARD_SLOTS: Hazard slots per thread (hazard-mode gates).
+ * A thread can hold at most this many hazard-mode versions at once.
  */
-#define MAX_ARENAS            (1048576)
+#define ATOMSNAP_HAZARD_SLOTS (8)
 
 /*
- * SLOTS_PER_ARENA: 3,276
- *
- * We want the memory_arena structure to align perfectly with the page
- * boundaries (32 pages = 131,072 bytes).
- *
- * - atomsnap_version size: 40 bytes
- * - memory_arena header:   8 bytes (top_handle)
+ * ATOMSNAP_HAZARD_SCAN_THRESHOLD: Retired versions per gate that trigger a
+ * hazard scan. Bounds the number of unreclaimed versions per gate to this
+ * value plus the number of versions currently protected by readers.
+ */
+#define ATOMSNAP_HAZARD_SCAN_THRESHOLD (64)
+
+/*
+ * ATOMSNAP_QSBR_LIMBO_MAX: Upper bound of an offline thread's limbo list. A
+ * writer that reaches it waits for a grace period before publishing again,
+ * which keeps the memory footprint bounded like the refcount scheme. An
+ * online writer cannot wait for a grace period it holds back itself, so its
+ * list keeps growing until it reports a quiescent state.
  *
- * Size = 8 + (3,276 * 40) = 131,048 bytes.
- * Remaining space = 24 bytes.
+ * ATOMSNAP_QSBR_SCAN_INTERVAL: Retirements between reclamation attempts.
+ */
+#define ATOMSNAP_QSBR_LIMBO_MAX      (1024)
+#define ATOMSNAP_QSBR_SCAN_INTERVAL  (64)
+
+/*
+ * ATOMSNAP_BATCH: Entries handled per pipeline round of acquire_many() and
+ * release_many(). Lines prefetched for a round should still be in L1 when
+ * the round consumes them.
+ */
+#define ATOMSNAP_BATCH        (32)
+
+_Static_assert(ATOMSNAP_BATCH * 2 == 64, "release_batch() hashes into 64");
+
+/*
+ * ATOMSNAP_COMBINE_PASSES: Publication lists drained per combiner turn.
+ * Bounds the time one writer spends serving the others.
  *
- * Indices: 0 to 3275.
- * Slot 0 is Sentinel. Slots 1..3275 are usable.
+ * ATOMSNAP_COMBINE_SPINS: Polls of a waiting writer before it yields the CPU
+ * to the combiner.
  */
-#define SLOTS_PER_ARENA       (3276)
+#define ATOMSNAP_COMBINE_PASSES (4)
+#define ATOMSNAP_COMBINE_SPINS  (128)
 
-/* Bit layout for the 32-bit handle */
-#define HANDLE_SLOT_BITS      (12)
-#define HANDLE_ARENA_BITS     (20)
+/*
+ * ATOMSNAP_BACKOFF_MAX: Upper bound of the pause loop between two failed
+ * publish attempts of atomsnap_update_slot(). Writers that have backed off
+ * this far yield instead.
+ */
+#define ATOMSNAP_BACKOFF_MAX    (1024)
+
+/* Set in atomsnap_gate.qsbr_pending once the gate has been destroyed */
+#define QSBR_GATE_DEAD        (1u << 31)
+
+/*
+ * Cache line sizes used to isolate gates and control blocks. The wide line
+ * covers CPUs whose adjacent-line prefetcher pulls in 128-byte pairs.
+ */
+#define CACHE_LINE_SIZE       (64)
+#define WIDE_LINE_SIZE        (128)
 
 /* Special Values */
-#define HANDLE_NULL           (0xFFFFFFFF) /* 32-bit of 1s */
+#define HANDLE_NULL           ATOMSNAP_HANDLE_NULL /* 32-bit of 1s */
 
 /*
  * Handle Masking & Tagging (for 64-bit top_handle)
@@ -102,10 +185,10 @@
  * Control Block (64-bit)
  * Layout: [ 32-bit RefCount | 32-bit Handle ]
  */
-#define REF_COUNT_SHIFT       (32)
-#define REF_COUNT_INC         (1ULL << REF_COUNT_SHIFT)
-#define REF_COUNT_MASK        (0xFFFFFFFF00000000ULL)
-#define HANDLE_MASK_64        (0x00000000FFFFFFFFULL)
+#define REF_COUNT_SHIFT       ATOMSNAP_REF_COUNT_SHIFT
+#define REF_COUNT_INC         ATOMSNAP_REF_COUNT_INC
+#define REF_COUNT_MASK        ATOMSNAP_REF_COUNT_MASK
+#define HANDLE_MASK_64        ATOMSNAP_HANDLE_MASK_64
 
 /*
  * Inner State (64-bit)
@@ -117,12 +200,12 @@
  * Readers increment the counter only by adding (1ULL << 32), so flags are
  * never modified by carry/overflow.
  */
-#define INNER_CNT_SHIFT       (32)
-#define INNER_CNT_INC         (1ULL << INNER_CNT_SHIFT)
+#define INNER_CNT_SHIFT       ATOMSNAP_INNER_CNT_SHIFT
+#define INNER_CNT_INC         ATOMSNAP_INNER_CNT_INC
 #define INNER_FLAGS_MASK      (0x00000000FFFFFFFFULL)
 
-#define INNER_F_DETACHED      (1u << 0)
-#define INNER_F_FINALIZED     (1u << 1)
+#define INNER_F_DETACHED      ATOMSNAP_INNER_F_DETACHED
+#define INNER_F_FINALIZED     ATOMSNAP_INNER_F_FINALIZED
 
 /* Error logging macro */
 #define errmsg(fmt, ...) \
@@ -139,6 +222,35 @@ typedef union {
 	uint32_t raw;
 } atomsnap_handle_t;
 
+_Static_assert(sizeof(struct atomsnap_version) == ATOMSNAP_SLOT_SIZE,
+	"version slot does not match ATOMSNAP_SLOT_SIZE");
+_Static_assert(sizeof(struct atomsnap_arena) <= 32 * PAGE_SIZE,
+	"arena exceeds 32 pages");
+_Static_assert(ATOMSNAP_SLOTS_PER_ARENA <= ATOMSNAP_HANDLE_SLOT_MASK,
+	"slot index collides with HANDLE_NULL");
+_Static_assert(ATOMSNAP_MAX_GATES <= UINT16_MAX + 1,
+	"gate indices must fit atomsnap_version.gate_idx");
+_Static_assert((ATOMSNAP_GATE_HAZARD | ATOMSNAP_GATE_QSBR) <= UINT16_MAX,
+	"reader modes must fit atomsnap_version.read_mode");
+_Static_assert((offsetof(struct atomsnap_arena, slots) + ATOMSNAP_SLOT_SIZE) %
+	ATOMSNAP_PAYLOAD_ALIGN == 0 &&
+	_Alignof(max_align_t) <= ATOMSNAP_PAYLOAD_ALIGN,
+	"inline payloads must be aligned for any object type");
+
+/*
+ * The gate is allocated on a line of its own, so the primary control block
+ * owns the start of that line and the writer-side fields start the next
+ * one. Strides of whole lines keep every extra control block line-aligned
+ * in both line sizes.
+ */
+_Static_assert(offsetof(struct atomsnap_gate, control_block) == 0,
+	"primary control block must start the gate's line");
+_Static_assert(offsetof(struct atomsnap_gate, sequences) == CACHE_LINE_SIZE,
+	"writer-side gate fields must start the second line");
+_Static_assert(WIDE_LINE_SIZE % CACHE_LINE_SIZE == 0 &&
+	CACHE_LINE_SIZE % sizeof(uint64_t) == 0,
+	"control block strides must be whole lines");
+
 static inline uint32_t inner_cnt(uint64_t s)
 {
 	return (uint32_t)(s >> INNER_CNT_SHIFT);
@@ -150,92 +262,244 @@ static inline uint32_t inner_flags(uint64_t s)
 }
 
 /*
- * atomsnap_version - Internal representation of a version.
- *
- * This structure is allocated within memory arenas. It contains both the
- * user-facing payload fields and internal management fields.
- *
- * @object:        Public-facing pointer to the user object.
- * @free_context:  User-defined context for the free function.
- * @gate:          Pointer to the gate this version belongs to.
- * @inner_state:   [32-bit Counter | 32-bit Flags] for reclamation.
- * @self_handle:   Handle identifying this version (when allocated).
- * @next_handle:   Handle to the next node in the stack (when freed).
- *
- * [ Memory Layout ]
- * 00-08: object (8B)
- * 08-16: free_context (8B)
- * 16-24: gate (8B)
- * 24-32: inner_state (8B)
- * 32-36: self_handle / next_handle (4B)
- * 36-40: padding (4B)
- */
-struct atomsnap_version {
-	_Atomic(void *) object;
-	void *free_context;
+ * arena_pool - Arenas of one size class owned by a thread.
+ *
+ * @cls:                Size class of the arenas (0 for plain versions).
+ * @owned_arenas:       Dynamic array of pointers to owned arenas.
+ * @arena_indices:      Dynamic array of indices for owned arenas.
+ * @active_arena_count: Index of the arena currently being allocated from.
+ * @vector_capacity:    Current allocated capacity of the dynamic arrays.
+ * @local_top:          Top of the local free stack.
+ * @alloc_count:        Allocation counter to pace reclamation.
+ * @empty_hint:         Set by a free that made an arena of the pool fully
+ *                      free.
+ * @ready_top:          Ready list: arenas whose shared stack went from
+ *                      empty to non-empty (Arena Index + 1, 0 when empty,
+ *                      READY_CLOSED once the owning thread has exited).
+ */
+struct arena_pool {
+	unsigned int cls;
+	struct atomsnap_arena **owned_arenas;
+	uint32_t *arena_indices;
+	size_t active_arena_count;
+	size_t vector_capacity;
+	uint32_t local_top;
+	uint64_t alloc_count;
+	_Atomic(uint32_t) ready_top;
+	_Atomic(bool) empty_hint;
+};
+
+/*
+ * arena_meta - Bookkeeping of an arena kept outside of it, so it survives
+ * madvise() and the arena changing hands.
+ *
+ * @owner:      Pool the arena is active in (0 if none), tagged with
+ *              ARENA_QUEUED and ARENA_LEAVING.
+ * @ready_next: Next link in the ready list (Arena Index + 1, 0 ends it).
+ * @stack_next: Next link in an arena stack (Arena Index + 1, 0 ends it).
+ * @pool_pos:   Position in the owner's arena vector (owner thread only).
+ * @stamps:     Generation stamp per slot, allocated when a stamped gate
+ *              first takes a slot of the arena (never freed).
+ */
+struct arena_meta {
+	_Atomic(uintptr_t) owner;
+	_Atomic(uint32_t) ready_next;
+	_Atomic(uint32_t) stack_next;
+	uint32_t pool_pos;
+	_Atomic(uint64_t *) stamps;
+};
+
+/*
+ * Tags of arena_meta.owner. A free that links an arena into its owner's
+ * ready list sets ARENA_QUEUED, and the owner clears it when it pops the
+ * arena. An arena that leaves its pool while queued keeps its entry and
+ * becomes ARENA_LEAVING; the owner releases it when it pops the entry, so
+ * an arena is never linked in two lists.
+ */
+#define ARENA_QUEUED          ((uintptr_t)1)
+#define READY_CLOSED          UINT32_MAX
+#define ARENA_LEAVING         ((uintptr_t)2)
+#define ARENA_OWNER_MASK      (~(uintptr_t)3)
+
+/*
+ * atomsnap_combine_req - Update posted to a combining gate.
+ *
+ * Lives on the posting writer's stack until @done is set.
+ *
+ * @next:     Next request in the publication list.
+ * @gate:     Target gate.
+ * @fn:       Update function.
+ * @arg:      Argument for @fn.
+ * @slot_idx: Target slot.
+ * @status:   0 if applied, -1 on allocation failure.
+ * @result:   Return value of @fn.
+ * @done:     Set by the combiner once the request has been served.
+ */
+struct atomsnap_combine_req {
+	struct atomsnap_combine_req *next;
 	struct atomsnap_gate *gate;
-	_Atomic(uint64_t) inner_state;
-	union {
-		uint32_t self_handle;
-		_Atomic(uint32_t) next_handle;
-	};
+	atomsnap_combine_func fn;
+	void *arg;
+	int slot_idx;
+	int status;
+	int64_t result;
+	_Atomic(bool) done;
+};
+
+/*
+ * atomsnap_history - Versions recently replaced in one slot.
+ *
+ * Ring entries are [ RefCount32 | Handle32 ] words that act as control
+ * blocks of their own: a replaced version moves into the ring with the
+ * outer references of its slot and is only detached when it is pushed
+ * out. @seq works like gate->txn_seq: it is odd while a writer pushes, and
+ * readers validate the entry they picked against it instead of locking
+ * the ring.
+ *
+ * @seq:   Twice the number of versions pushed, plus one during a push.
+ * @ring:  gate->history_depth entries.
+ */
+struct atomsnap_history {
+	_Atomic(uint64_t) seq;
+	_Atomic(uint64_t) *ring;
 };
 
 /*
- * memory_arena - Contiguous block of version slots.
+ * atomsnap_publisher - Coalescing publisher of one gate slot.
  *
- * @top_handle: Handle of the top node in the shared stack.
- * @slots:      Array of version structures. Slot 0 is the Sentinel.
+ * @cfg:       Configuration passed to atomsnap_publisher_create().
+ * @mailbox:   LIFO stack of posted deltas (Treiber stack).
+ * @pending:   Deltas taken from the mailbox but not published yet (FIFO).
+ * @tail:      Last node of @pending.
+ * @thread:    Publisher thread.
+ * @lock:      Protects @stop.
+ * @wake:      Signalled with @stop so the thread need not sleep out its
+ *             period (CLOCK_MONOTONIC).
+ * @stop:      Set by atomsnap_publisher_destroy().
  */
-struct memory_arena {
-	_Atomic(uint64_t) top_handle;
-	struct atomsnap_version slots[SLOTS_PER_ARENA];
+struct atomsnap_publisher {
+	struct atomsnap_publisher_context cfg;
+	_Atomic(struct atomsnap_delta *) mailbox;
+	struct atomsnap_delta *pending;
+	struct atomsnap_delta *tail;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	bool stop;
 };
 
 /*
  * thread_context - Thread-Local Storage (TLS) context.
  *
  * @thread_id:          Assigned global thread ID.
- * @owned_arenas:       Dynamic array of pointers to owned arenas.
- * @arena_indices:      Dynamic array of indices for owned arenas.
- * @active_arena_count: Index of the arena currently being allocated from.
- * @vector_capacity:    Current allocated capacity of the dynamic arrays.
- * @local_top:          Top of the local free stack.
- * @alloc_count:        Allocation counter to trigger periodic reclamation.
+ * @pools:              Arena pools, one per size class.
+ * @hazards:            Handles protected by this thread (hazard mode).
+ * @qsbr_epoch:         Last reported quiescent epoch, 0 if offline.
+ * @limbo_head:         Oldest retired version awaiting a grace period.
+ * @limbo_tail:         Newest retired version awaiting a grace period.
+ * @limbo_cnt:          Number of versions in the limbo list.
  */
 struct thread_context {
 	int thread_id;
-	struct memory_arena **owned_arenas;
-	uint32_t *arena_indices;
-	size_t active_arena_count;
-	size_t vector_capacity;
-	uint32_t local_top;
-	uint64_t alloc_count;
+	struct arena_pool pools[ATOMSNAP_SIZE_CLASSES];
+	_Atomic(uint32_t) hazards[ATOMSNAP_HAZARD_SLOTS];
+	_Atomic(uint64_t) qsbr_epoch;
+	uint32_t limbo_head;
+	uint32_t limbo_tail;
+	uint32_t limbo_cnt;
+};
+
+/*
+ * tid_chunk - Per-thread-ID state of TID_CHUNK consecutive IDs.
+ *
+ * @ctx:   Thread context owned by each ID (kept when the ID is released).
+ * @next:  Link of each ID in the free-ID stack.
+ */
+struct tid_chunk {
+	struct thread_context *ctx[TID_CHUNK];
+	_Atomic(uint32_t) next[TID_CHUNK];
 };
 
+#if ATOMSNAP_SLOT_SIZE == 32
 /*
- * atomsnap_gate - Gate structure.
- *
- * @control_block:        64-bit atomic [RefCnt | Handle].
- * @free_impl:            User callback for object cleanup.
- * @extra_control_blocks: Array for multi-slot gates.
- * @num_extra_slots:      Number of extra slots.
- */
-struct atomsnap_gate {
-	_Atomic(uint64_t) control_block;
-	atomsnap_free_func free_impl;
-	_Atomic(uint64_t) *extra_control_blocks;
-	int num_extra_slots;
+ * gate_chunk - State of ATOMSNAP_GATE_CHUNK consecutive gate indices.
+ *
+ * @gates: Gate registered at each index (the chunk atomsnap_gate_dir
+ *         points to).
+ * @next:  Link of each index in the free-index stack.
+ */
+struct gate_chunk {
+	struct atomsnap_gate *gates[ATOMSNAP_GATE_CHUNK];
+	_Atomic(uint32_t) next[ATOMSNAP_GATE_CHUNK];
 };
+#endif
 
 /*
  * Global Variables
  */
-static struct memory_arena *g_arena_table[MAX_ARENAS];
+struct atomsnap_arena **atomsnap_arena_dir[ATOMSNAP_ARENA_DIR_SIZE];
+
+/* Per-arena bookkeeping, chunked like the arena table */
+static _Atomic(struct arena_meta *) g_arena_meta_dir[ATOMSNAP_ARENA_DIR_SIZE];
+
+#if ATOMSNAP_SLOT_SIZE == 32
+struct atomsnap_gate **atomsnap_gate_dir[ATOMSNAP_GATE_DIR_SIZE];
+
+/*
+ * Released gate indices form a Treiber stack linked through
+ * gate_chunk.next, with the same [ Tag32 | Index + 1 ] top as the free-ID
+ * stack. Indices from g_gate_fresh on have never been handed out.
+ */
+static _Atomic(uint64_t) g_gate_free_top = 0;
+static _Atomic(uint32_t) g_gate_fresh = 0;
+#endif
 static _Atomic(size_t) g_global_arena_cnt = 0;
 
-static struct thread_context *g_thread_contexts[MAX_THREADS];
-static _Atomic(bool) g_tid_used[MAX_THREADS];
+static _Atomic(struct tid_chunk *) g_tid_dir[TID_DIR_SIZE];
+
+/*
+ * Released thread IDs form a Treiber stack linked through tid_chunk.next.
+ * The top is [ Tag32 | ID + 1 ] (0 when empty); the tag, bumped by every
+ * push and pop, prevents ABA. LIFO order hands out the most recently
+ * released ID, whose context and arenas are still warm.
+ */
+#define TID_TAG_INC           (1ULL << 32)
+#define TID_TAG_MASK          (0xFFFFFFFF00000000ULL)
+
+static _Atomic(uint64_t) g_tid_free_top = 0;
+
+/*
+ * Arena stacks are Treiber stacks of arena indices linked through
+ * arena_meta.stack_next. The top is [ Tag32 | Arena Index + 1 ] (0 when
+ * empty); the tag, bumped by every push and pop, prevents ABA.
+ *
+ * g_orphan_top:     Arenas left behind by exited threads, one stack per
+ *                   size class. They may still hold live versions.
+ * g_free_arena_top: Fully free arenas whose pages went back to the OS.
+ *                   init_arena() of any thread reuses them, index and all,
+ *                   before it grows the arena table.
+ */
+#define ARENA_STACK_TAG_INC   (1ULL << 32)
+#define ARENA_STACK_TAG_MASK  (0xFFFFFFFF00000000ULL)
+
+static _Atomic(uint64_t) g_orphan_top[ATOMSNAP_SIZE_CLASSES];
+static _Atomic(uint64_t) g_free_arena_top = 0;
+
+/* IDs from here on have never been handed out */
+static _Atomic(int) g_tid_fresh = 0;
+
+/* Upper bound (exclusive) of thread IDs ever handed out */
+static _Atomic(int) g_tid_limit = 0;
+
+/* Global QSBR epoch, advanced on every retirement */
+static _Atomic(uint64_t) g_qsbr_epoch = 1;
+
+/*
+ * Thread context of the calling thread. Initial-exec TLS resolves to a
+ * single fs-relative load; g_tls_key only exists to run tls_destructor().
+ */
+static __thread struct thread_context *g_tls_ctx
+	__attribute__((tls_model("initial-exec")));
 
 static pthread_key_t g_tls_key;
 static pthread_once_t g_init_once = PTHREAD_ONCE_INIT;
@@ -244,6 +508,7 @@ static pthread_once_t g_init_once = PTHREAD_ONCE_INIT;
  * Forward Declarations
  */
 static int atomsnap_thread_init_internal(void);
+static void qsbr_reclaim(struct thread_context *ctx, bool wait);
 
 /**
  * @brief   Convert a raw handle to a version pointer.
@@ -254,911 +519,4452 @@ static int atomsnap_thread_init_internal(void);
  */
 static inline struct atomsnap_version *resolve_handle(uint32_t handle_raw)
 {
-	atomsnap_handle_t h;
-	struct memory_arena *arena;
+	return atomsnap_resolve_handle(handle_raw);
+}
 
-	if (__builtin_expect(handle_raw == HANDLE_NULL, 0)) {
-		return NULL;
-	}
+/**
+ * @brief   Get the gate a version belongs to.
+ *
+ * @param   ver: Target version.
+ *
+ * @return  Pointer to the gate.
+ */
+static inline struct atomsnap_gate *version_gate(struct atomsnap_version *ver)
+{
+	return atomsnap_version_gate(ver);
+}
 
-	h.raw = handle_raw;
+/**
+ * @brief   Associate a version with its gate.
+ *
+ * @param   ver:  Target version.
+ * @param   gate: Owning gate.
+ */
+static inline void version_set_gate(struct atomsnap_version *ver,
+	struct atomsnap_gate *gate)
+{
+#if ATOMSNAP_SLOT_SIZE == 32
+	ver->gate_idx = (uint16_t)gate->gate_idx;
+#else
+	ver->gate = gate;
+#endif
+	ver->read_mode = (uint16_t)(gate->flags &
+		(ATOMSNAP_GATE_HAZARD | ATOMSNAP_GATE_QSBR));
+}
 
-	/* Bounds check */
-	if (__builtin_expect(h.arena_idx >= MAX_ARENAS, 0)) {
-		return NULL;
-	}
+#if ATOMSNAP_SLOT_SIZE == 32
+/**
+ * @brief   Get the chunk of a gate index.
+ *
+ * @param   idx: Gate index.
+ *
+ * @return  Chunk, or NULL if the index was never handed out.
+ */
+static inline struct gate_chunk *gate_chunk_of(uint32_t idx)
+{
+	return (struct gate_chunk *)__atomic_load_n(
+		&atomsnap_gate_dir[idx >> ATOMSNAP_GATE_CHUNK_BITS],
+		__ATOMIC_ACQUIRE);
+}
 
-	arena = g_arena_table[h.arena_idx];
+/**
+ * @brief   Return a gate index to the free-index stack.
+ *
+ * @param   idx: Index of a freed gate.
+ */
+static void gate_idx_push(uint32_t idx)
+{
+	uint64_t top, next;
 
-	if (__builtin_expect(arena == NULL, 0)) {
-		return NULL;
+	top = atomic_load_explicit(&g_gate_free_top, memory_order_relaxed);
+	do {
+		atomic_store_explicit(
+			&gate_chunk_of(idx)->next[idx & (ATOMSNAP_GATE_CHUNK - 1)],
+			(uint32_t)top, memory_order_relaxed);
+		next = ((top & TID_TAG_MASK) + TID_TAG_INC) |
+			(uint64_t)(idx + 1);
+	} while (!atomic_compare_exchange_weak_explicit(&g_gate_free_top,
+			&top, next, memory_order_release, memory_order_relaxed));
+}
+
+/**
+ * @brief   Take the most recently released gate index.
+ *
+ * @return  Gate index, or HANDLE_NULL if none was released.
+ */
+static uint32_t gate_idx_pop(void)
+{
+	uint64_t top, next;
+	uint32_t idx;
+
+	top = atomic_load_explicit(&g_gate_free_top, memory_order_acquire);
+	while ((uint32_t)top != 0) {
+		idx = (uint32_t)top - 1;
+		next = ((top & TID_TAG_MASK) + TID_TAG_INC) |
+			(uint64_t)atomic_load_explicit(
+				&gate_chunk_of(idx)->next[idx &
+					(ATOMSNAP_GATE_CHUNK - 1)],
+				memory_order_relaxed);
+		if (atomic_compare_exchange_weak_explicit(&g_gate_free_top,
+				&top, next, memory_order_acquire,
+				memory_order_acquire)) {
+			return idx;
+		}
 	}
 
-	return &arena->slots[h.slot_idx];
+	return HANDLE_NULL;
 }
 
 /**
- * @brief   Construct a handle from indices.
+ * @brief   Take a gate index that has never been used.
  *
- * @param   aid: Arena ID.
- * @param   sid: Slot ID.
+ * Allocates the index's chunk if it is the first of it.
  *
- * @return  Combined 32-bit handle.
+ * @return  Gate index, or HANDLE_NULL if all ATOMSNAP_MAX_GATES indices
+ *          were handed out or the chunk allocation failed.
  */
-static inline uint32_t construct_handle(int aid, int sid)
+static uint32_t gate_idx_fresh(void)
 {
-	atomsnap_handle_t h;
+	uint32_t idx = atomic_load_explicit(&g_gate_fresh,
+		memory_order_relaxed);
+	struct atomsnap_gate ***dir, **expected = NULL;
+	struct gate_chunk *chunk;
 
-	h.raw = 0;
-	h.arena_idx = aid;
-	h.slot_idx = sid;
-	return h.raw;
+	do {
+		if (idx >= ATOMSNAP_MAX_GATES) {
+			return HANDLE_NULL;
+		}
+	} while (!atomic_compare_exchange_weak_explicit(&g_gate_fresh, &idx,
+			idx + 1, memory_order_relaxed, memory_order_relaxed));
+
+	if (gate_chunk_of(idx) != NULL) {
+		return idx;
+	}
+
+	chunk = calloc(1, sizeof(struct gate_chunk));
+	if (chunk == NULL) {
+		errmsg("Failed to allocate gate table chunk\n");
+		return HANDLE_NULL;
+	}
+
+	dir = &atomsnap_gate_dir[idx >> ATOMSNAP_GATE_CHUNK_BITS];
+	if (!__atomic_compare_exchange_n(dir, &expected, chunk->gates, false,
+			__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		/* Another index of the chunk was handed out concurrently */
+		free(chunk);
+	}
+
+	return idx;
 }
+#endif
 
 /**
- * @brief   Check and reclaim the last active arena if it is fully free.
+ * @brief   Register a gate in the gate table (32B slots only).
  *
- * This function examines the last arena in the thread's active list.
- * If all slots in that arena have been returned (based on stack depth),
- * the arena is returned to the OS via madvise(), and the active arena count
- * is decremented. The arena remains in the owned_arenas vector for reuse.
+ * Compact versions refer to their gate by index, so every gate needs an
+ * entry for as long as versions can reference it. Released indices are
+ * reused first, so registration is O(1) and the table stays dense.
  *
- * @param   ctx: Thread context.
+ * @param   gate: Gate to register.
  *
- * @return  true if an arena was reclaimed, false otherwise.
+ * @return  0 on success, -1 if the table is full.
  */
-static bool reclaim_last_arena_if_empty(struct thread_context *ctx)
+static int register_gate(struct atomsnap_gate *gate)
 {
-	struct memory_arena *arena;
-	uint64_t curr_top, depth;
-	size_t idx;
+#if ATOMSNAP_SLOT_SIZE == 32
+	uint32_t idx = gate_idx_pop();
 
-	if (ctx->active_arena_count == 0) {
-		return false;
+	if (idx == HANDLE_NULL) {
+		idx = gate_idx_fresh();
+	}
+	if (idx == HANDLE_NULL) {
+		/* All indices handed out; one may have been released meanwhile */
+		idx = gate_idx_pop();
 	}
 
-	idx = ctx->active_arena_count - 1;
-	arena = ctx->owned_arenas[idx];
+	if (idx == HANDLE_NULL) {
+		errmsg("Max gates limit reached (%d)\n", ATOMSNAP_MAX_GATES);
+		return -1;
+	}
 
-	/* Read top handle to check utilization */
-	curr_top = atomic_load(&arena->top_handle);
-	depth = (curr_top & STACK_DEPTH_MASK) >> STACK_DEPTH_SHIFT;
+	gate->gate_idx = idx;
+	gate_chunk_of(idx)->gates[idx & (ATOMSNAP_GATE_CHUNK - 1)] = gate;
+	return 0;
+#else
+	(void)gate;
+	return 0;
+#endif
+}
 
-	/*
-	 * If depth equals (SLOTS - 1), it means all slots (1..N)
-	 * have been returned to the arena's stack.
-	 */
-	if (depth == (SLOTS_PER_ARENA - 1)) {
-		madvise(arena, sizeof(struct memory_arena), MADV_DONTNEED);
-		ctx->active_arena_count--;
-		return true;
-	}
+/**
+ * @brief   Unregister and free a gate.
+ *
+ * @param   gate: Gate whose versions have all been reclaimed.
+ */
+static void free_gate(struct atomsnap_gate *gate)
+{
+#if ATOMSNAP_SLOT_SIZE == 32
+	uint32_t idx = gate->gate_idx;
 
-	return false;
+	gate_chunk_of(idx)->gates[idx & (ATOMSNAP_GATE_CHUNK - 1)] = NULL;
+	gate_idx_push(idx);
+#endif
+	free(gate);
 }
 
 /**
- * @brief   TLS destructor called when a thread exits.
+ * @brief   Construct a handle from indices.
  *
- * Reclaims all fully free arenas from the end of the active list
- * and releases the thread ID.
+ * @param   aid: Arena ID.
+ * @param   sid: Slot ID.
  *
- * @param   arg: Pointer to the thread_context.
+ * @return  Combined 32-bit handle.
  */
-static void tls_destructor(void *arg)
+static inline uint32_t construct_handle(int aid, int sid)
 {
-	struct thread_context *ctx = (struct thread_context *)arg;
-
-	if (ctx) {
-		/*
-		 * Attempt to reclaim unused arenas from the end of the active
-		 * list. We loop until we hit a busy arena or run out of arenas.
-		 */
-		while (ctx->active_arena_count > 0) {
-			if (!reclaim_last_arena_if_empty(ctx)) {
-				/* Found a busy arena, stop reclamation */
-				break;
-			}
-		}
+	atomsnap_handle_t h;
 
-		/*
-		 * Release the Thread ID atomically so other threads can adopt
-		 * this ctx.
-		 */
-		atomic_store(&g_tid_used[ctx->thread_id], false);
-	}
+	h.raw = 0;
+	h.arena_idx = aid;
+	h.slot_idx = sid;
+	return h.raw;
 }
 
 /**
- * @brief   One-time global initialization routine.
+ * @brief   Number of slots (including the Sentinel) in an arena.
+ *
+ * @param   cls: Size class of the arena.
+ *
+ * @return  Slots per arena.
  */
-static void global_init_routine(void)
+static inline uint32_t class_slots(unsigned int cls)
 {
-	if (pthread_key_create(&g_tls_key, tls_destructor) != 0) {
-		errmsg("Failed to create pthread key\n");
-		exit(EXIT_FAILURE);
+	size_t n;
+
+	if (cls == 0) {
+		return SLOTS_PER_ARENA;
 	}
-	memset(g_arena_table, 0, sizeof(g_arena_table));
-	memset(g_thread_contexts, 0, sizeof(g_thread_contexts));
-	memset(g_tid_used, 0, sizeof(g_tid_used));
+
+	n = (ATOMSNAP_ARENA_SIZE - offsetof(struct atomsnap_arena, slots)) /
+		atomsnap_class_stride(cls);
+	return (uint32_t)n;
 }
 
 /**
- * @brief   Ensure the current thread is registered.
+ * @brief   Get a slot of an arena.
  *
- * Checks for TLS context. If not present, attempts lazy initialization
- * via atomsnap_thread_init_internal().
+ * @param   arena: Target arena.
+ * @param   cls:   Size class of the arena.
+ * @param   idx:   Slot index.
  *
- * @return  Pointer to the thread_context, or NULL on failure.
+ * @return  Pointer to the version slot.
  */
-static inline struct thread_context *get_or_init_thread_context(void)
+static inline struct atomsnap_version *arena_slot(struct atomsnap_arena *arena,
+	unsigned int cls, uint32_t idx)
 {
-	struct thread_context *ctx = NULL;
-
-	pthread_once(&g_init_once, global_init_routine);
-
-	ctx = (struct thread_context *)pthread_getspecific(g_tls_key);
+	return (struct atomsnap_version *)((char *)arena +
+		offsetof(struct atomsnap_arena, slots) +
+		(size_t)idx * atomsnap_class_stride(cls));
+}
 
-	if (__builtin_expect(ctx == NULL, 0)) {
-		if (atomsnap_thread_init_internal() != 0) {
+/**
+ * @brief   Get the arena table entry of a new arena index.
+ *
+ * Allocates the chunk covering the index if this is its first arena. The
+ * chunk is published with a CAS so racing threads agree on one.
+ *
+ * @param   arena_idx: Newly assigned arena index.
+ *
+ * @return  Pointer to the entry, or NULL on allocation failure.
+ */
+static struct atomsnap_arena **arena_table_slot(uint32_t arena_idx)
+{
+	struct atomsnap_arena ***dir, **chunk, **expected = NULL;
+
+	dir = &atomsnap_arena_dir[arena_idx >> ATOMSNAP_ARENA_CHUNK_BITS];
+	chunk = __atomic_load_n(dir, __ATOMIC_ACQUIRE);
+	if (chunk == NULL) {
+		chunk = calloc(ATOMSNAP_ARENA_CHUNK,
+			sizeof(struct atomsnap_arena *));
+		if (chunk == NULL) {
+			errmsg("Arena table chunk allocation failed\n");
 			return NULL;
 		}
-		ctx = (struct thread_context *)pthread_getspecific(g_tls_key);
+
+		if (!__atomic_compare_exchange_n(dir, &expected, chunk, false,
+				__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			free(chunk);
+			chunk = expected;
+		}
 	}
-	return ctx;
+
+	return &chunk[arena_idx & (ATOMSNAP_ARENA_CHUNK - 1)];
 }
 
 /**
- * @brief   Ensure the thread-local vector has enough capacity.
+ * @brief   Make sure the bookkeeping of a new arena index exists.
  *
- * @param   ctx: Thread context.
+ * @param   arena_idx: Global index of the arena.
  *
  * @return  0 on success, -1 on failure.
  */
-static int ensure_vector_capacity(struct thread_context *ctx)
+static int arena_meta_init(uint32_t arena_idx)
 {
-	size_t new_cap;
-	struct memory_arena **new_arenas;
-	uint32_t *new_indices;
-	size_t k;
+	_Atomic(struct arena_meta *) *dir;
+	struct arena_meta *chunk, *expected = NULL;
 
-	if (ctx->active_arena_count < ctx->vector_capacity) {
+	dir = &g_arena_meta_dir[arena_idx >> ATOMSNAP_ARENA_CHUNK_BITS];
+	if (atomic_load_explicit(dir, memory_order_acquire) != NULL) {
 		return 0;
 	}
 
-	new_cap = ctx->vector_capacity == 0 ? 4 : ctx->vector_capacity * 2;
-
-	new_arenas = realloc(ctx->owned_arenas,
-		new_cap * sizeof(struct memory_arena *));
-	new_indices = realloc(ctx->arena_indices,
-		new_cap * sizeof(uint32_t));
-
-	if (!new_arenas || !new_indices) {
-		errmsg("Failed to expand arena vector\n");
+	chunk = calloc(ATOMSNAP_ARENA_CHUNK, sizeof(struct arena_meta));
+	if (chunk == NULL) {
+		errmsg("Arena bookkeeping chunk allocation failed\n");
 		return -1;
 	}
 
-	ctx->owned_arenas = new_arenas;
-	ctx->arena_indices = new_indices;
-
-	/* Initialize new slots to NULL */
-	for (k = ctx->vector_capacity; k < new_cap; k++) {
-		ctx->owned_arenas[k] = NULL;
+	if (!atomic_compare_exchange_strong_explicit(dir, &expected, chunk,
+			memory_order_acq_rel, memory_order_acquire)) {
+		free(chunk);
 	}
 
-	ctx->vector_capacity = new_cap;
 	return 0;
 }
 
 /**
- * @brief   Initialize links and stack for a newly allocated/reused arena.
+ * @brief   Get the bookkeeping of an arena.
  *
- * @param   arena:      Pointer to the arena.
- * @param   arena_idx:  Global index of the arena.
+ * @param   arena_idx: Global index of an initialized arena.
  *
- * @return  Handle to the top of the stack (first valid slot).
+ * @return  Pointer to the arena's bookkeeping.
  */
-static uint32_t setup_arena_stack(struct memory_arena *arena, size_t arena_idx)
+static inline struct arena_meta *arena_meta_of(uint32_t arena_idx)
 {
-	uint32_t sentinel_handle, curr, next_in_stack;
-	struct atomsnap_version *slot;
-	int i;
+	struct arena_meta *chunk = atomic_load_explicit(
+		&g_arena_meta_dir[arena_idx >> ATOMSNAP_ARENA_CHUNK_BITS],
+		memory_order_acquire);
 
-	/* Setup Sentinel (Slot 0) */
+	return &chunk[arena_idx & (ATOMSNAP_ARENA_CHUNK - 1)];
+}
+
+/**
+ * @brief   Get the arena of a handle, without the size class tag.
+ *
+ * @param   arena_idx: Arena part of a handle.
+ *
+ * @return  Pointer to the arena.
+ */
+static inline struct atomsnap_arena *arena_of(uint32_t arena_idx)
+{
+	return (struct atomsnap_arena *)(atomsnap_arena_entry(arena_idx) &
+		~ATOMSNAP_ARENA_CLASS_MASK);
+}
+
+/**
+ * @brief   Get the size class an arena is currently used for.
+ *
+ * @param   arena_idx: Arena part of a handle.
+ *
+ * @return  Size class (0 for plain versions).
+ */
+static inline unsigned int arena_class(uint32_t arena_idx)
+{
+	return (unsigned int)(atomsnap_arena_entry(arena_idx) &
+		ATOMSNAP_ARENA_CLASS_MASK);
+}
+
+/**
+ * @brief   Get the generation stamp of a version.
+ *
+ * @param   ver: Version slot.
+ *
+ * @return  Pointer to the stamp, or NULL if the version's arena never held
+ *          a version of a stamped gate.
+ */
+static inline uint64_t *version_stamp(struct atomsnap_version *ver)
+{
+	atomsnap_handle_t h = { .raw = ver->self_handle };
+	uint64_t *stamps;
+
+	stamps = atomic_load_explicit(&arena_meta_of(h.arena_idx)->stamps,
+		memory_order_acquire);
+	return stamps ? stamps + h.slot_idx : NULL;
+}
+
+/**
+ * @brief   Make sure an arena has a stamp table.
+ *
+ * The table has SLOTS_PER_ARENA entries, enough for any size class the
+ * arena is reused for.
+ *
+ * @param   arena_idx: Global index of the arena.
+ *
+ * @return  0 on success, -1 on failure.
+ */
+static int arena_stamps_init(uint32_t arena_idx)
+{
+	struct arena_meta *meta = arena_meta_of(arena_idx);
+	uint64_t *stamps, *expected = NULL;
+
+	if (atomic_load_explicit(&meta->stamps, memory_order_acquire)) {
+		return 0;
+	}
+
+	stamps = calloc(SLOTS_PER_ARENA, sizeof(uint64_t));
+	if (stamps == NULL) {
+		errmsg("Stamp table allocation failed\n");
+		return -1;
+	}
+
+	if (!atomic_compare_exchange_strong_explicit(&meta->stamps, &expected,
+			stamps, memory_order_acq_rel, memory_order_acquire)) {
+		free(stamps);
+	}
+
+	return 0;
+}
+
+/**
+ * @brief   Get the inline payload of a version.
+ *
+ * @param   ver: Version allocated from a payload arena.
+ *
+ * @return  Pointer to the payload following the version.
+ */
+static inline void *version_payload(struct atomsnap_version *ver)
+{
+	return (char *)ver + ATOMSNAP_SLOT_SIZE;
+}
+
+/**
+ * @brief   Check whether an object is the inline payload of its version.
+ *
+ * Inline payloads die with their slot and never go through free_impl. An
+ * object set with atomsnap_set_object() on a payload version still does.
+ *
+ * @param   ver: Target version.
+ * @param   obj: Object of the version.
+ *
+ * @return  true if obj is the version's inline payload.
+ */
+static inline bool object_is_payload(struct atomsnap_version *ver, void *obj)
+{
+	atomsnap_handle_t h = { .raw = ver->self_handle };
+
+	if ((atomsnap_arena_entry(h.arena_idx) &
+			ATOMSNAP_ARENA_CLASS_MASK) == 0) {
+		return false;
+	}
+
+	return obj == version_payload(ver);
+}
+
+/**
+ * @brief   Push an arena onto an arena stack.
+ *
+ * @param   top:       Top of the stack.
+ * @param   arena_idx: Global index of the arena.
+ */
+static void arena_stack_push(_Atomic(uint64_t) *top, uint32_t arena_idx)
+{
+	struct arena_meta *meta = arena_meta_of(arena_idx);
+	uint64_t old_top, new_top;
+
+	old_top = atomic_load_explicit(top, memory_order_relaxed);
+	do {
+		atomic_store_explicit(&meta->stack_next, (uint32_t)old_top,
+			memory_order_relaxed);
+		new_top = ((old_top & ARENA_STACK_TAG_MASK) +
+			ARENA_STACK_TAG_INC) | (uint64_t)(arena_idx + 1);
+	} while (!atomic_compare_exchange_weak_explicit(top, &old_top,
+			new_top, memory_order_release, memory_order_relaxed));
+}
+
+/**
+ * @brief   Pop the most recently pushed arena from an arena stack.
+ *
+ * @param   top: Top of the stack.
+ *
+ * @return  Global index of the arena, or HANDLE_NULL if the stack is empty.
+ */
+static uint32_t arena_stack_pop(_Atomic(uint64_t) *top)
+{
+	uint64_t old_top, new_top;
+	uint32_t idx;
+
+	old_top = atomic_load_explicit(top, memory_order_acquire);
+	while ((uint32_t)old_top != 0) {
+		idx = (uint32_t)old_top - 1;
+		new_top = ((old_top & ARENA_STACK_TAG_MASK) +
+			ARENA_STACK_TAG_INC) |
+			(uint64_t)atomic_load_explicit(
+				&arena_meta_of(idx)->stack_next,
+				memory_order_relaxed);
+		if (atomic_compare_exchange_weak_explicit(top, &old_top,
+				new_top, memory_order_acquire,
+				memory_order_acquire)) {
+			return idx;
+		}
+	}
+
+	return HANDLE_NULL;
+}
+
+/**
+ * @brief   Check whether every slot (1..N) of an arena is back on its stack.
+ *
+ * @param   arena_idx: Global index of the arena.
+ *
+ * @return  true if the arena is fully free.
+ */
+static inline bool arena_is_free(uint32_t arena_idx)
+{
+	uint64_t depth;
+
+	depth = (atomic_load(&arena_of(arena_idx)->top_handle) &
+		STACK_DEPTH_MASK) >> STACK_DEPTH_SHIFT;
+	return depth == (class_slots(arena_class(arena_idx)) - 1);
+}
+
+/**
+ * @brief   Hand an arena that left its pool to its next user.
+ *
+ * A fully free arena returns its pages to the OS via madvise() and goes
+ * to the free-arena stack. An arena that still holds live versions goes
+ * to the orphan stack of its size class.
+ *
+ * @param   arena_idx: Global index of an arena without an owner.
+ */
+static void release_arena(uint32_t arena_idx)
+{
+	/*
+	 * Nobody holds a slot, so no free can race with the reclaim.
+	 */
+	if (arena_is_free(arena_idx)) {
+		madvise(arena_of(arena_idx), ATOMSNAP_ARENA_SIZE,
+			MADV_DONTNEED);
+		arena_stack_push(&g_free_arena_top, arena_idx);
+	} else {
+		arena_stack_push(&g_orphan_top[arena_class(arena_idx)],
+			arena_idx);
+	}
+}
+
+/**
+ * @brief   Remove an active arena from a pool and release it.
+ *
+ * The last active arena takes its place in the vector. An arena that is
+ * linked in the pool's ready list is released when the entry is popped.
+ *
+ * @param   pool: Arena pool of the thread.
+ * @param   i:    Position of the arena in the vector.
+ */
+static void remove_arena(struct arena_pool *pool, size_t i)
+{
+	uint32_t arena_idx = pool->arena_indices[i];
+	struct arena_meta *meta = arena_meta_of(arena_idx);
+	size_t last = pool->active_arena_count - 1;
+	uintptr_t own = (uintptr_t)pool;
+
+	pool->owned_arenas[i] = pool->owned_arenas[last];
+	pool->arena_indices[i] = pool->arena_indices[last];
+	arena_meta_of(pool->arena_indices[i])->pool_pos = (uint32_t)i;
+	pool->owned_arenas[last] = NULL;
+	pool->active_arena_count = last;
+
+	if (atomic_compare_exchange_strong(&meta->owner, &own, 0)) {
+		release_arena(arena_idx);
+		return;
+	}
+
+	/* Queued: no free touches @owner until the entry is popped */
+	atomic_fetch_or(&meta->owner, ARENA_LEAVING);
+}
+
+/**
+ * @brief   Link an arena into the ready list of a pool.
+ *
+ * @param   pool:      Pool owning the arena.
+ * @param   arena_idx: Global index of the arena.
+ *
+ * @return  true if linked, false if the pool's thread has exited.
+ */
+static bool ready_push(struct arena_pool *pool, uint32_t arena_idx)
+{
+	struct arena_meta *meta = arena_meta_of(arena_idx);
+	uint32_t top;
+
+	top = atomic_load_explicit(&pool->ready_top, memory_order_relaxed);
+	do {
+		if (top == READY_CLOSED) {
+			return false;
+		}
+		atomic_store_explicit(&meta->ready_next, top,
+			memory_order_relaxed);
+	} while (!atomic_compare_exchange_weak_explicit(&pool->ready_top,
+			&top, arena_idx + 1, memory_order_release,
+			memory_order_relaxed));
+
+	return true;
+}
+
+/**
+ * @brief   Unlink the most recently signalled arena from the ready list.
+ *
+ * Only the thread owning the pool pops, so the list cannot suffer ABA.
+ *
+ * @param   pool: Arena pool of the thread.
+ *
+ * @return  Global index of the arena, or HANDLE_NULL if the list is empty.
+ */
+static uint32_t ready_pop(struct arena_pool *pool)
+{
+	uint32_t top, next;
+
+	top = atomic_load_explicit(&pool->ready_top, memory_order_acquire);
+	while (top != 0) {
+		next = atomic_load_explicit(&arena_meta_of(top - 1)->ready_next,
+			memory_order_relaxed);
+		if (atomic_compare_exchange_weak_explicit(&pool->ready_top,
+				&top, next, memory_order_acquire,
+				memory_order_acquire)) {
+			return top - 1;
+		}
+	}
+
+	return HANDLE_NULL;
+}
+
+/**
+ * @brief   Settle an arena the owner popped from its ready list.
+ *
+ * @param   arena_idx: Global index of the arena.
+ *
+ * @return  true if the arena is still active in the pool, false if it
+ *          left the pool and has been released.
+ */
+static bool ready_settle(uint32_t arena_idx)
+{
+	struct arena_meta *meta = arena_meta_of(arena_idx);
+	uintptr_t own = atomic_load(&meta->owner);
+
+	if (own & ARENA_LEAVING) {
+		atomic_store(&meta->owner, 0);
+		release_arena(arena_idx);
+		return false;
+	}
+
+	/* Frees only set ARENA_QUEUED while it is clear */
+	atomic_store(&meta->owner, own & ~ARENA_QUEUED);
+	return true;
+}
+
+/**
+ * @brief   Tell the owner of an arena that its shared stack has slots.
+ *
+ * Called by free_slot() when it pushed onto an empty shared stack or made
+ * the arena fully free. Tagging @owner with ARENA_QUEUED picks the list
+ * and claims the link in one CAS, so the arena is linked at most once and
+ * only into the list of the pool it was active in. Arenas without an
+ * owner are taken whole when they are adopted or reused, so they are not
+ * linked.
+ *
+ * @param   arena_idx: Global index of the arena.
+ * @param   empty:     The arena is fully free; have the owner reclaim it.
+ */
+static void mark_ready(uint32_t arena_idx, bool empty)
+{
+	struct arena_meta *meta = arena_meta_of(arena_idx);
+	struct arena_pool *pool;
+	uintptr_t own;
+
+	own = atomic_load(&meta->owner);
+	do {
+		pool = (struct arena_pool *)(own & ARENA_OWNER_MASK);
+		if (pool == NULL || (own & ARENA_LEAVING)) {
+			return;
+		}
+		if (own & ARENA_QUEUED) {
+			goto linked;
+		}
+	} while (!atomic_compare_exchange_weak(&meta->owner, &own,
+			own | ARENA_QUEUED));
+
+	/*
+	 * The owner may have donated the arena (ARENA_LEAVING) and closed
+	 * its list since; nobody will pop the entry, so release it here.
+	 */
+	if (!ready_push(pool, arena_idx)) {
+		ready_settle(arena_idx);
+		return;
+	}
+
+linked:
+	/* Published after the link, so the reclaim walk finds the arena */
+	if (empty) {
+		atomic_store_explicit(&pool->empty_hint, true,
+			memory_order_release);
+	}
+}
+
+/**
+ * @brief   Reclaim the fully free arenas of a pool.
+ *
+ * An arena's last free links it into the ready list, if it is not linked
+ * already, and sets @empty_hint. So instead of checking every arena, the
+ * reclaim walks the ready list, and only after such a free. Arenas that
+ * are not fully free are linked back.
+ *
+ * @param   pool: Arena pool of the thread.
+ *
+ * @return  Number of arenas reclaimed.
+ */
+static size_t reclaim_empty_arenas(struct arena_pool *pool)
+{
+	uint32_t top, arena_idx;
+	size_t reclaimed = 0;
+
+	if (!atomic_load_explicit(&pool->empty_hint, memory_order_relaxed) ||
+			!atomic_exchange_explicit(&pool->empty_hint, false,
+				memory_order_acquire)) {
+		return 0;
+	}
+
+	/* Only the owner pops, so it may take the whole list at once */
+	top = atomic_exchange_explicit(&pool->ready_top, 0,
+		memory_order_acquire);
+	while (top != 0) {
+		arena_idx = top - 1;
+		top = atomic_load_explicit(&arena_meta_of(arena_idx)->ready_next,
+			memory_order_relaxed);
+
+		if (!arena_is_free(arena_idx)) {
+			ready_push(pool, arena_idx);
+			continue;
+		}
+
+		if (ready_settle(arena_idx)) {
+			remove_arena(pool, arena_meta_of(arena_idx)->pool_pos);
+			reclaimed++;
+		}
+	}
+
+	return reclaimed;
+}
+
+/**
+ * @brief   Push the local free stack back onto its arena's shared stack.
+ *
+ * The local stack always comes from a single arena (a fresh one or one
+ * batch steal) and ends at that arena's Sentinel, so it is spliced back
+ * with a single CAS.
+ *
+ * @param   pool: Arena pool of the thread.
+ */
+static void return_local_stack(struct arena_pool *pool)
+{
+	atomsnap_handle_t h = { .raw = pool->local_top };
+	struct atomsnap_version *bottom;
+	struct atomsnap_arena *arena;
+	uint64_t old_top, new_top, cnt = 0;
+	uint32_t head = pool->local_top;
+
+	pool->local_top = HANDLE_NULL;
+
+	if (head == HANDLE_NULL || h.slot_idx == 0) {
+		return;
+	}
+
+	arena = arena_of(h.arena_idx);
+
+	/* Find the bottom node (the one linked to the Sentinel) */
+	do {
+		bottom = resolve_handle(h.raw);
+		h.raw = atomic_load(&bottom->next_handle);
+		cnt++;
+	} while (h.slot_idx != 0);
+
+	old_top = atomic_load(&arena->top_handle);
+	do {
+		atomic_store(&bottom->next_handle,
+			(uint32_t)(old_top & HANDLE_MASK_32));
+		new_top = ((old_top & STACK_DEPTH_MASK) +
+			cnt * STACK_DEPTH_INC) | (uint64_t)head;
+	} while (!atomic_compare_exchange_weak(&arena->top_handle,
+		&old_top, new_top));
+}
+
+/**
+ * @brief   Give the active arenas of an exiting thread to the orphan pool.
+ *
+ * Remote frees keep landing on the arenas' shared stacks, and the next
+ * thread that runs out of slots adopts them instead of allocating a new
+ * arena. Fully free arenas are reclaimed instead (see release_arena()).
+ *
+ * @param   pool: Arena pool of the exiting thread.
+ */
+static void donate_arenas(struct arena_pool *pool)
+{
+	uint32_t arena_idx, empty;
+
+	while (pool->active_arena_count > 0) {
+		remove_arena(pool, pool->active_arena_count - 1);
+	}
+
+	/*
+	 * Release the arenas that were still linked, then close the list.
+	 * A free that queued an arena before the removal but links it only
+	 * now finds the list closed and releases the arena itself.
+	 */
+	do {
+		while ((arena_idx = ready_pop(pool)) != HANDLE_NULL) {
+			ready_settle(arena_idx);
+		}
+		empty = 0;
+	} while (!atomic_compare_exchange_strong(&pool->ready_top, &empty,
+			READY_CLOSED));
+}
+
+/**
+ * @brief   Get the chunk of a thread ID.
+ *
+ * @param   tid: Thread ID.
+ *
+ * @return  Chunk, or NULL if the ID was never handed out.
+ */
+static inline struct tid_chunk *tid_chunk_of(int tid)
+{
+	return atomic_load_explicit(&g_tid_dir[tid >> TID_CHUNK_BITS],
+		memory_order_acquire);
+}
+
+/**
+ * @brief   Get the thread context owned by a thread ID.
+ *
+ * @param   tid: Thread ID.
+ *
+ * @return  Context, or NULL if none was allocated yet.
+ */
+static inline struct thread_context *tid_ctx(int tid)
+{
+	struct tid_chunk *chunk = tid_chunk_of(tid);
+
+	return chunk ? chunk->ctx[tid & (TID_CHUNK - 1)] : NULL;
+}
+
+/**
+ * @brief   Return a thread ID to the free-ID stack.
+ *
+ * @param   tid: Thread ID that is no longer in use.
+ */
+static void tid_push(int tid)
+{
+	uint64_t top, next;
+
+	top = atomic_load_explicit(&g_tid_free_top, memory_order_relaxed);
+	do {
+		atomic_store_explicit(
+			&tid_chunk_of(tid)->next[tid & (TID_CHUNK - 1)],
+			(uint32_t)top, memory_order_relaxed);
+		next = ((top & TID_TAG_MASK) + TID_TAG_INC) |
+			(uint64_t)(uint32_t)(tid + 1);
+	} while (!atomic_compare_exchange_weak_explicit(&g_tid_free_top,
+			&top, next, memory_order_release, memory_order_relaxed));
+}
+
+/**
+ * @brief   Take the most recently released thread ID.
+ *
+ * @return  Thread ID, or -1 if none was released.
+ */
+static int tid_pop(void)
+{
+	uint64_t top, next;
+	uint32_t id;
+
+	top = atomic_load_explicit(&g_tid_free_top, memory_order_acquire);
+	while ((uint32_t)top != 0) {
+		id = (uint32_t)top - 1;
+		next = ((top & TID_TAG_MASK) + TID_TAG_INC) |
+			(uint64_t)atomic_load_explicit(
+				&tid_chunk_of((int)id)->next[id & (TID_CHUNK - 1)],
+				memory_order_relaxed);
+		if (atomic_compare_exchange_weak_explicit(&g_tid_free_top,
+				&top, next, memory_order_acquire,
+				memory_order_acquire)) {
+			return (int)id;
+		}
+	}
+
+	return -1;
+}
+
+/**
+ * @brief   Take a thread ID that has never been used.
+ *
+ * Allocates the ID's chunk if it is the first of it.
+ *
+ * @return  Thread ID, or -1 if all MAX_THREADS IDs were handed out.
+ */
+static int tid_fresh(void)
+{
+	int tid = atomic_load_explicit(&g_tid_fresh, memory_order_relaxed);
+	struct tid_chunk *chunk, *expected = NULL;
+
+	do {
+		if (tid >= MAX_THREADS) {
+			return -1;
+		}
+	} while (!atomic_compare_exchange_weak_explicit(&g_tid_fresh, &tid,
+			tid + 1, memory_order_relaxed, memory_order_relaxed));
+
+	if (tid_chunk_of(tid) != NULL) {
+		return tid;
+	}
+
+	chunk = calloc(1, sizeof(struct tid_chunk));
+	if (chunk == NULL) {
+		errmsg("Failed to allocate thread ID chunk\n");
+		return -1;
+	}
+
+	if (!atomic_compare_exchange_strong_explicit(
+			&g_tid_dir[tid >> TID_CHUNK_BITS], &expected, chunk,
+			memory_order_acq_rel, memory_order_acquire)) {
+		/* Another ID of the chunk was handed out concurrently */
+		free(chunk);
+	}
+
+	return tid;
+}
+
+/**
+ * @brief   TLS destructor called when a thread exits.
+ *
+ * Returns the local free stack to its arena, reclaims all fully free
+ * arenas, donates the remaining ones to the orphan pool and releases the
+ * thread ID.
+ *
+ * @param   arg: Pointer to the thread_context.
+ */
+static void tls_destructor(void *arg)
+{
+	struct thread_context *ctx = (struct thread_context *)arg;
+	struct arena_pool *pool;
+	int c;
+
+	if (ctx) {
+		/*
+		 * Go offline for QSBR gates and reclaim what has already
+		 * passed a grace period. The rest stays in the limbo list
+		 * until the context is adopted again.
+		 */
+		atomic_store(&ctx->qsbr_epoch, 0);
+		qsbr_reclaim(ctx, false);
+
+		/* Reclaim unused arenas and hand the rest over */
+		for (c = 0; c < ATOMSNAP_SIZE_CLASSES; c++) {
+			pool = &ctx->pools[c];
+			return_local_stack(pool);
+			donate_arenas(pool);
+		}
+
+		/*
+		 * Release the Thread ID atomically so other threads can adopt
+		 * this ctx.
+		 */
+		tid_push(ctx->thread_id);
+		g_tls_ctx = NULL;
+	}
+}
+
+/**
+ * @brief   One-time global initialization routine.
+ */
+static void global_init_routine(void)
+{
+	if (pthread_key_create(&g_tls_key, tls_destructor) != 0) {
+		errmsg("Failed to create pthread key\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * @brief   Ensure the current thread is registered.
+ *
+ * Checks the static TLS context. If not present, performs the one-time
+ * global initialization and registers the thread via
+ * atomsnap_thread_init_internal().
+ *
+ * @return  Pointer to the thread_context, or NULL on failure.
+ */
+static inline struct thread_context *get_or_init_thread_context(void)
+{
+	struct thread_context *ctx = g_tls_ctx;
+
+	if (__builtin_expect(ctx == NULL, 0)) {
+		pthread_once(&g_init_once, global_init_routine);
+
+		if (atomsnap_thread_init_internal() != 0) {
+			return NULL;
+		}
+		ctx = g_tls_ctx;
+	}
+	return ctx;
+}
+
+/**
+ * @brief   Ensure the thread-local vector has enough capacity.
+ *
+ * @param   pool: Arena pool of the thread.
+ *
+ * @return  0 on success, -1 on failure.
+ */
+static int ensure_vector_capacity(struct arena_pool *pool)
+{
+	size_t new_cap;
+	struct atomsnap_arena **new_arenas;
+	uint32_t *new_indices;
+	size_t k;
+
+	if (pool->active_arena_count < pool->vector_capacity) {
+		return 0;
+	}
+
+	new_cap = pool->vector_capacity == 0 ? 4 : pool->vector_capacity * 2;
+
+	new_arenas = realloc(pool->owned_arenas,
+		new_cap * sizeof(struct atomsnap_arena *));
+	new_indices = realloc(pool->arena_indices,
+		new_cap * sizeof(uint32_t));
+
+	if (!new_arenas || !new_indices) {
+		errmsg("Failed to expand arena vector\n");
+		return -1;
+	}
+
+	pool->owned_arenas = new_arenas;
+	pool->arena_indices = new_indices;
+
+	/* Initialize new slots to NULL */
+	for (k = pool->vector_capacity; k < new_cap; k++) {
+		pool->owned_arenas[k] = NULL;
+	}
+
+	pool->vector_capacity = new_cap;
+	return 0;
+}
+
+/**
+ * @brief   Initialize links and stack for a newly allocated/reused arena.
+ *
+ * @param   arena:      Pointer to the arena.
+ * @param   arena_idx:  Global index of the arena.
+ * @param   cls:        Size class of the arena.
+ *
+ * @return  Handle to the top of the stack (first valid slot).
+ */
+static uint32_t setup_arena_stack(struct atomsnap_arena *arena,
+	size_t arena_idx, unsigned int cls)
+{
+	uint32_t nslots = class_slots(cls);
+	uint32_t sentinel_handle, curr, next_in_stack;
+	struct atomsnap_version *slot;
+	uint32_t i;
+
+	/* Setup Sentinel (Slot 0) */
 	sentinel_handle = construct_handle(arena_idx, 0);
 
-	/* Sentinel points to NULL */
-	atomic_store(&arena->slots[0].next_handle, HANDLE_NULL);
+	/* Sentinel points to NULL */
+	atomic_store(&arena_slot(arena, cls, 0)->next_handle, HANDLE_NULL);
+
+	/* Arena Top initially points to Sentinel, Depth 0 */
+	atomic_store(&arena->top_handle, (uint64_t)sentinel_handle);
+
+	/*
+	 * Link slots 1..N sequentially to form the free list stack.
+	 */
+	next_in_stack = sentinel_handle;
+
+	for (i = 1; i < nslots; i++) {
+		curr = construct_handle(arena_idx, i);
+		slot = arena_slot(arena, cls, i);
+		slot->self_handle = curr;
+
+		atomic_store(&slot->next_handle, next_in_stack);
+		next_in_stack = curr;
+	}
+
+	return next_in_stack;
+}
+
+/**
+ * @brief   Initialize a new arena (or reuse a reclaimed one).
+ *
+ * Reclaimed arenas of any thread and size class are reused before a new
+ * index is taken, which keeps the arena table dense.
+ *
+ * @param   pool: Arena pool of the thread.
+ *
+ * @return  0 on success, -1 on failure.
+ */
+static int init_arena(struct arena_pool *pool)
+{
+	struct atomsnap_arena *arena, **entry;
+	size_t arena_idx;
+	uint32_t next_in_stack;
+
+	/* Ensure vector capacity */
+	if (ensure_vector_capacity(pool) != 0) {
+		return -1;
+	}
+
+	arena_idx = arena_stack_pop(&g_free_arena_top);
+	if (arena_idx != HANDLE_NULL) {
+		/* Reuse a reclaimed arena, possibly of another size class */
+		arena = arena_of((uint32_t)arena_idx);
+		entry = atomsnap_arena_ref((uint32_t)arena_idx);
+	} else {
+		/* Allocate New Global Arena */
+		/* The last index holds HANDLE_BUSY and HANDLE_NULL */
+		arena_idx = atomic_fetch_add(&g_global_arena_cnt, 1);
+		if (arena_idx >= MAX_ARENAS - 1) {
+			errmsg("Max arenas reached\n");
+			return -1;
+		}
+
+		entry = arena_table_slot((uint32_t)arena_idx);
+		if (entry == NULL || arena_meta_init((uint32_t)arena_idx) != 0) {
+			return -1;
+		}
+
+		arena = aligned_alloc(PAGE_SIZE, ATOMSNAP_ARENA_SIZE);
+		if (!arena) {
+			errmsg("Memory allocation failed for new arena\n");
+			return -1;
+		}
+		memset(arena, 0, ATOMSNAP_ARENA_SIZE);
+	}
+
+	/* Register in global table, tagged with the size class */
+	*entry = (struct atomsnap_arena *)((uintptr_t)arena | pool->cls);
+
+	pool->owned_arenas[pool->active_arena_count] = arena;
+	pool->arena_indices[pool->active_arena_count] = (uint32_t)arena_idx;
+	arena_meta_of((uint32_t)arena_idx)->pool_pos =
+		(uint32_t)pool->active_arena_count;
+
+	atomic_store(&arena_meta_of((uint32_t)arena_idx)->owner,
+		(uintptr_t)pool);
+
+	/* Setup Stack and Links */
+	next_in_stack = setup_arena_stack(arena, arena_idx, pool->cls);
+
+	/* Increment active count */
+	pool->active_arena_count++;
+
+	/* Use the new stack */
+	pool->local_top = next_in_stack;
+
+	return 0;
+}
+
+/**
+ * @brief   Take the whole shared stack of an arena as the local stack.
+ *
+ * @param   pool:      Arena pool of the thread.
+ * @param   arena_idx: Global index of an arena owned by the pool.
+ *
+ * @return  true if the shared stack had slots, false otherwise.
+ */
+static bool steal_arena(struct arena_pool *pool, uint32_t arena_idx)
+{
+	struct atomsnap_arena *arena = arena_of(arena_idx);
+	uint32_t sentinel_handle = construct_handle(arena_idx, 0);
+	uint64_t top_val, batch_top;
+
+	/* Check if empty (optimization) */
+	top_val = atomic_load(&arena->top_handle);
+	if ((uint32_t)(top_val & HANDLE_MASK_32) == sentinel_handle) {
+		return false;
+	}
+
+	/*
+	 * Batch Steal: Atomically exchange Top with Sentinel.
+	 * This detaches the entire stack.
+	 */
+	batch_top = atomic_exchange(&arena->top_handle,
+		(uint64_t)sentinel_handle);
+
+	assert((uint32_t)(batch_top & HANDLE_MASK_32) != sentinel_handle);
+
+	/* Adopt the batch */
+	pool->local_top = (uint32_t)(batch_top & HANDLE_MASK_32);
+	return true;
+}
+
+/**
+ * @brief   Adopt an arena orphaned by an exited thread.
+ *
+ * The arena becomes the last active one and its shared stack becomes the
+ * local free stack.
+ *
+ * @param   pool: Arena pool of the thread.
+ *
+ * @return  0 if an arena was adopted, -1 if there was none to adopt.
+ */
+static int adopt_orphan(struct arena_pool *pool)
+{
+	uint32_t arena_idx;
+
+	if (ensure_vector_capacity(pool) != 0) {
+		return -1;
+	}
+
+	arena_idx = arena_stack_pop(&g_orphan_top[pool->cls]);
+	if (arena_idx == HANDLE_NULL) {
+		return -1;
+	}
+
+	pool->owned_arenas[pool->active_arena_count] = arena_of(arena_idx);
+	pool->arena_indices[pool->active_arena_count] = arena_idx;
+	arena_meta_of(arena_idx)->pool_pos =
+		(uint32_t)pool->active_arena_count;
+	pool->active_arena_count++;
+
+	/*
+	 * Claim the arena before taking what has been freed so far, so
+	 * frees landing after the steal signal this pool.
+	 */
+	atomic_store(&arena_meta_of(arena_idx)->owner, (uintptr_t)pool);
+	steal_arena(pool, arena_idx);
+
+	return 0;
+}
+
+/**
+ * @brief   Pop a slot from the local free list (Stack Pop).
+ *
+ * @param   pool: Arena pool of the thread.
+ *
+ * @return  Handle of the allocated slot, or HANDLE_NULL if empty.
+ */
+static uint32_t pop_local(struct arena_pool *pool)
+{
+	uint32_t handle_raw;
+	struct atomsnap_version *slot;
+	atomsnap_handle_t h;
+
+	if (pool->local_top == HANDLE_NULL) {
+		return HANDLE_NULL;
+	}
+
+	handle_raw = pool->local_top;
+	h.raw = handle_raw;
+
+	/* Check if the top is the Sentinel (Slot 0) */
+	if (h.slot_idx == 0) {
+		/* Stack is empty (hit sentinel) */
+		pool->local_top = HANDLE_NULL;
+		return HANDLE_NULL;
+	}
+
+	slot = resolve_handle(handle_raw);
+	assert(slot != NULL);
+
+	/*
+	 * Move top to the next node down the stack.
+	 */
+	pool->local_top = atomic_load(&slot->next_handle);
+
+	/* Restore self_handle for Allocated state */
+	slot->self_handle = h.raw;
+	return h.raw;
+}
+
+/**
+ * @brief   Allocates a slot handle.
+ *
+ * Strategy:
+ * 1. Try Local Stack (pop_local).
+ * 2. Try Batch Steal from an arena on the ready list (atomic_exchange).
+ * 3. Try Batch Steal from any owned arena.
+ * 4. Adopt an arena orphaned by an exited thread.
+ * 5. Init New Arena (or reuse).
+ *
+ * @param   ctx: Thread context.
+ * @param   cls: Size class to allocate from (0 for plain versions).
+ *
+ * @return  Handle of the allocated slot, or HANDLE_NULL on failure.
+ */
+static uint64_t alloc_slot(struct thread_context *ctx, unsigned int cls)
+{
+	struct arena_pool *pool = &ctx->pools[cls];
+	uint32_t handle, arena_idx;
+	size_t i;
+
+	pool->alloc_count++;
+
+	/*
+	 * Periodic Reclamation Check.
+	 * Reclaim the arenas that frees have reported fully free.
+	 */
+	if ((pool->alloc_count % class_slots(cls)) == 0) {
+		reclaim_empty_arenas(pool);
+	}
+
+	/* 1. Try Local Free Stack */
+	handle = pop_local(pool);
+	if (handle != HANDLE_NULL) {
+		return handle;
+	}
+
+	/*
+	 * 2. Try the arenas that signalled frees. Clearing ARENA_QUEUED
+	 * before the steal lets the next push onto the emptied stack link the
+	 * arena again. Arenas that left the pool meanwhile are released.
+	 */
+	while ((arena_idx = ready_pop(pool)) != HANDLE_NULL) {
+		if (ready_settle(arena_idx) && steal_arena(pool, arena_idx)) {
+			return pop_local(pool);
+		}
+	}
+
+	/*
+	 * 3. Scan owned active arenas. Only frees still between their push
+	 * and mark_ready() are not on the ready list yet, so this mostly runs
+	 * right before a new arena is taken.
+	 */
+	for (i = 0; i < pool->active_arena_count; i++) {
+		if (steal_arena(pool, pool->arena_indices[i])) {
+			return pop_local(pool);
+		}
+	}
+
+	/* 4. Adopt orphaned arenas until one has a free slot */
+	while (adopt_orphan(pool) == 0) {
+		handle = pop_local(pool);
+		if (handle != HANDLE_NULL) {
+			return handle;
+		}
+	}
+
+	/* 5. Allocate New Arena (or reuse inactive) */
+	if (init_arena(pool) == 0) {
+		return pop_local(pool);
+	}
+
+	errmsg("Out of memory (Max arenas reached)\n");
+	return HANDLE_NULL;
+}
+
+/**
+ * @brief   Returns a slot to its arena (Stack Push).
+ *
+ * Uses a CAS loop to push the slot onto the top of the arena's stack.
+ *
+ * @param   slot: Pointer to the version slot to free.
+ */
+static void free_slot(struct atomsnap_version *slot)
+{
+	uint32_t my_handle = slot->self_handle;
+	atomsnap_handle_t h = { .raw = my_handle };
+	struct atomsnap_arena *arena = arena_of(h.arena_idx);
+	/* Once the slot is pushed, the arena may be reused for another class */
+	uint64_t full = (uint64_t)(class_slots(arena_class(h.arena_idx)) - 1);
+	uint64_t old_top, new_top, depth;
+	bool empty;
+
+	old_top = atomic_load(&arena->top_handle);
+	do {
+		/* 1. Extract current stack depth */
+		depth = (old_top & STACK_DEPTH_MASK);
+
+		/* 2. Increment depth */
+		depth += STACK_DEPTH_INC;
+
+		/* 3. Construct new top handle: [ New Depth | My Handle ] */
+		new_top = depth | (uint64_t)my_handle;
+
+		/* Link: Me -> Old Top (Extract 32-bit handle) */
+		atomic_store(&slot->next_handle,
+			(uint32_t)(old_top & HANDLE_MASK_32));
+
+		/* Attempt to make Me the New Top */
+	} while (!atomic_compare_exchange_weak(&arena->top_handle,
+		&old_top, new_top));
+
+	/*
+	 * Pushed onto an empty stack, or made the arena fully free: let the
+	 * owner find the arena.
+	 */
+	empty = ((depth >> STACK_DEPTH_SHIFT) == full);
+	if (empty || (uint32_t)(old_top & HANDLE_MASK_32) ==
+			construct_handle(h.arena_idx, 0)) {
+		mark_ready(h.arena_idx, empty);
+	}
+}
+
+/*
+ * Finalize and return the slot to the arena.
+ */
+static inline void finalize_and_free(struct atomsnap_version *ver)
+{
+	struct atomsnap_gate *gate = version_gate(ver);
+	void *obj;
+
+	obj = atomic_load_explicit(&ver->object, memory_order_relaxed);
+
+	if (gate && gate->free_impl && !object_is_payload(ver, obj)) {
+		gate->free_impl(obj, ver->free_context);
+	}
+
+	free_slot(ver);
+}
+
+/*
+ * Attempt to finalize a detached version when the counter reaches zero.
+ *
+ * A thread claims FINALIZED before reclaiming. If FINALIZED is already
+ * set, another thread reclaimed it.
+ *
+ * Define ATOMSNAP_DISABLE_FINALIZE_CHECK to ignore duplicates.
+ */
+static inline void try_finalize(struct atomsnap_version *ver, uint64_t state)
+{
+	uint32_t flags;
+	uint64_t old;
+
+	flags = inner_flags(state);
+	if (!(flags & INNER_F_DETACHED)) {
+		return;
+	}
+
+	if (inner_cnt(state) != 0) {
+		return;
+	}
+
+	old = atomic_fetch_or_explicit(&ver->inner_state,
+		(uint64_t)INNER_F_FINALIZED, memory_order_acq_rel);
+
+	if ((uint32_t)old & INNER_F_FINALIZED) {
+		errmsg("Double finalize detected\n");
+		abort();
+	}
+
+	finalize_and_free(ver);
+}
+
+/*
+ * Atomically detach and subtract outer refs from the inner counter.
+ *
+ * The DETACHED flag and counter adjustment must be committed together to
+ * avoid intermediate states that could lead to premature reclamation.
+ */
+static inline void detach_and_adjust(struct atomsnap_version *ver,
+	uint32_t old_refs)
+{
+	uint64_t cur, next;
+	uint32_t cnt, flags;
+	uint32_t new_cnt, new_flags;
+
+	cur = atomic_load_explicit(&ver->inner_state, memory_order_acquire);
+
+	for (;;) {
+		cnt = inner_cnt(cur);
+		flags = inner_flags(cur);
+
+		new_cnt = (uint32_t)(cnt - old_refs);
+		new_flags = flags | INNER_F_DETACHED;
+
+		next = ((uint64_t)new_cnt << INNER_CNT_SHIFT) |
+			(uint64_t)new_flags;
+
+		if (atomic_compare_exchange_weak_explicit(&ver->inner_state,
+				&cur, next, memory_order_acq_rel,
+				memory_order_acquire)) {
+			break;
+		}
+	}
+
+	try_finalize(ver, next);
+}
+
+/*
+ * Single-writer variant of detach_and_adjust().
+ *
+ * Publishes are serialized, so the version is detached exactly once and
+ * DETACHED is still clear: adding it cannot carry into the other flags,
+ * and flag and counter are committed by one fetch_add.
+ */
+static inline void detach_single(struct atomsnap_version *ver,
+	uint32_t old_refs)
+{
+	uint64_t delta, prev;
+
+	delta = ((uint64_t)(uint32_t)(0u - old_refs) << INNER_CNT_SHIFT) |
+		(uint64_t)INNER_F_DETACHED;
+	prev = atomic_fetch_add_explicit(&ver->inner_state, delta,
+		memory_order_acq_rel);
+
+	try_finalize(ver, prev + delta);
+}
+
+/**
+ * @brief   Check whether any thread protects the given handle.
+ *
+ * Walks the hazard slots of every registered thread context. Pairs with the
+ * seq_cst store/validate sequence in hazard_acquire().
+ *
+ * @param   handle: Handle of the retired version.
+ *
+ * @return  true if some reader still holds the handle, false otherwise.
+ */
+static bool hazard_is_protected(uint32_t handle)
+{
+	struct thread_context *ctx;
+	int limit, tid, i;
+
+	limit = atomic_load(&g_tid_limit);
+
+	for (tid = 0; tid < limit; tid++) {
+		ctx = tid_ctx(tid);
+		if (ctx == NULL) {
+			continue;
+		}
+
+		for (i = 0; i < ATOMSNAP_HAZARD_SLOTS; i++) {
+			if (atomic_load(&ctx->hazards[i]) == handle) {
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+/**
+ * @brief   Push a version onto the gate's retire stack.
+ *
+ * @param   gate: Hazard-mode gate.
+ * @param   ver:  Detached version.
+ */
+static inline void hazard_push_retired(struct atomsnap_gate *gate,
+	struct atomsnap_version *ver)
+{
+	uint32_t old_head;
+
+	old_head = atomic_load_explicit(&gate->retired_head,
+		memory_order_relaxed);
+	do {
+		ver->retire.next = old_head;
+	} while (!atomic_compare_exchange_weak_explicit(&gate->retired_head,
+		&old_head, ver->self_handle, memory_order_release,
+		memory_order_relaxed));
+}
+
+/**
+ * @brief   Reclaim every retired version that no reader protects.
+ *
+ * Detaches the whole retire stack, finalizes unprotected versions and
+ * pushes the protected ones back.
+ *
+ * @param   gate:  Hazard-mode gate.
+ * @param   force: Reclaim without scanning (gate teardown).
+ */
+static void hazard_scan(struct atomsnap_gate *gate, bool force)
+{
+	struct atomsnap_version *ver;
+	uint32_t handle, reclaimed = 0;
+
+	handle = atomic_exchange_explicit(&gate->retired_head, HANDLE_NULL,
+		memory_order_acquire);
+
+	while (handle != HANDLE_NULL) {
+		ver = resolve_handle(handle);
+		handle = ver->retire.next;
+
+		if (!force && hazard_is_protected(ver->self_handle)) {
+			hazard_push_retired(gate, ver);
+			continue;
+		}
+
+		finalize_and_free(ver);
+		reclaimed++;
+	}
+
+	atomic_fetch_sub_explicit(&gate->retired_cnt, reclaimed,
+		memory_order_relaxed);
+}
+
+/**
+ * @brief   Retire a version detached from a hazard-mode gate.
+ *
+ * @param   gate: Hazard-mode gate.
+ * @param   ver:  Detached version.
+ */
+static void hazard_retire(struct atomsnap_gate *gate,
+	struct atomsnap_version *ver)
+{
+	uint32_t cnt;
+
+	hazard_push_retired(gate, ver);
+
+	cnt = atomic_fetch_add_explicit(&gate->retired_cnt, 1,
+		memory_order_relaxed) + 1;
+
+	if (cnt >= ATOMSNAP_HAZARD_SCAN_THRESHOLD) {
+		/* Order the control block swap before reading hazards */
+		atomic_thread_fence(memory_order_seq_cst);
+		hazard_scan(gate, false);
+	}
+}
+
+/**
+ * @brief   Publish a hazard for the current version of a slot.
+ *
+ * The handle is stored in a free hazard slot and the control block is read
+ * again. If the handle is unchanged, the writer that replaces it is
+ * guaranteed to observe the hazard during its scan.
+ *
+ * @param   cb: Control block of the slot.
+ *
+ * @return  Pointer to the protected version, or NULL.
+ */
+static struct atomsnap_version *hazard_acquire(_Atomic(uint64_t) *cb)
+{
+	struct thread_context *ctx = get_or_init_thread_context();
+	_Atomic(uint32_t) *hp = NULL;
+	uint32_t handle, cur;
+	int i;
+
+	if (ctx == NULL) {
+		return NULL;
+	}
+
+	for (i = 0; i < ATOMSNAP_HAZARD_SLOTS; i++) {
+		if (atomic_load_explicit(&ctx->hazards[i],
+				memory_order_relaxed) == HANDLE_NULL) {
+			hp = &ctx->hazards[i];
+			break;
+		}
+	}
+
+	if (hp == NULL) {
+		errmsg("Hazard slots exhausted (%d)\n", ATOMSNAP_HAZARD_SLOTS);
+		return NULL;
+	}
+
+	handle = (uint32_t)(atomic_load_explicit(cb, memory_order_acquire) &
+		HANDLE_MASK_64);
+
+	while (handle != HANDLE_NULL) {
+		atomic_store(hp, handle);
+
+		cur = (uint32_t)(atomic_load(cb) & HANDLE_MASK_64);
+		if (cur == handle) {
+			return resolve_handle(handle);
+		}
+
+		handle = cur;
+	}
+
+	atomic_store_explicit(hp, HANDLE_NULL, memory_order_release);
+	return NULL;
+}
+
+/**
+ * @brief   Drop the hazard that protects @ver.
+ *
+ * @param   ver: Version acquired through hazard_acquire().
+ */
+static void hazard_release(struct atomsnap_version *ver)
+{
+	struct thread_context *ctx = get_or_init_thread_context();
+	int i;
+
+	if (ctx == NULL) {
+		return;
+	}
+
+	for (i = ATOMSNAP_HAZARD_SLOTS - 1; i >= 0; i--) {
+		if (atomic_load_explicit(&ctx->hazards[i],
+				memory_order_relaxed) == ver->self_handle) {
+			atomic_store_explicit(&ctx->hazards[i], HANDLE_NULL,
+				memory_order_release);
+			return;
+		}
+	}
+
+	errmsg("Releasing a version that is not protected\n");
+}
+
+/**
+ * @brief   Report a quiescent state for the given thread context.
+ *
+ * @param   ctx: Thread context.
+ */
+static inline void qsbr_report(struct thread_context *ctx)
+{
+	atomic_store(&ctx->qsbr_epoch, atomic_load(&g_qsbr_epoch));
+}
+
+/**
+ * @brief   Check whether a thread is online for QSBR gates.
+ *
+ * @param   ctx: Thread context.
+ *
+ * @return  true if the thread holds back grace periods.
+ */
+static inline bool qsbr_online(struct thread_context *ctx)
+{
+	return atomic_load_explicit(&ctx->qsbr_epoch, memory_order_relaxed) != 0;
+}
+
+/**
+ * @brief   Find the oldest epoch reported by any online thread.
+ *
+ * @return  Minimum reported epoch, or the current epoch if no thread is
+ *          online.
+ */
+static uint64_t qsbr_min_epoch(void)
+{
+	struct thread_context *ctx;
+	uint64_t min, e;
+	int limit, tid;
+
+	/* Every retire epoch handed out so far is at most the current one */
+	min = atomic_load(&g_qsbr_epoch);
+	limit = atomic_load(&g_tid_limit);
+
+	for (tid = 0; tid < limit; tid++) {
+		ctx = tid_ctx(tid);
+		if (ctx == NULL) {
+			continue;
+		}
+
+		e = atomic_load(&ctx->qsbr_epoch);
+		if (e != 0 && e < min) {
+			min = e;
+		}
+	}
+
+	return min;
+}
+
+/**
+ * @brief   Drop one limbo reference of a QSBR gate.
+ *
+ * The gate memory is freed here if the gate was destroyed while versions
+ * were still waiting for a grace period.
+ *
+ * @param   gate: QSBR gate.
+ */
+static inline void qsbr_gate_put(struct atomsnap_gate *gate)
+{
+	uint32_t prev;
+
+	prev = atomic_fetch_sub_explicit(&gate->qsbr_pending, 1,
+		memory_order_acq_rel);
+
+	if (prev == (QSBR_GATE_DEAD | 1)) {
+		free_gate(gate);
+	}
+}
+
+/**
+ * @brief   Reclaim limbo versions whose grace period has elapsed.
+ *
+ * @param   ctx:  Thread context owning the limbo list.
+ * @param   wait: Keep retrying until the limbo list is below
+ *                ATOMSNAP_QSBR_LIMBO_MAX. Only for offline threads, whose
+ *                own epoch does not hold the grace period back.
+ */
+static void qsbr_reclaim(struct thread_context *ctx, bool wait)
+{
+	struct atomsnap_version *ver;
+	struct atomsnap_gate *gate;
+	uint64_t min;
+
+	for (;;) {
+		min = qsbr_min_epoch();
+
+		while (ctx->limbo_head != HANDLE_NULL) {
+			ver = resolve_handle(ctx->limbo_head);
+
+			/*
+			 * Retire epochs are truncated to 32 bits. Offline
+			 * writers stall at ATOMSNAP_QSBR_LIMBO_MAX, and an
+			 * online one would run out of memory long before
+			 * holding 2^31 versions in limbo, so the distance to
+			 * min stays below 2^31 and the signed difference is
+			 * exact.
+			 */
+			if ((int32_t)(ver->retire.epoch - (uint32_t)min) > 0) {
+				break;
+			}
+
+			ctx->limbo_head = ver->retire.next;
+			ctx->limbo_cnt--;
+
+			gate = version_gate(ver);
+			finalize_and_free(ver);
+			qsbr_gate_put(gate);
+		}
+
+		if (ctx->limbo_head == HANDLE_NULL) {
+			ctx->limbo_tail = HANDLE_NULL;
+		}
+
+		if (!wait || ctx->limbo_cnt < ATOMSNAP_QSBR_LIMBO_MAX) {
+			break;
+		}
+
+		sched_yield();
+	}
+}
+
+/**
+ * @brief   Retire a version detached from a QSBR gate.
+ *
+ * The version is stamped with a new epoch and appended to the caller's
+ * limbo list. Publishing is not a quiescent state: an online caller may
+ * still use versions it acquired before, so it does not wait at
+ * ATOMSNAP_QSBR_LIMBO_MAX for a grace period its own epoch holds back.
+ * Its list drains at the first scan after its next quiescent state.
+ * Threads that only publish stay offline and are bounded.
+ *
+ * @param   gate: QSBR gate.
+ * @param   ver:  Detached version.
+ */
+static void qsbr_retire(struct atomsnap_gate *gate,
+	struct atomsnap_version *ver)
+{
+	struct thread_context *ctx = get_or_init_thread_context();
+	struct atomsnap_version *tail;
+	uint64_t epoch;
+
+	if (ctx == NULL) {
+		errmsg("Cannot retire without a thread context\n");
+		return;
+	}
+
+	atomic_fetch_add_explicit(&gate->qsbr_pending, 1,
+		memory_order_relaxed);
+
+	epoch = atomic_fetch_add(&g_qsbr_epoch, 1) + 1;
+	ver->retire.epoch = (uint32_t)epoch;
+	ver->retire.next = HANDLE_NULL;
+	if (ctx->limbo_tail == HANDLE_NULL) {
+		ctx->limbo_head = ver->self_handle;
+	} else {
+		tail = resolve_handle(ctx->limbo_tail);
+		tail->retire.next = ver->self_handle;
+	}
+	ctx->limbo_tail = ver->self_handle;
+	ctx->limbo_cnt++;
+
+	if (ctx->limbo_cnt >= ATOMSNAP_QSBR_LIMBO_MAX) {
+		qsbr_reclaim(ctx, !qsbr_online(ctx));
+	} else if ((ctx->limbo_cnt % ATOMSNAP_QSBR_SCAN_INTERVAL) == 0) {
+		qsbr_reclaim(ctx, false);
+	}
+}
+
+/**
+ * @brief   Read the current version of a QSBR slot.
+ *
+ * Brings the calling thread online if needed. The returned version stays
+ * valid until the thread reports a quiescent state.
+ *
+ * @param   cb: Control block of the slot.
+ *
+ * @return  Pointer to the current version, or NULL.
+ */
+static struct atomsnap_version *qsbr_acquire(_Atomic(uint64_t) *cb)
+{
+	struct thread_context *ctx = get_or_init_thread_context();
+
+	if (ctx == NULL) {
+		return NULL;
+	}
+
+	if (__builtin_expect(atomic_load_explicit(&ctx->qsbr_epoch,
+			memory_order_relaxed) == 0, 0)) {
+		qsbr_report(ctx);
+	}
+
+	return resolve_handle((uint32_t)(atomic_load(cb) & HANDLE_MASK_64));
+}
+
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield");
+#else
+	atomic_signal_fence(memory_order_seq_cst);
+#endif
+}
+
+/**
+ * @brief   Wait after a failed publish, doubling the wait each time.
+ *
+ * @param   backoff: Pause iterations for this round, updated in place.
+ */
+static inline void backoff_wait(uint32_t *backoff)
+{
+	uint32_t i;
+
+	if (*backoff >= ATOMSNAP_BACKOFF_MAX) {
+		sched_yield();
+		return;
+	}
+
+	for (i = 0; i < *backoff; i++) {
+		cpu_relax();
+	}
+
+	*backoff <<= 1;
+}
+
+/**
+ * @brief   Detach a version pushed out of a history ring.
+ *
+ * @param   gate:  Gate with a history.
+ * @param   entry: Ring entry value taken out of the ring.
+ */
+static inline void history_evict(struct atomsnap_gate *gate, uint64_t entry)
+{
+	struct atomsnap_version *ver = resolve_handle(
+		(uint32_t)(entry & HANDLE_MASK_64));
+	uint32_t refs = (uint32_t)((entry & REF_COUNT_MASK) >> REF_COUNT_SHIFT);
+
+	if (ver == NULL) {
+		return;
+	}
+
+	if (gate->flags & ATOMSNAP_GATE_SINGLE_WRITER) {
+		detach_single(ver, refs);
+	} else {
+		detach_and_adjust(ver, refs);
+	}
+}
+
+/**
+ * @brief   Move a replaced version into the history ring of its slot.
+ *
+ * The ring entry takes over the outer references collected from the slot,
+ * so the version stays attached while it is in the ring. The version
+ * pushed out of the ring is detached, and is reclaimed once its readers
+ * are gone.
+ *
+ * @param   gate:     Gate with a history.
+ * @param   slot_idx: Slot the version was replaced in.
+ * @param   ver:      Replaced version.
+ * @param   old_refs: Outer reference count collected from the slot.
+ */
+static void history_push(struct atomsnap_gate *gate, int slot_idx,
+	struct atomsnap_version *ver, uint32_t old_refs)
+{
+	struct atomsnap_history *hist = &gate->history[slot_idx];
+	uint32_t backoff = 1;
+	uint64_t seq, evicted;
+
+	/* Taking seq from even to odd serializes the slot's writers */
+	seq = atomic_load_explicit(&hist->seq, memory_order_relaxed);
+	while (1) {
+		if (!(seq & 1) && atomic_compare_exchange_weak_explicit(
+				&hist->seq, &seq, seq + 1,
+				memory_order_acquire, memory_order_relaxed)) {
+			break;
+		}
+
+		backoff_wait(&backoff);
+		seq = atomic_load_explicit(&hist->seq, memory_order_relaxed);
+	}
+
+	/* Push number k (from 0) goes to entry k % depth */
+	evicted = atomic_exchange_explicit(&hist->ring[(seq >> 1) %
+			(uint64_t)gate->history_depth],
+		((uint64_t)old_refs << REF_COUNT_SHIFT) | ver->self_handle,
+		memory_order_acq_rel);
+
+	atomic_store_explicit(&hist->seq, seq + 2, memory_order_release);
+
+	history_evict(gate, evicted);
+}
+
+/**
+ * @brief   Detach the old version of a slot after a successful publish.
+ *
+ * @param   gate:     Gate the version was published in.
+ * @param   slot_idx: Slot the version was replaced in.
+ * @param   old_ver:  Version that was replaced (may be NULL).
+ * @param   old_refs: Outer reference count collected from the control block.
+ */
+static inline void detach_version(struct atomsnap_gate *gate, int slot_idx,
+	struct atomsnap_version *old_ver, uint32_t old_refs)
+{
+	if (old_ver == NULL) {
+		return;
+	}
+
+	if (gate->flags & ATOMSNAP_GATE_HAZARD) {
+		hazard_retire(gate, old_ver);
+		return;
+	} else if (gate->flags & ATOMSNAP_GATE_QSBR) {
+		qsbr_retire(gate, old_ver);
+		return;
+	}
+
+	/* Detached when it leaves the history ring */
+	if (gate->history != NULL) {
+		history_push(gate, slot_idx, old_ver, old_refs);
+		return;
+	}
+
+	if (gate->flags & ATOMSNAP_GATE_SINGLE_WRITER) {
+		detach_single(old_ver, old_refs);
+	} else {
+		detach_and_adjust(old_ver, old_refs);
+	}
+}
+
+/**
+ * @brief   Explicitly initialize the atomsnap library globals.
+ *
+ * Optional; usually called lazily.
+ */
+int atomsnap_global_init(void)
+{
+	pthread_once(&g_init_once, global_init_routine);
+	return 0;
+}
+
+/**
+ * @brief   Internal thread initialization.
+ *
+ * Acquires a global thread ID and allocates/adopts a thread context.
+ *
+ * @return  0 on success, -1 on failure.
+ */
+static int atomsnap_thread_init_internal(void)
+{
+	struct thread_context *ctx;
+	int tid, i, limit;
+
+	/* 1. Acquire Thread ID: a released one first, then a fresh one */
+	tid = tid_pop();
+	if (tid == -1) {
+		tid = tid_fresh();
+	}
+	if (tid == -1) {
+		/* All IDs handed out; one may have been released meanwhile */
+		tid = tid_pop();
+	}
+
+	if (tid == -1) {
+		errmsg("Max threads limit reached (%d)\n", MAX_THREADS);
+		return -1;
+	}
+
+	/* 2. Adoption or New Allocation */
+	ctx = tid_ctx(tid);
+	if (ctx == NULL) {
+		/* New Allocation */
+		ctx = calloc(1, sizeof(struct thread_context));
+		if (ctx == NULL) {
+			errmsg("Failed to allocate thread context\n");
+			tid_push(tid);
+			return -1;
+		}
+		ctx->thread_id = tid;
+		for (i = 0; i < ATOMSNAP_SIZE_CLASSES; i++) {
+			ctx->pools[i].cls = (unsigned int)i;
+			ctx->pools[i].local_top = HANDLE_NULL;
+		}
+		ctx->limbo_head = HANDLE_NULL;
+		ctx->limbo_tail = HANDLE_NULL;
+		for (i = 0; i < ATOMSNAP_HAZARD_SLOTS; i++) {
+			atomic_init(&ctx->hazards[i], HANDLE_NULL);
+		}
+		tid_chunk_of(tid)->ctx[tid & (TID_CHUNK - 1)] = ctx;
+
+		/* Publish the context to hazard scanners */
+		limit = atomic_load(&g_tid_limit);
+		while (limit <= tid) {
+			if (atomic_compare_exchange_weak(&g_tid_limit,
+					&limit, tid + 1)) {
+				break;
+			}
+		}
+	} else {
+		/*
+		 * Adoption: Reuse existing context and arenas. The exiting
+		 * thread closed the ready lists; frees that still find them
+		 * closed release their arena themselves.
+		 */
+		for (i = 0; i < ATOMSNAP_SIZE_CLASSES; i++) {
+			atomic_store(&ctx->pools[i].ready_top, 0);
+		}
+	}
+
+	/* 3. Set TLS (the key value only drives the destructor) */
+	if (pthread_setspecific(g_tls_key, ctx) != 0) {
+		errmsg("Failed to set TLS value\n");
+		return -1;
+	}
+	g_tls_ctx = ctx;
+
+	return 0;
+}
+
+static inline _Atomic(uint64_t) *get_cb_slot(struct atomsnap_gate *gate,
+	int idx)
+{
+	return atomsnap_cb_slot(gate, idx);
+}
+
+/**
+ * @brief   Pick the replica for the calling thread's current CPU.
+ *
+ * @param   gate: Replicated gate.
+ *
+ * @return  Control block index of the replica.
+ */
+static inline int replica_index(struct atomsnap_gate *gate)
+{
+	int cpu = sched_getcpu();
+
+	if (__builtin_expect(cpu < 0, 0)) {
+		cpu = 0;
+	}
+
+	return cpu % (gate->num_extra_slots + 1);
+}
+
+/**
+ * @brief   Publish a handle into every replica of a replicated gate.
+ *
+ * Must be called with replica_lock held, so all replicas hold the same
+ * version before and after the call.
+ *
+ * @param   gate:       Replicated gate.
+ * @param   new_handle: Handle to publish.
+ * @param   old_refs:   Out: outer refcounts summed over all replicas.
+ *
+ * @return  Handle that was replaced.
+ */
+static uint32_t replica_fan_out(struct atomsnap_gate *gate,
+	uint32_t new_handle, uint32_t *old_refs)
+{
+	uint64_t old_val;
+	uint32_t old_handle = HANDLE_NULL, refs = 0;
+	int i;
+
+	for (i = 0; i <= gate->num_extra_slots; i++) {
+		old_val = atomic_exchange(get_cb_slot(gate, i),
+			(uint64_t)new_handle);
+
+		assert(i == 0 ||
+			(uint32_t)(old_val & HANDLE_MASK_64) == old_handle);
+
+		old_handle = (uint32_t)(old_val & HANDLE_MASK_64);
+		refs += (uint32_t)((old_val & REF_COUNT_MASK) >>
+			REF_COUNT_SHIFT);
+	}
+
+	*old_refs = refs;
+	return old_handle;
+}
+
+/*
+ * Distance in words between the per-slot words of gate->generations and
+ * gate->sequences: a whole line, whatever the control block stride.
+ */
+static inline size_t line_words(struct atomsnap_gate *gate)
+{
+	return ((gate->flags & ATOMSNAP_GATE_WIDE_LINES) ?
+		WIDE_LINE_SIZE : CACHE_LINE_SIZE) / sizeof(uint64_t);
+}
+
+/**
+ * @brief   Get the publish counter of a slot.
+ *
+ * The counters are a line apart, so a publish to one slot never
+ * invalidates the line a poller of another reads.
+ *
+ * @param   gate:     Target gate.
+ * @param   slot_idx: Control block slot index.
+ *
+ * @return  Pointer to the slot's counter.
+ */
+static inline _Atomic(uint64_t) *slot_generation(struct atomsnap_gate *gate,
+	int slot_idx)
+{
+	return &gate->generations[(size_t)slot_idx * line_words(gate)];
+}
+
+/**
+ * @brief   Get the atomsnap_publish_if_newer() claim word of a slot.
+ *
+ * A line apart like the publish counters, so writers claiming one slot
+ * do not contend with those claiming another.
+ *
+ * @param   gate:     Target gate.
+ * @param   slot_idx: Control block slot index.
+ *
+ * @return  Pointer to the slot's highest claimed sequence.
+ */
+static inline _Atomic(uint64_t) *slot_sequence(struct atomsnap_gate *gate,
+	int slot_idx)
+{
+	return &gate->sequences[(size_t)slot_idx * line_words(gate)];
+}
+
+/**
+ * @brief   Count a publish into a slot.
+ *
+ * Runs after the control block has been updated, so a poller that sees the
+ * new generation acquires the new version or a later one.
+ *
+ * @param   gate:     Target gate.
+ * @param   slot_idx: Published slot (0 for replicated gates).
+ */
+static inline void bump_generation(struct atomsnap_gate *gate, int slot_idx)
+{
+	_Atomic(uint64_t) *gen = slot_generation(gate, slot_idx);
+
+	if (gate->flags & ATOMSNAP_GATE_SINGLE_WRITER) {
+		atomic_store_explicit(gen, atomic_load_explicit(gen,
+			memory_order_relaxed) + 1, memory_order_release);
+		return;
+	}
+
+	atomic_fetch_add_explicit(gen, 1, memory_order_release);
+}
+
+/**
+ * @brief   Stamp a version that is about to replace @old_ver in a slot.
+ *
+ * The stamp is one more than the replaced version's, so publishing needs
+ * no shared counter, and a version only lands over the one it was stamped
+ * from. Runs before the version can be seen, so the stamp is a plain store
+ * that the publishing CAS or exchange releases. The caller keeps @old_ver
+ * in place meanwhile: it holds a reference and CASes against it, holds
+ * the replica lock, or is the only writer. An empty slot continues from
+ * gate->stamp_base (see stamp_empty()).
+ *
+ * @param   gate:     Target gate.
+ * @param   slot_idx: Slot the version is published to.
+ * @param   ver:      Version about to be published (may be NULL).
+ * @param   old_ver:  Version it replaces (may be NULL).
+ */
+static inline void stamp_version(struct atomsnap_gate *gate, int slot_idx,
+	struct atomsnap_version *ver, struct atomsnap_version *old_ver)
+{
+	uint64_t prev;
+
+	if (!(gate->flags & ATOMSNAP_GATE_STAMPED) || ver == NULL) {
+		return;
+	}
+
+	prev = old_ver ? *version_stamp(old_ver) :
+		atomic_load_explicit(&gate->stamp_base[slot_idx],
+			memory_order_relaxed);
+	*version_stamp(ver) = prev + 1;
+}
+
+/**
+ * @brief   Remember the last stamp of a slot that was just emptied.
+ *
+ * Called after NULL replaced @old_ver, with the replica lock held (or by
+ * the only writer), which also covers every publish over an empty slot.
+ *
+ * @param   gate:     Target gate.
+ * @param   slot_idx: Emptied slot.
+ * @param   old_ver:  Version that was replaced (may be NULL).
+ */
+static inline void stamp_empty(struct atomsnap_gate *gate, int slot_idx,
+	struct atomsnap_version *old_ver)
+{
+	if (!(gate->flags & ATOMSNAP_GATE_STAMPED) || old_ver == NULL) {
+		return;
+	}
+
+	atomic_store_explicit(&gate->stamp_base[slot_idx],
+		*version_stamp(old_ver), memory_order_relaxed);
+}
+
+/**
+ * @brief   Current version of a slot, as its writers see it.
+ *
+ * Only stable while other writers are excluded (replica lock held or a
+ * single-writer gate).
+ *
+ * @param   gate:     Target gate.
+ * @param   slot_idx: Slot index.
+ *
+ * @return  Current version, or NULL if the slot is empty.
+ */
+static inline struct atomsnap_version *writer_current(
+	struct atomsnap_gate *gate, int slot_idx)
+{
+	if (gate->flags & ATOMSNAP_GATE_SINGLE_WRITER) {
+		return gate->sw_current[slot_idx];
+	}
+
+	return resolve_handle((uint32_t)(atomic_load_explicit(
+		get_cb_slot(gate, slot_idx), memory_order_relaxed) &
+		HANDLE_MASK_64));
+}
+
+/**
+ * @brief   Replace the writer's cached version of a slot.
+ *
+ * Single-writer gates only. Saves resolving the handle that the exchange
+ * returned.
+ *
+ * @param   gate:     Target gate.
+ * @param   slot_idx: Published slot (0 for replicated gates).
+ * @param   new_ver:  Version that was just published.
+ *
+ * @return  Version that was replaced.
+ */
+static inline struct atomsnap_version *sw_swap(struct atomsnap_gate *gate,
+	int slot_idx, struct atomsnap_version *new_ver)
+{
+	struct atomsnap_version *old_ver = gate->sw_current[slot_idx];
+
+	gate->sw_current[slot_idx] = new_ver;
+	return old_ver;
+}
+
+/**
+ * @brief   Wait until a control block is no longer parked on HANDLE_BUSY.
+ *
+ * @param   cb:  Control block of an ATOMSNAP_GATE_IN_PLACE gate.
+ * @param   val: Last value loaded from @cb.
+ *
+ * @return  A value of @cb with a regular handle.
+ */
+static uint64_t wait_not_busy(_Atomic(uint64_t) *cb, uint64_t val)
+{
+	uint32_t backoff = 1;
+
+	while ((uint32_t)(val & HANDLE_MASK_64) == ATOMSNAP_HANDLE_BUSY) {
+		backoff_wait(&backoff);
+		val = atomic_load_explicit(cb, memory_order_acquire);
+	}
+
+	return val;
+}
+
+/* Single-writer gates have nothing to serialize */
+static inline void replica_lock(struct atomsnap_gate *gate)
+{
+	if (gate->flags & ATOMSNAP_GATE_SINGLE_WRITER) {
+		return;
+	}
+
+	while (atomic_exchange_explicit(&gate->replica_lock, true,
+			memory_order_acquire)) {
+		sched_yield();
+	}
+}
+
+static inline void replica_unlock(struct atomsnap_gate *gate)
+{
+	if (gate->flags & ATOMSNAP_GATE_SINGLE_WRITER) {
+		return;
+	}
+
+	atomic_store_explicit(&gate->replica_lock, false, memory_order_release);
+}
+
+/**
+ * @brief   Publish to a slot of a stamped gate that has several writers.
+ *
+ * The current version is held while the new one is stamped from it, so
+ * it cannot be recycled in between, and the CAS only lands while it is
+ * still current. Transitions from or to an empty slot take the replica
+ * lock, so an empty slot cannot be refilled and emptied again behind a
+ * writer that continues from gate->stamp_base.
+ *
+ * @param   gate:     Stamped gate without ATOMSNAP_GATE_SINGLE_WRITER or
+ *                    ATOMSNAP_GATE_REPLICATED.
+ * @param   slot_idx: Control block slot index.
+ * @param   new_ver:  Version to publish (may be NULL).
+ * @param   match:    Only publish over @expected.
+ * @param   expected: Expected current version if @match is set.
+ * @param   claim:    Only publish while it still holds @seq (may be NULL).
+ * @param   seq:      Sequence claimed by the caller.
+ *
+ * @return  true if @new_ver was published, false if a condition failed.
+ */
+static bool stamped_publish(struct atomsnap_gate *gate, int slot_idx,
+	struct atomsnap_version *new_ver, bool match,
+	struct atomsnap_version *expected, _Atomic(uint64_t) *claim,
+	uint64_t seq)
+{
+	uint32_t new_handle = new_ver ? new_ver->self_handle : HANDLE_NULL;
+	_Atomic(uint64_t) *cb = get_cb_slot(gate, slot_idx);
+	struct atomsnap_version *cur;
+	uint32_t cur_handle, old_refs, backoff = 1;
+	uint64_t val = 0;
+	bool locked, done, ok;
+
+	while (1) {
+		cur = atomsnap_acquire_version_slot(gate, slot_idx);
+		cur_handle = cur ? cur->self_handle : HANDLE_NULL;
+
+		locked = (cur == NULL || new_ver == NULL);
+		if (locked) {
+			replica_lock(gate);
+		}
+
+		ok = false;
+		done = (match && cur != expected) || (claim != NULL &&
+			atomic_load_explicit(claim, memory_order_seq_cst) != seq);
+		if (!done) {
+			stamp_version(gate, slot_idx, new_ver, cur);
+
+			/* Retry while only the reference count changes */
+			val = atomic_load_explicit(cb, memory_order_seq_cst);
+			do {
+				val = wait_not_busy(cb, val);
+				if ((uint32_t)(val & HANDLE_MASK_64) != cur_handle) {
+					break;
+				}
+				ok = atomic_compare_exchange_weak_explicit(cb, &val,
+					(uint64_t)new_handle, memory_order_seq_cst,
+					memory_order_seq_cst);
+			} while (!ok);
+			done = ok;
+		}
+
+		if (ok && new_ver == NULL) {
+			stamp_empty(gate, slot_idx, cur);
+		}
+		if (locked) {
+			replica_unlock(gate);
+		}
+
+		if (ok) {
+			bump_generation(gate, slot_idx);
+			old_refs = (uint32_t)((val & REF_COUNT_MASK) >>
+				REF_COUNT_SHIFT);
+			detach_version(gate, slot_idx, cur, old_refs);
+		}
+
+		atomsnap_release_version(cur);
+
+		if (done) {
+			return ok;
+		}
+
+		backoff_wait(&backoff);
+	}
+}
+
+/*
+ * Merged versions of a write-sharded gate carry the shard token they were
+ * built from behind the object: [ object | pad to 8 | token ].
+ */
+static inline size_t merged_size(size_t object_size)
+{
+	return ALIGN_UP(object_size, sizeof(uint64_t)) + sizeof(uint64_t);
+}
+
+static inline uint64_t *merged_token(struct atomsnap_gate *gate,
+	struct atomsnap_version *ver)
+{
+	return (uint64_t *)((char *)version_payload(ver) +
+		ALIGN_UP(gate->object_size, sizeof(uint64_t)));
+}
+
+/**
+ * @brief   Create a new atomsnap_gate.
+ *
+ * @param   ctx: Initialization context containing callback pointers.
+ *
+ * @return  Pointer to the new gate, or NULL on failure.
+ */
+struct atomsnap_gate *atomsnap_init_gate(struct atomsnap_init_context *ctx)
+{
+	size_t line = (ctx->flags & ATOMSNAP_GATE_WIDE_LINES) ?
+		WIDE_LINE_SIZE : CACHE_LINE_SIZE;
+	_Atomic(uint64_t) *ring = NULL;
+	struct atomsnap_gate *gate;
+	int i;
+
+	/* Keep the primary control block off other gates' lines */
+	gate = aligned_alloc(line, ALIGN_UP(sizeof(struct atomsnap_gate), line));
+	if (gate == NULL) {
+		errmsg("Gate allocation failed\n");
+		return NULL;
+	}
+	memset(gate, 0, sizeof(struct atomsnap_gate));
+
+	gate->free_impl = ctx->free_impl;
+	gate->num_extra_slots = ctx->num_extra_control_blocks;
+	gate->flags = ctx->flags;
+	atomic_init(&gate->retired_head, HANDLE_NULL);
+	atomic_init(&gate->retired_cnt, 0);
+	atomic_init(&gate->qsbr_pending, 0);
+
+	if ((gate->flags & ATOMSNAP_GATE_HAZARD) &&
+			(gate->flags & ATOMSNAP_GATE_QSBR)) {
+		errmsg("Hazard and QSBR modes are exclusive\n");
+		free(gate);
+		return NULL;
+	}
+
+	if (gate->free_impl == NULL) {
+		errmsg("Invalid free function\n");
+		free(gate);
+		return NULL;
+	}
+
+	if (ctx->object_size > ATOMSNAP_INLINE_PAYLOAD_MAX ||
+			(ctx->object_size == 0 &&
+				(gate->flags & ATOMSNAP_GATE_COMBINING))) {
+		errmsg("Invalid object size (%zu)\n", ctx->object_size);
+		free(gate);
+		return NULL;
+	}
+	gate->object_size = ctx->object_size;
+
+	if ((gate->flags & ATOMSNAP_GATE_SINGLE_WRITER) &&
+			(gate->flags & ATOMSNAP_GATE_COMBINING)) {
+		errmsg("Combining gates have several writers\n");
+		free(gate);
+		return NULL;
+	}
+
+	if ((gate->flags & ATOMSNAP_GATE_WRITE_SHARDED) &&
+			(gate->num_extra_slots < 1 ||
+			 gate->num_extra_slots > ATOMSNAP_MAX_SHARDS ||
+			 ctx->object_size == 0 ||
+			 merged_size(ctx->object_size) >
+				ATOMSNAP_INLINE_PAYLOAD_MAX ||
+			 (gate->flags & (ATOMSNAP_GATE_HAZARD |
+				ATOMSNAP_GATE_REPLICATED)))) {
+		errmsg("Invalid write-sharded gate configuration\n");
+		free(gate);
+		return NULL;
+	}
+
+	/* Readers publish the merged cache, so there is always more than one */
+	if ((gate->flags & ATOMSNAP_GATE_WRITE_SHARDED) &&
+			(gate->flags & ATOMSNAP_GATE_SINGLE_WRITER)) {
+		errmsg("Write-sharded gates have several writers\n");
+		free(gate);
+		return NULL;
+	}
+
+	/* History references live in the inner counter */
+	if (ctx->history_depth < 0 ||
+			ctx->history_depth > ATOMSNAP_MAX_HISTORY ||
+			(ctx->history_depth > 0 && (gate->flags &
+				(ATOMSNAP_GATE_HAZARD | ATOMSNAP_GATE_QSBR)))) {
+		errmsg("Invalid history depth (%d)\n", ctx->history_depth);
+		free(gate);
+		return NULL;
+	}
+	gate->history_depth = ctx->history_depth;
+
+	/* In-place updates rely on the reference count in the control block */
+	if ((gate->flags & ATOMSNAP_GATE_IN_PLACE) &&
+			(gate->flags & (ATOMSNAP_GATE_HAZARD | ATOMSNAP_GATE_QSBR |
+				ATOMSNAP_GATE_REPLICATED))) {
+		errmsg("In-place updates need a reference counted gate\n");
+		free(gate);
+		return NULL;
+	}
+
+	atomic_init(&gate->replica_lock, false);
+	atomic_init(&gate->fc_head, NULL);
+	atomic_init(&gate->fc_lock, false);
+	atomic_init(&gate->txn_seq, 0);
+
+	/*
+	 * One control block per cache line unless packing was requested.
+	 * Replicas are only useful if they do not share lines, so replicated
+	 * gates ignore ATOMSNAP_GATE_PACKED_SLOTS.
+	 */
+	gate->cb_stride = (int)(line / sizeof(uint64_t));
+	if ((gate->flags & ATOMSNAP_GATE_PACKED_SLOTS) &&
+			!(gate->flags & ATOMSNAP_GATE_REPLICATED)) {
+		gate->cb_stride = 1;
+	}
+
+	gate->generations = aligned_alloc(line,
+		(size_t)(gate->num_extra_slots + 1) * line);
+	if (gate->generations == NULL) {
+		errmsg("Generation counters allocation failed\n");
+		free(gate);
+		return NULL;
+	}
+
+	gate->sequences = aligned_alloc(line,
+		(size_t)(gate->num_extra_slots + 1) * line);
+	if (gate->sequences == NULL) {
+		errmsg("Sequence words allocation failed\n");
+		free(gate->generations);
+		free(gate);
+		return NULL;
+	}
+
+	if (gate->flags & ATOMSNAP_GATE_STAMPED) {
+		gate->stamp_base = calloc((size_t)gate->num_extra_slots + 1,
+			sizeof(_Atomic(uint64_t)));
+		if (gate->stamp_base == NULL) {
+			errmsg("Stamp base allocation failed\n");
+			free(gate->sequences);
+			free(gate->generations);
+			free(gate);
+			return NULL;
+		}
+	}
+
+	if (gate->flags & ATOMSNAP_GATE_SINGLE_WRITER) {
+		gate->sw_current = calloc((size_t)gate->num_extra_slots + 1,
+			sizeof(struct atomsnap_version *));
+		if (gate->sw_current == NULL) {
+			errmsg("Writer cache allocation failed\n");
+			free(gate->stamp_base);
+			free(gate->sequences);
+			free(gate->generations);
+			free(gate);
+			return NULL;
+		}
+	}
+
+	if (gate->history_depth > 0) {
+		gate->history = calloc((size_t)gate->num_extra_slots + 1,
+			sizeof(struct atomsnap_history));
+		ring = malloc((size_t)(gate->num_extra_slots + 1) *
+			gate->history_depth * sizeof(_Atomic(uint64_t)));
+		if (gate->history == NULL || ring == NULL) {
+			errmsg("History allocation failed\n");
+			free(ring);
+			free(gate->history);
+			free(gate->sw_current);
+			free(gate->stamp_base);
+			free(gate->sequences);
+			free(gate->generations);
+			free(gate);
+			return NULL;
+		}
+	}
+
+	for (i = 0; i <= gate->num_extra_slots; i++) {
+		atomic_init(slot_generation(gate, i), 0);
+		atomic_init(slot_sequence(gate, i), 0);
+		if (gate->history != NULL) {
+			atomic_init(&gate->history[i].seq, 0);
+			gate->history[i].ring = ring + i * gate->history_depth;
+		}
+	}
+	for (i = 0; gate->history != NULL &&
+			i < (gate->num_extra_slots + 1) * gate->history_depth; i++) {
+		atomic_init(&ring[i], (uint64_t)HANDLE_NULL);
+	}
+
+	if (gate->num_extra_slots > 0) {
+		gate->extra_control_blocks = aligned_alloc(line,
+			ALIGN_UP((size_t)gate->num_extra_slots * gate->cb_stride *
+				sizeof(_Atomic(uint64_t)), line));
+
+		if (gate->extra_control_blocks == NULL) {
+			errmsg("Extra blocks allocation failed\n");
+			free(ring);
+			free(gate->history);
+			free(gate->sw_current);
+			free(gate->stamp_base);
+			free(gate->sequences);
+			free(gate->generations);
+			free(gate);
+			return NULL;
+		}
+
+		for (i = 0; i < gate->num_extra_slots; i++) {
+			atomic_init(get_cb_slot(gate, i + 1),
+				(uint64_t)HANDLE_NULL);
+		}
+	}
+
+	atomic_init(&gate->control_block, (uint64_t)HANDLE_NULL);
+
+	if (register_gate(gate) != 0) {
+		free(gate->extra_control_blocks);
+		free(ring);
+		free(gate->history);
+		free(gate->sw_current);
+		free(gate->stamp_base);
+		free(gate->sequences);
+		free(gate->generations);
+		free(gate);
+		return NULL;
+	}
+
+	return gate;
+}
+
+/**
+ * @brief   Destroy the atomsnap_gate.
+ *
+ * @param   gate: Gate to destroy.
+ */
+void atomsnap_destroy_gate(struct atomsnap_gate *gate)
+{
+	int i;
+
+	if (gate == NULL) {
+		return;
+	}
+
+	/* Readers are gone; reclaim whatever is still retired */
+	if (gate->flags & ATOMSNAP_GATE_HAZARD) {
+		hazard_scan(gate, true);
+	}
+
+	/* Detach what is left in the history; reclaiming needs the gate */
+	if (gate->history != NULL) {
+		for (i = 0; i < (gate->num_extra_slots + 1) *
+				gate->history_depth; i++) {
+			history_evict(gate, atomic_load_explicit(
+				&gate->history[0].ring[i], memory_order_acquire));
+		}
+		free(gate->history[0].ring);
+		free(gate->history);
+	}
+
+	if (gate->extra_control_blocks) {
+		free(gate->extra_control_blocks);
+	}
+
+	free(gate->generations);
+	free(gate->sequences);
+	free(gate->stamp_base);
+	free(gate->sw_current);
+
+	/*
+	 * Versions still in limbo lists reference the gate. The last one to
+	 * be reclaimed frees it (see qsbr_gate_put()).
+	 */
+	if (gate->flags & ATOMSNAP_GATE_QSBR) {
+		if (atomic_fetch_or_explicit(&gate->qsbr_pending,
+				QSBR_GATE_DEAD, memory_order_acq_rel) != 0) {
+			return;
+		}
+	}
+
+	free_gate(gate);
+}
+
+/**
+ * @brief   Allocate a version slot of a size class.
+ *
+ * @param   gate: Gate to associate with the version.
+ * @param   cls:  Size class (0 for plain versions).
+ *
+ * @return  Pointer to the new version, or NULL on failure.
+ */
+static struct atomsnap_version *make_version_class(struct atomsnap_gate *gate,
+	unsigned int cls)
+{
+	struct thread_context *ctx = get_or_init_thread_context();
+	uint32_t handle;
+	atomsnap_handle_t h;
+	struct atomsnap_version *slot;
+	uint64_t *stamp;
+
+	if (ctx == NULL) {
+		return NULL;
+	}
+
+	handle = alloc_slot(ctx, cls);
+	if (handle == HANDLE_NULL) {
+		return NULL;
+	}
+
+	slot = resolve_handle(handle);
+	assert(slot != NULL);
+
+	/* Initialize slot; payload versions point at their payload */
+	slot->object = (cls == 0) ? NULL : version_payload(slot);
+	slot->free_context = NULL;
+	version_set_gate(slot, gate);
+
+	atomic_store_explicit(&slot->inner_state, 0, memory_order_relaxed);
+
+	/* Only versions of stamped gates ever get a stamp */
+	stamp = version_stamp(slot);
+	if (stamp == NULL && (gate->flags & ATOMSNAP_GATE_STAMPED)) {
+		h.raw = handle;
+		if (arena_stamps_init(h.arena_idx) != 0) {
+			free_slot(slot);
+			return NULL;
+		}
+		stamp = version_stamp(slot);
+	}
+	if (stamp != NULL) {
+		*stamp = 0;
+	}
+
+	return slot;
+}
+
+/**
+ * @brief   Allocate memory for an atomsnap_version.
+ *
+ * Uses the internal memory allocator (arena) to get a version slot.
+ *
+ * @param   gate: Gate to associate with the version.
+ *
+ * @return  Pointer to the new version, or NULL on failure.
+ */
+struct atomsnap_version *atomsnap_make_version(struct atomsnap_gate *gate)
+{
+	return make_version_class(gate, 0);
+}
+
+/**
+ * @brief   Allocate a version with an inline payload.
+ *
+ * The payload is carved from a size-class arena right behind the version
+ * metadata, and the version's object points to it. Readers get it from
+ * atomsnap_get_object() as usual. The payload is released together with
+ * the version, so free_impl is not called for it.
+ *
+ * @param   gate: Gate to associate with the version.
+ * @param   size: Payload size in bytes (1 to ATOMSNAP_INLINE_PAYLOAD_MAX).
+ *
+ * @return  Pointer to the new version, or NULL on failure.
+ */
+struct atomsnap_version *atomsnap_make_version_inline(
+	struct atomsnap_gate *gate, size_t size)
+{
+	unsigned int cls = 1;
+
+	if (size == 0 || size > ATOMSNAP_INLINE_PAYLOAD_MAX) {
+		errmsg("Invalid inline payload size (%zu)\n", size);
+		return NULL;
+	}
+
+	while (((size_t)8 << cls) < size) {
+		cls++;
+	}
+
+	return make_version_class(gate, cls);
+}
+
+/**
+ * @brief   Manually free a version that was created but NEVER exchanged.
+ *
+ * This function is used when a writer creates a version but decides not to
+ * publish it (e.g., CAS failure). It invokes the user-defined free callback
+ * to clean up the object, and then returns the version slot to the pool.
+ *
+ * @param   version: The version to free.
+ */
+void atomsnap_free_version(struct atomsnap_version *version)
+{
+	struct atomsnap_gate *gate;
+	void *obj;
+
+	if (version == NULL) {
+		return;
+	}
+
+	obj = atomic_load_explicit(&version->object, memory_order_relaxed);
+
+	gate = version_gate(version);
+	if (gate && gate->free_impl && !object_is_payload(version, obj)) {
+		gate->free_impl(obj, version->free_context);
+	}
+
+	free_slot(version);
+}
+
+/**
+ * @brief   Set the user object and context for a version.
+ *
+ * @param   ver:          The version.
+ * @param   object:       User object pointer.
+ * @param   free_context: User free context.
+ */
+void atomsnap_set_object(struct atomsnap_version *ver, void *object,
+	void *free_context)
+{
+	if (ver) {
+		ver->free_context = free_context;
+		atomic_store_explicit(&ver->object, object,
+			memory_order_release);
+	}
+}
+
+/**
+ * @brief   Get the user payload object from a version.
+ *
+ * @param   ver: The version pointer.
+ *
+ * @return  Pointer to the user object.
+ */
+void *atomsnap_get_object(const struct atomsnap_version *ver)
+{
+	if (ver) {
+		return atomic_load_explicit(&ver->object,
+			memory_order_acquire);
+	}
+	return NULL;
+}
+
+/**
+ * @brief   Atomically acquire the current version from a slot.
+ *
+ * Increments the outer reference count, publishes a hazard slot on
+ * hazard-mode gates, or performs a plain load on QSBR gates.
+ *
+ * @param   gate:     Target gate.
+ * @param   slot_idx: Control block slot index (0 for default).
+ *
+ * @return  Pointer to the acquired version.
+ */
+struct atomsnap_version *atomsnap_acquire_version_slot(
+	struct atomsnap_gate *gate, int slot_idx)
+{
+	_Atomic(uint64_t) *cb = get_cb_slot(gate, slot_idx);
+	uint64_t val;
+	uint32_t handle;
+
+	if (gate->flags & ATOMSNAP_GATE_REPLICATED) {
+		cb = get_cb_slot(gate, replica_index(gate));
+	}
+
+	if (gate->flags & ATOMSNAP_GATE_HAZARD) {
+		return hazard_acquire(cb);
+	} else if (gate->flags & ATOMSNAP_GATE_QSBR) {
+		return qsbr_acquire(cb);
+	}
+
+	/* Increment Reference Count (Upper 32 bits) */
+	val = atomic_fetch_add_explicit(cb, REF_COUNT_INC,
+		memory_order_acquire);
+
+	handle = (uint32_t)(val & HANDLE_MASK_64);
+
+	/*
+	 * A writer is mutating the version in place. Our increment went to
+	 * the busy word, which the writer discards; just try again.
+	 */
+	while (__builtin_expect(handle == ATOMSNAP_HANDLE_BUSY, 0)) {
+		wait_not_busy(cb, val);
+		val = atomic_fetch_add_explicit(cb, REF_COUNT_INC,
+			memory_order_acquire);
+		handle = (uint32_t)(val & HANDLE_MASK_64);
+	}
+
+	return resolve_handle(handle);
+}
+
+/**
+ * @brief   Generation number of a published version.
+ *
+ * @param   ver: Acquired version.
+ *
+ * @return  Generation, or 0 if @ver is NULL or never published.
+ */
+uint64_t atomsnap_get_generation(struct atomsnap_version *ver)
+{
+	uint64_t *stamp;
+
+	if (ver == NULL) {
+		return 0;
+	}
+
+	stamp = version_stamp(ver);
+	return stamp ? *stamp : 0;
+}
+
+/**
+ * @brief   Acquire a current or recently replaced version of a slot.
+ *
+ * A history entry is acquired like a control block, with an outer
+ * reference on the ring entry that history_evict() settles. The read is
+ * validated against the slot's history seq: if a writer pushed meanwhile,
+ * the entry may no longer be the one asked for, so the reference is
+ * dropped and the read retried.
+ *
+ * @param   gate:     Target gate.
+ * @param   slot_idx: Control block slot index.
+ * @param   back:     0 for the current version, k for the k-th most
+ *                    recently replaced one.
+ *
+ * @return  Acquired version, or NULL.
+ */
+struct atomsnap_version *atomsnap_acquire_version_at(
+	struct atomsnap_gate *gate, int slot_idx, int back)
+{
+	struct atomsnap_history *hist;
+	struct atomsnap_version *ver;
+	uint32_t backoff = 1;
+	uint64_t seq, val;
+
+	if (back == 0) {
+		return atomsnap_acquire_version_slot(gate, slot_idx);
+	}
+
+	if (back < 0 || back > gate->history_depth) {
+		return NULL;
+	}
+
+	hist = &gate->history[slot_idx];
+
+	while (1) {
+		seq = atomic_load_explicit(&hist->seq, memory_order_acquire);
+		if (seq & 1) {
+			backoff_wait(&backoff);
+			continue;
+		}
+
+		if ((seq >> 1) < (uint64_t)back) {
+			return NULL;
+		}
+
+		val = atomic_fetch_add_explicit(&hist->ring[((seq >> 1) - back) %
+				(uint64_t)gate->history_depth], REF_COUNT_INC,
+			memory_order_acquire);
+		ver = resolve_handle((uint32_t)(val & HANDLE_MASK_64));
+
+		if (atomic_load_explicit(&hist->seq,
+				memory_order_relaxed) == seq) {
+			return ver;
+		}
+
+		atomsnap_release_version(ver);
+		backoff_wait(&backoff);
+	}
+}
+
+/**
+ * @brief   Release a version previously acquired.
+ *
+ * Increments the inner counter (upper 32 bits only).
+ * If DETACHED is set and the counter becomes 0, the version is reclaimed.
+ * On hazard-mode gates, only the reader's hazard slot is cleared. On QSBR
+ * gates this is a no-op; see atomsnap_quiescent_state().
+ *
+ * @param   ver: Version to release.
+ */
+void atomsnap_release_version(struct atomsnap_version *ver)
+{
+	uint64_t prev, now;
+
+	if (ver == NULL) {
+		return;
+	}
+
+	if (ver->read_mode & ATOMSNAP_GATE_HAZARD) {
+		hazard_release(ver);
+		return;
+	} else if (ver->read_mode & ATOMSNAP_GATE_QSBR) {
+		/* Protected until the next quiescent state */
+		return;
+	}
+
+	/*
+	 * Readers increment only the counter (upper 32 bits). Flags in the
+	 * lower 32 bits are never affected by carry/overflow.
+	 */
+	prev = atomic_fetch_add_explicit(&ver->inner_state, INNER_CNT_INC,
+		memory_order_acq_rel);
+	now = prev + INNER_CNT_INC;
+
+	try_finalize(ver, now);
+}
+
+/**
+ * @brief   Acquire one round (at most ATOMSNAP_BATCH) of acquire_many().
+ *
+ * Four passes, each issuing all of its misses before consuming them:
+ * gate lines, then control blocks, then arena table entries, then slots.
+ */
+static void acquire_batch(struct atomsnap_gate *const *gates,
+	const int *slots, int n, struct atomsnap_version **out)
+{
+	_Atomic(uint64_t) *cbs[ATOMSNAP_BATCH];
+	uint32_t handles[ATOMSNAP_BATCH];
+	struct atomsnap_gate *gate;
+	uint64_t val;
+	int i, slot;
+
+	for (i = 0; i < n; i++) {
+		__builtin_prefetch(gates[i], 0);
+	}
+
+	/* Pass 1: control block addresses (gate lines are in flight) */
+	for (i = 0; i < n; i++) {
+		slot = slots ? slots[i] : 0;
+		cbs[i] = get_cb_slot(gates[i], slot);
+		__builtin_prefetch(cbs[i], 1);
+	}
+
+	/* Pass 2: take the references, start loading arena table entries */
+	for (i = 0; i < n; i++) {
+		gate = gates[i];
+
+		if (gate->flags & ATOMSNAP_GATE_SLOW_READ) {
+			out[i] = atomsnap_acquire_version_slot(gate,
+				slots ? slots[i] : 0);
+			handles[i] = HANDLE_NULL;
+			continue;
+		}
+
+		val = atomic_fetch_add_explicit(cbs[i], REF_COUNT_INC,
+			memory_order_acquire);
+		handles[i] = (uint32_t)(val & HANDLE_MASK_64);
 
-	/* Arena Top initially points to Sentinel, Depth 0 */
-	atomic_store(&arena->top_handle, (uint64_t)sentinel_handle);
+		if (handles[i] != HANDLE_NULL) {
+			__builtin_prefetch(atomsnap_arena_ref(
+				handles[i] >> HANDLE_SLOT_BITS), 0);
+		}
+	}
+
+	/* Pass 3: resolve handles, start loading the version slots */
+	for (i = 0; i < n; i++) {
+		if (gates[i]->flags & ATOMSNAP_GATE_SLOW_READ) {
+			continue;
+		}
+
+		out[i] = resolve_handle(handles[i]);
+		if (out[i] != NULL) {
+			__builtin_prefetch(out[i], 0);
+		}
+	}
+}
+
+/**
+ * @brief   Acquire the current versions of many slots at once.
+ *
+ * Equivalent to calling atomsnap_acquire_version_slot() for every pair
+ * (gates[i], slots[i]), but the control block, arena table and slot loads
+ * of all entries are software-pipelined so that their cache misses overlap.
+ * Pass the same gate n times with slots 0..n-1 to acquire every slot of a
+ * multi-slot gate. Release with atomsnap_release_many().
+ *
+ * @param   gates: Gates to read.
+ * @param   slots: Slot index per gate, or NULL for slot 0 everywhere.
+ * @param   n:     Number of entries.
+ * @param   out:   Receives the acquired versions (NULL for empty slots).
+ */
+void atomsnap_acquire_many(struct atomsnap_gate *const *gates,
+	const int *slots, int n, struct atomsnap_version **out)
+{
+	int i, cnt;
+
+	for (i = 0; i < n; i += ATOMSNAP_BATCH) {
+		cnt = (n - i < ATOMSNAP_BATCH) ? n - i : ATOMSNAP_BATCH;
+		acquire_batch(gates + i, slots ? slots + i : NULL, cnt,
+			out + i);
+	}
+}
+
+/**
+ * @brief   Release one round (at most ATOMSNAP_BATCH) of release_many().
+ *
+ * Duplicates within the round are merged first, so a version acquired k
+ * times takes a single k-fold inner_state add.
+ */
+static void release_batch(struct atomsnap_version *const *vers, int n)
+{
+	struct atomsnap_version *uniq[ATOMSNAP_BATCH];
+	uint32_t cnt[ATOMSNAP_BATCH];
+	uint8_t bucket[ATOMSNAP_BATCH * 2];
+	struct atomsnap_version *ver;
+	uint64_t now;
+	int i, j, nuniq = 0;
+	uint32_t k, h;
+
+	/* Open-addressing index into uniq[], 0xFF is empty */
+	memset(bucket, 0xFF, sizeof(bucket));
+
+	for (i = 0; i < n; i++) {
+		ver = vers[i];
+		if (ver == NULL) {
+			continue;
+		}
+
+		/* Fibonacci hash; the top 6 bits index the 64 buckets */
+		h = (uint32_t)(((uintptr_t)ver * 0x9E3779B97F4A7C15ULL) >> 58);
+		while (bucket[h] != 0xFF && uniq[bucket[h]] != ver) {
+			h = (h + 1) & (ATOMSNAP_BATCH * 2 - 1);
+		}
+
+		if (bucket[h] == 0xFF) {
+			__builtin_prefetch(ver, 1);
+			bucket[h] = (uint8_t)nuniq;
+			uniq[nuniq] = ver;
+			cnt[nuniq++] = 0;
+		}
+		cnt[bucket[h]]++;
+	}
+
+	for (j = 0; j < nuniq; j++) {
+		ver = uniq[j];
+
+		if (ver->read_mode) {
+			for (k = 0; k < cnt[j]; k++) {
+				atomsnap_release_version(ver);
+			}
+			continue;
+		}
+
+		now = atomic_fetch_add_explicit(&ver->inner_state,
+			(uint64_t)cnt[j] * INNER_CNT_INC,
+			memory_order_acq_rel) + (uint64_t)cnt[j] * INNER_CNT_INC;
+
+		try_finalize(ver, now);
+	}
+}
+
+/**
+ * @brief   Release versions acquired by atomsnap_acquire_many().
+ *
+ * Equivalent to calling atomsnap_release_version() on every entry. NULL
+ * entries are skipped, and repeated versions are released with one atomic
+ * add per version.
+ *
+ * @param   vers: Versions to release.
+ * @param   n:    Number of entries.
+ */
+void atomsnap_release_many(struct atomsnap_version *const *vers, int n)
+{
+	int i, cnt;
+
+	for (i = 0; i < n; i += ATOMSNAP_BATCH) {
+		cnt = (n - i < ATOMSNAP_BATCH) ? n - i : ATOMSNAP_BATCH;
+		release_batch(vers + i, cnt);
+	}
+}
+
+/**
+ * @brief   Acquire several slots of a gate as one consistent snapshot.
+ *
+ * Seqlock-style read of gate->txn_seq: the slots are acquired between two
+ * loads of the word, and the snapshot is retried if a transaction started
+ * or finished in between. A snapshot is never torn, but readers may retry
+ * while transactions keep coming.
+ *
+ * @param   gate:     Target gate.
+ * @param   slot_ids: Slots to read.
+ * @param   n:        Number of slots.
+ * @param   out:      Receives the acquired versions.
+ */
+void atomsnap_acquire_slots_consistent(struct atomsnap_gate *gate,
+	const int *slot_ids, int n, struct atomsnap_version **out)
+{
+	struct atomsnap_gate *gates[ATOMSNAP_BATCH];
+	uint32_t backoff = 1;
+	uint64_t seq;
+	int i, cnt;
+
+	for (i = 0; i < n && i < ATOMSNAP_BATCH; i++) {
+		gates[i] = gate;
+	}
+
+	while (1) {
+		seq = atomic_load_explicit(&gate->txn_seq, memory_order_acquire);
+		if (seq & 1) {
+			backoff_wait(&backoff);
+			continue;
+		}
+
+		for (i = 0; i < n; i += ATOMSNAP_BATCH) {
+			cnt = (n - i < ATOMSNAP_BATCH) ? n - i : ATOMSNAP_BATCH;
+			atomsnap_acquire_many(gates, slot_ids + i, cnt, out + i);
+		}
+
+		/* The slot loads must not move below the re-check */
+		atomic_thread_fence(memory_order_acquire);
+		if (atomic_load_explicit(&gate->txn_seq,
+				memory_order_relaxed) == seq) {
+			return;
+		}
+
+		atomsnap_release_many(out, n);
+		backoff_wait(&backoff);
+	}
+}
+
+/**
+ * @brief   Return the current version of a slot through a lease.
+ *
+ * The pinned version cannot be recycled while the lease holds it, so an
+ * unchanged handle in the control block means it is still current. Only a
+ * changed handle pays for the release/acquire pair.
+ *
+ * @param   gate:     Target gate.
+ * @param   slot_idx: Control block slot index.
+ * @param   lease:    Lease owned by the calling thread.
+ *
+ * @return  Pointer to the current version (owned by the lease).
+ */
+struct atomsnap_version *atomsnap_lease_refresh(struct atomsnap_gate *gate,
+	int slot_idx, struct atomsnap_lease *lease)
+{
+	_Atomic(uint64_t) *cb = get_cb_slot(gate, slot_idx);
+	struct atomsnap_version *held = lease->version;
+	uint32_t handle;
+
+	handle = (uint32_t)(atomic_load_explicit(cb, memory_order_relaxed) &
+		HANDLE_MASK_64);
+
+	if (__builtin_expect(held != NULL && held->self_handle == handle, 1)) {
+		return held;
+	}
+
+	atomsnap_release_version(held);
+	lease->version = atomsnap_acquire_version_slot(gate, slot_idx);
+
+	return lease->version;
+}
+
+/**
+ * @brief   Release the version pinned by a lease.
+ *
+ * @param   lease: Lease to empty.
+ */
+void atomsnap_lease_release(struct atomsnap_lease *lease)
+{
+	atomsnap_release_version(lease->version);
+	lease->version = NULL;
+}
+
+/**
+ * @brief   Reclaim a detached version whose inner counter reached zero.
+ *
+ * Slow path of the inlined atomsnap_release_version().
+ *
+ * @param   ver:   Released version.
+ * @param   state: Inner state observed after the release.
+ */
+void atomsnap_release_slow(struct atomsnap_version *ver, uint64_t state)
+{
+	try_finalize(ver, state);
+}
+
+/**
+ * @brief   Replace the version in the given slot unconditionally.
+ *
+ * @param   gate:     Target gate.
+ * @param   slot_idx: Control block slot index.
+ * @param   new_ver:  New version to register.
+ */
+void atomsnap_exchange_version_slot(struct atomsnap_gate *gate, int slot_idx,
+	struct atomsnap_version *new_ver)
+{
+	uint32_t new_handle = new_ver ? new_ver->self_handle : HANDLE_NULL;
+	_Atomic(uint64_t) *cb = get_cb_slot(gate, slot_idx);
+	uint64_t old_val;
+	uint32_t old_handle, old_refs;
+	struct atomsnap_version *old_ver;
+
+	if (gate->flags & ATOMSNAP_GATE_REPLICATED) {
+		replica_lock(gate);
+		stamp_version(gate, 0, new_ver, writer_current(gate, 0));
+		old_handle = replica_fan_out(gate, new_handle, &old_refs);
+		old_ver = (gate->flags & ATOMSNAP_GATE_SINGLE_WRITER) ?
+			sw_swap(gate, 0, new_ver) : resolve_handle(old_handle);
+		if (new_ver == NULL) {
+			stamp_empty(gate, 0, old_ver);
+		}
+		bump_generation(gate, 0);
+		replica_unlock(gate);
+
+		detach_version(gate, 0, old_ver, old_refs);
+		return;
+	}
+
+	/* Stamps must follow the version they replace */
+	if ((gate->flags & (ATOMSNAP_GATE_STAMPED |
+			ATOMSNAP_GATE_SINGLE_WRITER)) == ATOMSNAP_GATE_STAMPED) {
+		stamped_publish(gate, slot_idx, new_ver, false, NULL, NULL, 0);
+		return;
+	}
 
 	/*
-	 * Link slots 1..N sequentially to form the free list stack.
+	 * Swap the handle in the control block.
+	 * The new value will have 'new_handle' and 'RefCount = 0' (implicitly).
+	 * A version being mutated in place must not be swapped out.
 	 */
-	next_in_stack = sentinel_handle;
+	if (gate->flags & ATOMSNAP_GATE_SINGLE_WRITER) {
+		stamp_version(gate, slot_idx, new_ver, gate->sw_current[slot_idx]);
+	}
+	if (gate->flags & ATOMSNAP_GATE_IN_PLACE) {
+		old_val = atomic_load_explicit(cb, memory_order_acquire);
+		do {
+			old_val = wait_not_busy(cb, old_val);
+		} while (!atomic_compare_exchange_weak(cb, &old_val,
+				(uint64_t)new_handle));
+	} else {
+		old_val = atomic_exchange(cb, (uint64_t)new_handle);
+	}
+	bump_generation(gate, slot_idx);
 
-	for (i = 1; i < SLOTS_PER_ARENA; i++) {
-		curr = construct_handle(arena_idx, i);
-		slot = &arena->slots[i];
-		slot->self_handle = curr;
+	old_refs = (uint32_t)((old_val & REF_COUNT_MASK) >> REF_COUNT_SHIFT);
 
-		atomic_store(&slot->next_handle, next_in_stack);
-		next_in_stack = curr;
+	if (gate->flags & ATOMSNAP_GATE_SINGLE_WRITER) {
+		old_ver = sw_swap(gate, slot_idx, new_ver);
+		if (new_ver == NULL) {
+			stamp_empty(gate, slot_idx, old_ver);
+		}
+	} else {
+		old_handle = (uint32_t)(old_val & HANDLE_MASK_64);
+		old_ver = resolve_handle(old_handle);
 	}
+	detach_version(gate, slot_idx, old_ver, old_refs);
+}
 
-	return next_in_stack;
+/**
+ * @brief   Conditionally replace the version if @old_ver matches.
+ *
+ * @param   gate:     Target gate.
+ * @param   slot_idx: Control block slot index.
+ * @param   expected: Expected current version.
+ * @param   new_ver:  New version to register.
+ *
+ * @return  true on successful exchange, false otherwise.
+ */
+bool atomsnap_compare_exchange_version_slot(struct atomsnap_gate *gate,
+	int slot_idx, struct atomsnap_version *expected,
+	struct atomsnap_version *new_ver)
+{
+	uint32_t new_handle = new_ver ? new_ver->self_handle : HANDLE_NULL;
+	uint32_t exp_handle = expected ? expected->self_handle : HANDLE_NULL;
+	_Atomic(uint64_t) *cb = get_cb_slot(gate, slot_idx);
+	uint64_t current_val, next_val;
+	uint32_t cur_handle, old_refs;
+
+	current_val = atomic_load_explicit(cb, memory_order_acquire);
+	if (gate->flags & ATOMSNAP_GATE_IN_PLACE) {
+		/* A mutation in place leaves the slot at @expected */
+		current_val = wait_not_busy(cb, current_val);
+	}
+	cur_handle = (uint32_t)(current_val & HANDLE_MASK_64);
+
+	if (cur_handle != exp_handle) {
+		return false;
+	}
+
+	if (gate->flags & ATOMSNAP_GATE_REPLICATED) {
+		replica_lock(gate);
+
+		/* Replicas only change under the lock; slot 0 is authoritative */
+		cur_handle = (uint32_t)(atomic_load_explicit(cb,
+			memory_order_relaxed) & HANDLE_MASK_64);
+		if (cur_handle != exp_handle) {
+			replica_unlock(gate);
+			return false;
+		}
+
+		stamp_version(gate, 0, new_ver, expected);
+		replica_fan_out(gate, new_handle, &old_refs);
+		if (new_ver == NULL) {
+			stamp_empty(gate, 0, expected);
+		}
+		bump_generation(gate, 0);
+		replica_unlock(gate);
+
+		if (gate->flags & ATOMSNAP_GATE_SINGLE_WRITER) {
+			gate->sw_current[0] = new_ver;
+		}
+		detach_version(gate, 0, expected, old_refs);
+		return true;
+	}
+
+	if ((gate->flags & (ATOMSNAP_GATE_STAMPED |
+			ATOMSNAP_GATE_SINGLE_WRITER)) == ATOMSNAP_GATE_STAMPED) {
+		return stamped_publish(gate, slot_idx, new_ver, true, expected,
+			NULL, 0);
+	}
+
+	/* The only writer keeps the slot at @expected until the CAS */
+	stamp_version(gate, slot_idx, new_ver, expected);
+
+	/*
+	 * CAS Loop:
+	 * Retry if RefCount changes but Handle is still expected, or once a
+	 * concurrent mutation in place has restored it.
+	 */
+	while (1) {
+		if (gate->flags & ATOMSNAP_GATE_IN_PLACE) {
+			current_val = wait_not_busy(cb, current_val);
+		}
+		if ((uint32_t)(current_val & HANDLE_MASK_64) != exp_handle) {
+			return false;
+		}
+
+		next_val = (uint64_t)new_handle;
+
+		if (atomic_compare_exchange_weak_explicit(cb, &current_val,
+			next_val, memory_order_seq_cst,
+			memory_order_acquire)) {
+			break;
+		}
+	}
+
+	bump_generation(gate, slot_idx);
+
+	/* The CAS matched @expected, so there is nothing to resolve */
+	if (gate->flags & ATOMSNAP_GATE_SINGLE_WRITER) {
+		gate->sw_current[slot_idx] = new_ver;
+		if (new_ver == NULL) {
+			stamp_empty(gate, slot_idx, expected);
+		}
+	}
+
+	old_refs = (uint32_t)((current_val & REF_COUNT_MASK) >> REF_COUNT_SHIFT);
+	detach_version(gate, slot_idx, expected, old_refs);
+
+	return true;
 }
 
 /**
- * @brief   Initialize a new arena (or reuse a reclaimed one).
+ * @brief   Publish a version only if its sequence is the newest so far.
  *
- * @param   ctx: Thread context.
+ * The sequence is claimed first, so an out-of-order publisher fails on a
+ * single load. The claimant then CASes the control block for as long as
+ * no newer sequence has been claimed. A publish can only land after every
+ * publish of an older sequence, so the slot never moves backwards.
  *
- * @return  0 on success, -1 on failure.
+ * @param   gate:     Target gate.
+ * @param   slot_idx: Control block slot index.
+ * @param   new_ver:  Version to publish (may be NULL).
+ * @param   seq:      Sequence of @new_ver.
+ *
+ * @return  true if @new_ver was published, false if a newer or equal
+ *          sequence was claimed first.
  */
-static int init_arena(struct thread_context *ctx)
+bool atomsnap_publish_if_newer(struct atomsnap_gate *gate, int slot_idx,
+	struct atomsnap_version *new_ver, uint64_t seq)
 {
-	struct memory_arena *arena;
-	size_t arena_idx;
-	uint32_t next_in_stack;
+	uint32_t new_handle = new_ver ? new_ver->self_handle : HANDLE_NULL;
+	_Atomic(uint64_t) *cb, *claim;
+	uint64_t current_val, cur_seq;
+	uint32_t old_handle, old_refs;
+	struct atomsnap_version *old_ver;
+
+	if (gate->flags & ATOMSNAP_GATE_REPLICATED) {
+		slot_idx = 0;
+	}
+
+	claim = slot_sequence(gate, slot_idx);
+	cur_seq = atomic_load_explicit(claim, memory_order_relaxed);
+	do {
+		if (seq <= cur_seq) {
+			return false;
+		}
+	} while (!atomic_compare_exchange_weak_explicit(claim, &cur_seq, seq,
+			memory_order_seq_cst, memory_order_relaxed));
+
+	if (gate->flags & ATOMSNAP_GATE_REPLICATED) {
+		replica_lock(gate);
+
+		if (atomic_load_explicit(claim, memory_order_relaxed) != seq) {
+			replica_unlock(gate);
+			return false;
+		}
+
+		stamp_version(gate, 0, new_ver, writer_current(gate, 0));
+		old_handle = replica_fan_out(gate, new_handle, &old_refs);
+		old_ver = (gate->flags & ATOMSNAP_GATE_SINGLE_WRITER) ?
+			sw_swap(gate, 0, new_ver) : resolve_handle(old_handle);
+		if (new_ver == NULL) {
+			stamp_empty(gate, 0, old_ver);
+		}
+		bump_generation(gate, 0);
+		replica_unlock(gate);
+
+		detach_version(gate, 0, old_ver, old_refs);
+		return true;
+	}
+
+	if ((gate->flags & (ATOMSNAP_GATE_STAMPED |
+			ATOMSNAP_GATE_SINGLE_WRITER)) == ATOMSNAP_GATE_STAMPED) {
+		return stamped_publish(gate, slot_idx, new_ver, false, NULL,
+			claim, seq);
+	}
+
+	if (gate->flags & ATOMSNAP_GATE_SINGLE_WRITER) {
+		stamp_version(gate, slot_idx, new_ver,
+			gate->sw_current[slot_idx]);
+	}
 
 	/*
-	 * Check if we have an existing pointer in the vector beyond the
-	 * active_arena_count (which means it was reclaimed).
+	 * A CAS that succeeds was based on a control block loaded before the
+	 * claim was re-checked, so any newer claimant publishes after us.
 	 */
-	if (ctx->active_arena_count < ctx->vector_capacity &&
-		ctx->owned_arenas[ctx->active_arena_count] != NULL) {
-		/* Reuse existing arena slot */
-		arena = ctx->owned_arenas[ctx->active_arena_count];
-		arena_idx = ctx->arena_indices[ctx->active_arena_count];
-	} else {
-		/* Allocate New Global Arena */
-		arena_idx = atomic_fetch_add(&g_global_arena_cnt, 1);
-		if (arena_idx >= MAX_ARENAS) {
-			errmsg("Max arenas reached\n");
-			return -1;
+	cb = get_cb_slot(gate, slot_idx);
+	current_val = atomic_load_explicit(cb, memory_order_seq_cst);
+	do {
+		if (atomic_load_explicit(claim, memory_order_seq_cst) != seq) {
+			return false;
+		}
+		if (gate->flags & ATOMSNAP_GATE_IN_PLACE) {
+			current_val = wait_not_busy(cb, current_val);
+		}
+	} while (!atomic_compare_exchange_weak_explicit(cb, &current_val,
+			(uint64_t)new_handle, memory_order_seq_cst,
+			memory_order_seq_cst));
+
+	bump_generation(gate, slot_idx);
+
+	if (gate->flags & ATOMSNAP_GATE_SINGLE_WRITER) {
+		old_ver = sw_swap(gate, slot_idx, new_ver);
+		if (new_ver == NULL) {
+			stamp_empty(gate, slot_idx, old_ver);
 		}
+	} else {
+		old_handle = (uint32_t)(current_val & HANDLE_MASK_64);
+		old_ver = resolve_handle(old_handle);
+	}
+
+	old_refs = (uint32_t)((current_val & REF_COUNT_MASK) >> REF_COUNT_SHIFT);
+	detach_version(gate, slot_idx, old_ver, old_refs);
+
+	return true;
+}
 
-		arena = aligned_alloc(PAGE_SIZE, sizeof(struct memory_arena));
-		if (!arena) {
-			errmsg("Memory allocation failed for new arena\n");
+/**
+ * @brief   Publish versions to several slots of a gate as one transaction.
+ *
+ * gate->txn_seq is odd while a transaction is in progress. Taking it from
+ * even to odd serializes transactions, and every exchange is ordered
+ * between the two increments, so a consistent reader that saw the same
+ * even value before and after its loads saw none or all of them.
+ *
+ * @param   gate:     Target gate.
+ * @param   slot_ids: Slots to publish to.
+ * @param   vers:     Version per slot.
+ * @param   n:        Number of slots.
+ *
+ * @return  0 on success, -1 on an invalid slot index.
+ */
+int atomsnap_exchange_slots(struct atomsnap_gate *gate, const int *slot_ids,
+	struct atomsnap_version *const *vers, int n)
+{
+	uint32_t backoff = 1;
+	uint64_t seq;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (slot_ids[i] < 0 || slot_ids[i] > gate->num_extra_slots) {
+			errmsg("Invalid slot index %d\n", slot_ids[i]);
 			return -1;
 		}
-		memset(arena, 0, sizeof(struct memory_arena));
-
-		/* Register in global table */
-		g_arena_table[arena_idx] = arena;
+	}
 
-		/* Ensure vector capacity */
-		if (ensure_vector_capacity(ctx) != 0) {
-			return -1;
+	seq = atomic_load_explicit(&gate->txn_seq, memory_order_relaxed);
+	while (1) {
+		if (!(seq & 1) && atomic_compare_exchange_weak_explicit(
+				&gate->txn_seq, &seq, seq + 1,
+				memory_order_acquire, memory_order_relaxed)) {
+			break;
 		}
 
-		ctx->owned_arenas[ctx->active_arena_count] = arena;
-		ctx->arena_indices[ctx->active_arena_count] =
-			(uint32_t)arena_idx;
+		backoff_wait(&backoff);
+		seq = atomic_load_explicit(&gate->txn_seq, memory_order_relaxed);
 	}
 
-	/* Setup Stack and Links */
-	next_in_stack = setup_arena_stack(arena, arena_idx);
-
-	/* Increment active count */
-	ctx->active_arena_count++;
+	for (i = 0; i < n; i++) {
+		atomsnap_exchange_version_slot(gate, slot_ids[i], vers[i]);
+	}
 
-	/* Use the new stack */
-	ctx->local_top = next_in_stack;
+	atomic_store_explicit(&gate->txn_seq, seq + 2, memory_order_release);
 
 	return 0;
 }
 
 /**
- * @brief   Pop a slot from the local free list (Stack Pop).
+ * @brief   Read-modify-publish a slot, reusing the new version on retry.
  *
- * @param   ctx: Thread context.
+ * @param   gate:     Gate with a non-zero object_size.
+ * @param   slot_idx: Control block slot index.
+ * @param   fn:       Builds the next object from the current one.
+ * @param   ctx:      Argument passed to @fn.
  *
- * @return  Handle of the allocated slot, or HANDLE_NULL if empty.
+ * @return  1 if published, 0 if @fn declined, -1 on failure.
  */
-static uint32_t pop_local(struct thread_context *ctx)
+int atomsnap_update_slot(struct atomsnap_gate *gate, int slot_idx,
+	atomsnap_update_func fn, void *ctx)
 {
-	uint32_t handle_raw;
-	struct atomsnap_version *slot;
-	atomsnap_handle_t h;
+	struct atomsnap_version *cur, *ver;
+	uint32_t backoff = 1;
+	bool ok;
 
-	if (ctx->local_top == HANDLE_NULL) {
-		return HANDLE_NULL;
+	if (gate->object_size == 0) {
+		errmsg("Gate was created without object_size\n");
+		return -1;
 	}
 
-	handle_raw = ctx->local_top;
-	h.raw = handle_raw;
-
-	/* Check if the top is the Sentinel (Slot 0) */
-	if (h.slot_idx == 0) {
-		/* Stack is empty (hit sentinel) */
-		ctx->local_top = HANDLE_NULL;
-		return HANDLE_NULL;
+	ver = atomsnap_make_version_inline(gate, gate->object_size);
+	if (ver == NULL) {
+		return -1;
 	}
 
-	slot = resolve_handle(handle_raw);
+	while (1) {
+		cur = atomsnap_acquire_version_slot(gate, slot_idx);
 
-	/*
-	 * Move top to the next node down the stack.
-	 */
-	ctx->local_top = atomic_load(&slot->next_handle);
+		if (!fn(cur ? atomsnap_get_object(cur) : NULL,
+				version_payload(ver), ctx)) {
+			atomsnap_release_version(cur);
+			atomsnap_free_version(ver);
+			return 0;
+		}
 
-	/* Restore self_handle for Allocated state */
-	slot->self_handle = h.raw;
-	return h.raw;
+		ok = atomsnap_compare_exchange_version_slot(gate, slot_idx,
+			cur, ver);
+
+		/* Only now may the old version be reclaimed */
+		atomsnap_release_version(cur);
+
+		if (ok) {
+			return 1;
+		}
+
+		backoff_wait(&backoff);
+	}
 }
 
 /**
- * @brief   Allocates a slot handle.
+ * @brief   Mutate the published object of a slot if nobody holds it.
  *
- * Strategy:
- * 1. Try Local Stack (pop_local).
- * 2. Try Batch Steal from Arenas (atomic_exchange).
- * 3. Init New Arena (or reuse).
+ * The control block is parked on HANDLE_BUSY first, which freezes the set
+ * of readers that ever acquired the version. If all of them have released
+ * it, @fn runs on the published object; either way the original control
+ * block value is restored afterwards.
  *
- * @param   ctx: Thread context.
+ * @param   gate:     ATOMSNAP_GATE_IN_PLACE gate.
+ * @param   slot_idx: Control block slot index.
+ * @param   fn:       Modification.
+ * @param   ctx:      Argument passed to @fn.
  *
- * @return  Handle of the allocated slot, or HANDLE_NULL on failure.
+ * @return  true if @fn was applied, false if the caller must copy.
  */
-static uint64_t alloc_slot(struct thread_context *ctx)
+static bool mutate_exclusive(struct atomsnap_gate *gate, int slot_idx,
+	atomsnap_mutate_func fn, void *ctx)
 {
-	uint32_t handle, sentinel_handle;
-	struct memory_arena *arena;
-	uint64_t top_val, batch_top;
-	size_t i;
+	_Atomic(uint64_t) *cb = get_cb_slot(gate, slot_idx);
+	struct atomsnap_version *ver;
+	uint64_t val, state;
+	uint32_t handle, refs;
+	void *obj;
+	bool idle;
+
+	val = atomic_load_explicit(cb, memory_order_acquire);
+	handle = (uint32_t)(val & HANDLE_MASK_64);
+	if (handle == HANDLE_NULL || handle == ATOMSNAP_HANDLE_BUSY) {
+		return false;
+	}
 
-	ctx->alloc_count++;
+	ver = resolve_handle(handle);
+	assert(ver != NULL);
+	obj = atomsnap_get_object(ver);
+	refs = (uint32_t)((val & REF_COUNT_MASK) >> REF_COUNT_SHIFT);
 
-	/*
-	 * Periodic Reclamation Check.
-	 * Check if the last active arena is fully free.
-	 */
-	if ((ctx->alloc_count % SLOTS_PER_ARENA) == 0) {
-		reclaim_last_arena_if_empty(ctx);
+	/* Cheap filter before making readers wait */
+	state = atomic_load_explicit(&ver->inner_state, memory_order_acquire);
+	if (obj == NULL || inner_cnt(state) != refs) {
+		return false;
 	}
 
-	/* 1. Try Local Free Stack */
-	handle = pop_local(ctx);
-	if (handle != HANDLE_NULL) {
-		return handle;
+	if (!atomic_compare_exchange_strong_explicit(cb, &val,
+			(uint64_t)ATOMSNAP_HANDLE_BUSY, memory_order_acq_rel,
+			memory_order_relaxed)) {
+		return false;
 	}
 
-	/* 2. Try Batch Steal from owned active arenas */
-	for (i = 0; i < ctx->active_arena_count; i++) {
-		arena = ctx->owned_arenas[i];
-		sentinel_handle = construct_handle(ctx->arena_indices[i], 0);
+	/* No reader can acquire ver now; all earlier ones have released */
+	state = atomic_load_explicit(&ver->inner_state, memory_order_acquire);
+	idle = (inner_cnt(state) == refs);
+	if (idle) {
+		fn(obj, ctx);
+		stamp_version(gate, slot_idx, ver, ver);
+	}
 
-		/* Check if empty (optimization) */
-		top_val = atomic_load(&arena->top_handle);
-		if ((uint32_t)(top_val & HANDLE_MASK_32) == sentinel_handle) {
-			continue;
-		}
+	/* Readers that saw HANDLE_BUSY hold nothing; drop their increments */
+	atomic_store_explicit(cb, val, memory_order_release);
 
-		/*
-		 * Batch Steal: Atomically exchange Top with Sentinel.
-		 * This detaches the entire stack.
-		 */
-		batch_top = atomic_exchange(&arena->top_handle,
-			(uint64_t)sentinel_handle);
+	if (idle) {
+		bump_generation(gate, slot_idx);
+	}
 
-		assert((uint32_t)(batch_top & HANDLE_MASK_32) !=
-			sentinel_handle);
+	return idle;
+}
 
-		/* Adopt the batch */
-		ctx->local_top = (uint32_t)(batch_top & HANDLE_MASK_32);
+struct mutate_args {
+	atomsnap_mutate_func fn;
+	void *ctx;
+	size_t size;
+};
 
-		return pop_local(ctx);
-	}
+/* atomsnap_update_func that applies a mutation to a copy */
+static bool mutate_copy(const void *old_obj, void *new_obj, void *ctx)
+{
+	struct mutate_args *a = ctx;
 
-	/* 3. Allocate New Arena (or reuse inactive) */
-	if (init_arena(ctx) == 0) {
-		return pop_local(ctx);
+	if (old_obj != NULL) {
+		memcpy(new_obj, old_obj, a->size);
+	} else {
+		memset(new_obj, 0, a->size);
 	}
 
-	errmsg("Out of memory (Max arenas reached)\n");
-	return HANDLE_NULL;
+	a->fn(new_obj, a->ctx);
+	return true;
 }
 
 /**
- * @brief   Returns a slot to its arena (Stack Push).
+ * @brief   Modify a slot's object, in place if no reader holds it.
  *
- * Uses a CAS loop to push the slot onto the top of the arena's stack.
+ * @param   gate:     Gate with a non-zero object_size.
+ * @param   slot_idx: Control block slot index.
+ * @param   fn:       Modification.
+ * @param   ctx:      Argument passed to @fn.
  *
- * @param   slot: Pointer to the version slot to free.
+ * @return  1 if modified in place, 0 if a copy was published, -1 on failure.
  */
-static void free_slot(struct atomsnap_version *slot)
+int atomsnap_mutate_slot(struct atomsnap_gate *gate, int slot_idx,
+	atomsnap_mutate_func fn, void *ctx)
 {
-	uint32_t my_handle = slot->self_handle;
-	atomsnap_handle_t h = { .raw = my_handle };
-	struct memory_arena *arena = g_arena_table[h.arena_idx];
-	uint64_t old_top, new_top, depth;
-
-	old_top = atomic_load(&arena->top_handle);
-	do {
-		/* 1. Extract current stack depth */
-		depth = (old_top & STACK_DEPTH_MASK);
-
-		/* 2. Increment depth */
-		depth += STACK_DEPTH_INC;
+	struct mutate_args a;
 
-		/* 3. Construct new top handle: [ New Depth | My Handle ] */
-		new_top = depth | (uint64_t)my_handle;
+	if ((gate->flags & ATOMSNAP_GATE_IN_PLACE) &&
+			mutate_exclusive(gate, slot_idx, fn, ctx)) {
+		return 1;
+	}
 
-		/* Link: Me -> Old Top (Extract 32-bit handle) */
-		atomic_store(&slot->next_handle,
-			(uint32_t)(old_top & HANDLE_MASK_32));
+	a.fn = fn;
+	a.ctx = ctx;
+	a.size = gate->object_size;
 
-		/* Attempt to make Me the New Top */
-	} while (!atomic_compare_exchange_weak(&arena->top_handle,
-		&old_top, new_top));
+	return (atomsnap_update_slot(gate, slot_idx, mutate_copy, &a) == 1) ?
+		0 : -1;
 }
 
-/*
- * Finalize and return the slot to the arena.
+/**
+ * @brief   Take a change-detection token of a slot.
+ *
+ * A plain load of the slot's publish counter. Neither the control block
+ * nor the version is touched, so pollers do not disturb readers.
+ *
+ * @param   gate:     Target gate.
+ * @param   slot_idx: Control block slot index.
+ *
+ * @return  Opaque token for atomsnap_changed_since().
  */
-static inline void finalize_and_free(struct atomsnap_version *ver)
+uint64_t atomsnap_peek_generation(struct atomsnap_gate *gate, int slot_idx)
 {
-	void *obj;
-
-	obj = atomic_load_explicit(&ver->object, memory_order_relaxed);
-
-	if (ver->gate && ver->gate->free_impl) {
-		ver->gate->free_impl(obj, ver->free_context);
+	if (gate->flags & ATOMSNAP_GATE_REPLICATED) {
+		slot_idx = 0;
 	}
 
-	free_slot(ver);
+	return atomic_load_explicit(slot_generation(gate, slot_idx),
+		memory_order_acquire);
 }
 
-/*
- * Attempt to finalize a detached version when the counter reaches zero.
+/**
+ * @brief   Check whether a slot was published to since a token was taken.
  *
- * A thread claims FINALIZED before reclaiming. If FINALIZED is already
- * set, another thread reclaimed it.
+ * @param   gate:     Target gate.
+ * @param   slot_idx: Control block slot index.
+ * @param   token:    Token from atomsnap_peek_generation().
  *
- * Define ATOMSNAP_DISABLE_FINALIZE_CHECK to ignore duplicates.
+ * @return  true if at least one exchange or successful CAS happened since.
  */
-static inline void try_finalize(struct atomsnap_version *ver, uint64_t state)
+bool atomsnap_changed_since(struct atomsnap_gate *gate, int slot_idx,
+	uint64_t token)
 {
-	uint32_t flags;
-	uint64_t old;
+	return atomsnap_peek_generation(gate, slot_idx) != token;
+}
 
-	flags = inner_flags(state);
-	if (!(flags & INNER_F_DETACHED)) {
-		return;
-	}
+/**
+ * @brief   Apply a group of requests for one slot to a copy of its object.
+ *
+ * atomsnap_update_func of the combiner. Re-run from scratch whenever a
+ * writer outside the combining protocol changes the slot underneath us.
+ *
+ * @param   old_obj: Current object (NULL if the slot is empty).
+ * @param   new_obj: Object to build.
+ * @param   ctx:     Requests for the same slot, in posting order.
+ *
+ * @return  Always true.
+ */
+static bool combine_apply(const void *old_obj, void *new_obj, void *ctx)
+{
+	struct atomsnap_combine_req *req = ctx;
+	struct atomsnap_gate *gate = req->gate;
 
-	if (inner_cnt(state) != 0) {
-		return;
+	if (old_obj != NULL) {
+		memcpy(new_obj, old_obj, gate->object_size);
+	} else {
+		memset(new_obj, 0, gate->object_size);
 	}
 
-	old = atomic_fetch_or_explicit(&ver->inner_state,
-		(uint64_t)INNER_F_FINALIZED, memory_order_acq_rel);
-
-	if ((uint32_t)old & INNER_F_FINALIZED) {
-		errmsg("Double finalize detected\n");
-		abort();
+	for (; req != NULL; req = req->next) {
+		req->result = req->fn(new_obj, req->arg);
 	}
 
-	finalize_and_free(ver);
+	return true;
 }
 
-/*
- * Atomically detach and subtract outer refs from the inner counter.
+/**
+ * @brief   Serve every request currently on the publication list.
  *
- * The DETACHED flag and counter adjustment must be committed together to
- * avoid intermediate states that could lead to premature reclamation.
+ * Called with the combiner lock held.
+ *
+ * @param   gate: Combining gate.
  */
-static inline void detach_and_adjust(struct atomsnap_version *ver,
-	uint32_t old_refs)
+static void combine_drain(struct atomsnap_gate *gate)
 {
-	uint64_t cur, next;
-	uint32_t cnt, flags;
-	uint32_t new_cnt, new_flags;
+	struct atomsnap_combine_req *list, *req, *next, *group, **group_tail,
+		*rest, **rest_tail;
+	int slot_idx, status;
 
-	cur = atomic_load_explicit(&ver->inner_state, memory_order_acquire);
+	list = atomic_exchange_explicit(&gate->fc_head, NULL,
+		memory_order_acquire);
 
-	for (;;) {
-		cnt = inner_cnt(cur);
-		flags = inner_flags(cur);
+	/* The list is LIFO; restore posting order */
+	req = list;
+	list = NULL;
+	while (req != NULL) {
+		next = req->next;
+		req->next = list;
+		list = req;
+		req = next;
+	}
 
-		new_cnt = (uint32_t)(cnt - old_refs);
-		new_flags = flags | INNER_F_DETACHED;
+	while (list != NULL) {
+		/* Split off the requests for the slot of the oldest one */
+		slot_idx = list->slot_idx;
+		group = NULL;
+		group_tail = &group;
+		rest = NULL;
+		rest_tail = &rest;
+
+		for (req = list; req != NULL; req = next) {
+			next = req->next;
+			req->next = NULL;
+			if (req->slot_idx == slot_idx) {
+				*group_tail = req;
+				group_tail = &req->next;
+			} else {
+				*rest_tail = req;
+				rest_tail = &req->next;
+			}
+		}
 
-		next = ((uint64_t)new_cnt << INNER_CNT_SHIFT) |
-			(uint64_t)new_flags;
+		status = (atomsnap_update_slot(gate, slot_idx, combine_apply,
+			group) == 1) ? 0 : -1;
 
-		if (atomic_compare_exchange_weak_explicit(&ver->inner_state,
-				&cur, next, memory_order_acq_rel,
-				memory_order_acquire)) {
-			break;
+		/* The writer may return as soon as done is set */
+		for (req = group; req != NULL; req = next) {
+			next = req->next;
+			req->status = status;
+			atomic_store_explicit(&req->done, true,
+				memory_order_release);
 		}
-	}
 
-	try_finalize(ver, next);
+		list = rest;
+	}
 }
 
-/**
- * @brief   Explicitly initialize the atomsnap library globals.
- *
- * Optional; usually called lazily.
- */
-int atomsnap_global_init(void)
+static inline bool combine_trylock(struct atomsnap_gate *gate)
 {
-	pthread_once(&g_init_once, global_init_routine);
-	return 0;
+	return !atomic_load_explicit(&gate->fc_lock, memory_order_relaxed) &&
+		!atomic_exchange_explicit(&gate->fc_lock, true,
+			memory_order_acquire);
 }
 
 /**
- * @brief   Internal thread initialization.
- *
- * Acquires a global thread ID and allocates/adopts a thread context.
+ * @brief   Serve the requests posted so far and give up the combiner role.
  *
- * @return  0 on success, -1 on failure.
+ * @param   gate: Combining gate, with the combiner lock held.
  */
-static int atomsnap_thread_init_internal(void)
+static void combine_unlock(struct atomsnap_gate *gate)
 {
-	struct thread_context *ctx;
-	bool expected = false;
-	int tid = -1;
-	int i;
+	int pass;
 
-	/* 1. Acquire Thread ID using CAS */
-	for (i = 0; i < MAX_THREADS; i++) {
-		if (atomic_load(&g_tid_used[i]) == true) {
-			continue;
-		}
-
-		expected = false;
-		if (atomic_compare_exchange_strong(&g_tid_used[i],
-			&expected, true)) {
-			tid = i;
+	for (pass = 0; pass < ATOMSNAP_COMBINE_PASSES; pass++) {
+		if (atomic_load_explicit(&gate->fc_head,
+				memory_order_relaxed) == NULL) {
 			break;
 		}
+		combine_drain(gate);
 	}
 
-	if (tid == -1) {
-		errmsg("Max threads limit reached (%d)\n", MAX_THREADS);
-		return -1;
-	}
-
-	/* 2. Adoption or New Allocation */
-	ctx = g_thread_contexts[tid];
-	if (ctx == NULL) {
-		/* New Allocation */
-		ctx = calloc(1, sizeof(struct thread_context));
-		if (ctx == NULL) {
-			errmsg("Failed to allocate thread context\n");
-			atomic_store(&g_tid_used[tid], false);
-			return -1;
-		}
-		ctx->thread_id = tid;
-		ctx->active_arena_count = 0;
-		ctx->vector_capacity = 0;
-		ctx->local_top = HANDLE_NULL;
-		g_thread_contexts[tid] = ctx;
-	} else {
-		/*
-		 * Adoption: Reuse existing context and arenas.
-		 */
-	}
-
-	/* 3. Set TLS */
-	if (pthread_setspecific(g_tls_key, ctx) != 0) {
-		errmsg("Failed to set TLS value\n");
-		return -1;
-	}
-
-	return 0;
+	atomic_store_explicit(&gate->fc_lock, false, memory_order_release);
 }
 
 /**
- * @brief   Create a new atomsnap_gate.
+ * @brief   Apply an update to a slot of a combining gate.
  *
- * @param   ctx: Initialization context containing callback pointers.
+ * @param   gate:     Combining gate.
+ * @param   slot_idx: Control block slot index.
+ * @param   fn:       Update function.
+ * @param   arg:      Argument passed to @fn.
+ * @param   result:   Receives the return value of @fn (may be NULL).
  *
- * @return  Pointer to the new gate, or NULL on failure.
+ * @return  0 on success, -1 on failure.
  */
-struct atomsnap_gate *atomsnap_init_gate(struct atomsnap_init_context *ctx)
+int atomsnap_combine(struct atomsnap_gate *gate, int slot_idx,
+	atomsnap_combine_func fn, void *arg, int64_t *result)
 {
-	struct atomsnap_gate *gate = calloc(1, sizeof(struct atomsnap_gate));
-	int i;
+	struct atomsnap_combine_req req;
+	struct atomsnap_combine_req *head;
+	int spins = 0;
 
-	if (gate == NULL) {
-		errmsg("Gate allocation failed\n");
-		return NULL;
+	if (!(gate->flags & ATOMSNAP_GATE_COMBINING)) {
+		errmsg("Gate was not created with ATOMSNAP_GATE_COMBINING\n");
+		return -1;
 	}
 
-	gate->free_impl = ctx->free_impl;
-	gate->num_extra_slots = ctx->num_extra_control_blocks;
+	if (gate->flags & ATOMSNAP_GATE_REPLICATED) {
+		slot_idx = 0;
+	}
 
-	if (gate->free_impl == NULL) {
-		errmsg("Invalid free function\n");
-		free(gate);
-		return NULL;
+	req.gate = gate;
+	req.fn = fn;
+	req.arg = arg;
+	req.slot_idx = slot_idx;
+	req.status = -1;
+	req.result = 0;
+	atomic_init(&req.done, false);
+
+	/* Uncontended: publish directly without going through the list */
+	if (combine_trylock(gate)) {
+		req.next = NULL;
+		req.status = (atomsnap_update_slot(gate, slot_idx,
+			combine_apply, &req) == 1) ? 0 : -1;
+		combine_unlock(gate);
+		goto out;
 	}
 
-	if (gate->num_extra_slots > 0) {
-		gate->extra_control_blocks = calloc(gate->num_extra_slots,
-			sizeof(_Atomic(uint64_t)));
+	head = atomic_load_explicit(&gate->fc_head, memory_order_relaxed);
+	do {
+		req.next = head;
+	} while (!atomic_compare_exchange_weak_explicit(&gate->fc_head, &head,
+			&req, memory_order_release, memory_order_relaxed));
 
-		if (gate->extra_control_blocks == NULL) {
-			errmsg("Extra blocks allocation failed\n");
-			free(gate);
-			return NULL;
+	while (!atomic_load_explicit(&req.done, memory_order_acquire)) {
+		/*
+		 * Our request was either served by the previous combiner or
+		 * is still on the list, where combine_unlock() finds it.
+		 */
+		if (combine_trylock(gate)) {
+			combine_unlock(gate);
+			continue;
 		}
 
-		for (i = 0; i < gate->num_extra_slots; i++) {
-			atomic_init(&gate->extra_control_blocks[i],
-				(uint64_t)HANDLE_NULL);
+		if (++spins >= ATOMSNAP_COMBINE_SPINS) {
+			spins = 0;
+			sched_yield();
 		}
 	}
 
-	atomic_init(&gate->control_block, (uint64_t)HANDLE_NULL);
+out:
+	if (result != NULL) {
+		*result = req.result;
+	}
 
-	return gate;
+	return req.status;
 }
 
 /**
- * @brief   Destroy the atomsnap_gate.
+ * @brief   Shard of a write-sharded gate for the calling thread.
  *
- * @param   gate: Gate to destroy.
+ * @param   gate: Write-sharded gate.
+ *
+ * @return  Slot index, or -1 on failure.
  */
-void atomsnap_destroy_gate(struct atomsnap_gate *gate)
+int atomsnap_shard_slot(struct atomsnap_gate *gate)
 {
-	if (gate == NULL) {
-		return;
+	struct thread_context *ctx;
+
+	if (!(gate->flags & ATOMSNAP_GATE_WRITE_SHARDED)) {
+		errmsg("Gate was not created with ATOMSNAP_GATE_WRITE_SHARDED\n");
+		return -1;
 	}
 
-	if (gate->extra_control_blocks) {
-		free(gate->extra_control_blocks);
+	ctx = get_or_init_thread_context();
+	if (ctx == NULL) {
+		return -1;
 	}
-	free(gate);
+
+	return ctx->thread_id % gate->num_extra_slots;
+}
+
+/*
+ * Sum of the shard generations. Each term only grows, so the sum is equal
+ * to an earlier one only if no shard has been published to in between.
+ * Every counter is on its own line, so a shard writer invalidates only
+ * its own counter's line.
+ */
+static uint64_t shard_token(struct atomsnap_gate *gate)
+{
+	uint64_t token = 0;
+	int i;
+
+	for (i = 0; i < gate->num_extra_slots; i++) {
+		token += atomic_load_explicit(slot_generation(gate, i),
+			memory_order_acquire);
+	}
+
+	return token;
 }
 
 /**
- * @brief   Allocate memory for an atomsnap_version.
- *
- * Uses the internal memory allocator (arena) to get a version slot.
+ * @brief   Build a merged version from the current shards.
  *
- * @param   gate: Gate to associate with the version.
+ * @param   gate:  Write-sharded gate.
+ * @param   token: Shard token read before the shards are acquired.
+ * @param   fn:    Merge function.
+ * @param   ctx:   Argument passed to @fn.
  *
- * @return  Pointer to the new version, or NULL on failure.
+ * @return  Unpublished merged version, or NULL on failure.
  */
-struct atomsnap_version *atomsnap_make_version(struct atomsnap_gate *gate)
+static struct atomsnap_version *build_merged(struct atomsnap_gate *gate,
+	uint64_t token, atomsnap_merge_func fn, void *ctx)
 {
-	struct thread_context *ctx = get_or_init_thread_context();
-	uint32_t handle;
-	struct atomsnap_version *slot;
+	struct atomsnap_gate *gates[ATOMSNAP_MAX_SHARDS];
+	struct atomsnap_version *vers[ATOMSNAP_MAX_SHARDS];
+	const void *objs[ATOMSNAP_MAX_SHARDS];
+	int slots[ATOMSNAP_MAX_SHARDS];
+	int i, n = gate->num_extra_slots;
+	struct atomsnap_version *merged;
+	void *obj;
 
-	if (ctx == NULL) {
+	merged = atomsnap_make_version_inline(gate,
+		merged_size(gate->object_size));
+	if (merged == NULL) {
 		return NULL;
 	}
 
-	handle = alloc_slot(ctx);
-	if (handle == HANDLE_NULL) {
-		return NULL;
+	for (i = 0; i < n; i++) {
+		gates[i] = gate;
+		slots[i] = i;
 	}
 
-	slot = resolve_handle(handle);
-	assert(slot != NULL);
+	atomsnap_acquire_many(gates, slots, n, vers);
 
-	/* Initialize slot */
-	slot->object = NULL;
-	slot->free_context = NULL;
-	slot->gate = gate;
+	for (i = 0; i < n; i++) {
+		objs[i] = atomsnap_get_object(vers[i]);
+	}
 
-	atomic_store_explicit(&slot->inner_state, 0, memory_order_relaxed);
+	obj = version_payload(merged);
+	memset(obj, 0, gate->object_size);
+	fn(obj, objs, n, ctx);
 
-	return slot;
+	atomsnap_release_many(vers, n);
+
+	/* Shards may be newer than token, which only costs a rebuild */
+	*merged_token(gate, merged) = token;
+
+	return merged;
 }
 
 /**
- * @brief   Manually free a version that was created but NEVER exchanged.
+ * @brief   Acquire the merge of all shards of a write-sharded gate.
  *
- * This function is used when a writer creates a version but decides not to
- * publish it (e.g., CAS failure). It invokes the user-defined free callback
- * to clean up the object, and then returns the version slot to the pool.
+ * @param   gate: Write-sharded gate.
+ * @param   fn:   Merge function.
+ * @param   ctx:  Argument passed to @fn.
  *
- * @param   version: The version to free.
+ * @return  Merged version, or NULL on failure.
  */
-void atomsnap_free_version(struct atomsnap_version *version)
+struct atomsnap_version *atomsnap_acquire_merged(struct atomsnap_gate *gate,
+	atomsnap_merge_func fn, void *ctx)
 {
-	void *obj;
+	int cache_slot = gate->num_extra_slots;
+	struct atomsnap_version *cur, *merged;
+	uint64_t token;
 
-	if (version == NULL) {
-		return;
+	if (!(gate->flags & ATOMSNAP_GATE_WRITE_SHARDED)) {
+		errmsg("Gate was not created with ATOMSNAP_GATE_WRITE_SHARDED\n");
+		return NULL;
 	}
 
-	obj = atomic_load_explicit(&version->object, memory_order_relaxed);
+	while (1) {
+		token = shard_token(gate);
 
-	if (version->gate && version->gate->free_impl) {
-		version->gate->free_impl(obj, version->free_context);
-	}
+		cur = atomsnap_acquire_version_slot(gate, cache_slot);
+		if (cur != NULL && *merged_token(gate, cur) == token) {
+			return cur;
+		}
 
-	free_slot(version);
+		merged = build_merged(gate, token, fn, ctx);
+		if (merged == NULL) {
+			atomsnap_release_version(cur);
+			return NULL;
+		}
+
+		if (atomsnap_compare_exchange_version_slot(gate, cache_slot,
+				cur, merged)) {
+			atomsnap_release_version(cur);
+
+			/* Ours or a newer merge; do not chase writers */
+			return atomsnap_acquire_version_slot(gate, cache_slot);
+		}
+
+		/* Another reader refreshed the cache first; check its merge */
+		atomsnap_free_version(merged);
+		atomsnap_release_version(cur);
+	}
 }
 
-/**
- * @brief   Set the user object and context for a version.
- *
- * @param   ver:          The version.
- * @param   object:       User object pointer.
- * @param   free_context: User free context.
- */
-void atomsnap_set_object(struct atomsnap_version *ver, void *object,
-	void *free_context)
+/* atomsnap_update_func of a publisher: rebuild, then apply pending deltas */
+static bool publisher_apply(const void *old_obj, void *new_obj, void *ctx)
 {
-	if (ver) {
-		ver->free_context = free_context;
-		atomic_store_explicit(&ver->object, object,
-			memory_order_release);
+	struct atomsnap_publisher *pub = ctx;
+	size_t size = pub->cfg.gate->object_size;
+	struct atomsnap_delta *delta;
+
+	if (old_obj != NULL) {
+		memcpy(new_obj, old_obj, size);
+	} else {
+		memset(new_obj, 0, size);
 	}
+
+	for (delta = pub->pending; delta != NULL; delta = delta->next) {
+		pub->cfg.apply(new_obj, delta, pub->cfg.ctx);
+	}
+
+	return true;
 }
 
 /**
- * @brief   Get the user payload object from a version.
+ * @brief   Publish everything posted so far as one version.
  *
- * @param   ver: The version pointer.
+ * Deltas stay pending if the version cannot be allocated, and are retried
+ * on the next period.
  *
- * @return  Pointer to the user object.
+ * @param   pub: Publisher; called from its thread only.
  */
-void *atomsnap_get_object(const struct atomsnap_version *ver)
+static void publisher_flush(struct atomsnap_publisher *pub)
 {
-	if (ver) {
-		return atomic_load_explicit(&ver->object,
-			memory_order_acquire);
+	struct atomsnap_delta *list, *delta, *next, *fifo = NULL, *last;
+
+	list = atomic_exchange_explicit(&pub->mailbox, NULL,
+		memory_order_acquire);
+
+	/* The mailbox is LIFO; restore posting order */
+	last = list;
+	for (delta = list; delta != NULL; delta = next) {
+		next = delta->next;
+		delta->next = fifo;
+		fifo = delta;
 	}
-	return NULL;
-}
 
-static inline _Atomic(uint64_t) *get_cb_slot(struct atomsnap_gate *gate,
-	int idx)
-{
-	return (idx == 0) ? &gate->control_block :
-		&gate->extra_control_blocks[idx - 1];
+	if (fifo != NULL) {
+		if (pub->pending == NULL) {
+			pub->pending = fifo;
+		} else {
+			pub->tail->next = fifo;
+		}
+		pub->tail = last;
+	}
+
+	if (pub->pending == NULL) {
+		return;
+	}
+
+	if (atomsnap_update_slot(pub->cfg.gate, pub->cfg.slot_idx,
+			publisher_apply, pub) != 1) {
+		return;
+	}
+
+	for (delta = pub->pending; delta != NULL; delta = next) {
+		next = delta->next;
+		if (pub->cfg.retire) {
+			pub->cfg.retire(delta, pub->cfg.ctx);
+		}
+	}
+
+	pub->pending = NULL;
+	pub->tail = NULL;
 }
 
-/**
- * @brief   Atomically acquire the current version from a slot.
- *
- * Increments the outer reference count.
- *
- * @param   gate:     Target gate.
- * @param   slot_idx: Control block slot index (0 for default).
- *
- * @return  Pointer to the acquired version.
- */
-struct atomsnap_version *atomsnap_acquire_version_slot(
-	struct atomsnap_gate *gate, int slot_idx)
+static void *publisher_thread(void *arg)
 {
-	_Atomic(uint64_t) *cb = get_cb_slot(gate, slot_idx);
-	uint64_t val;
-	uint32_t handle;
+	struct atomsnap_publisher *pub = arg;
+	struct timespec next;
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+
+	pthread_mutex_lock(&pub->lock);
+	while (!pub->stop) {
+		next.tv_nsec += (long)(pub->cfg.period_ns % 1000000000ULL);
+		next.tv_sec += (time_t)(pub->cfg.period_ns / 1000000000ULL);
+		if (next.tv_nsec >= 1000000000L) {
+			next.tv_nsec -= 1000000000L;
+			next.tv_sec++;
+		}
 
-	/* Increment Reference Count (Upper 32 bits) */
-	val = atomic_fetch_add_explicit(cb, REF_COUNT_INC,
-		memory_order_acquire);
+		/* Sleep until the period ends or destroy wakes us */
+		while (!pub->stop && pthread_cond_timedwait(&pub->wake,
+				&pub->lock, &next) != ETIMEDOUT) {
+		}
+		if (pub->stop) {
+			break;
+		}
+		pthread_mutex_unlock(&pub->lock);
 
-	handle = (uint32_t)(val & HANDLE_MASK_64);
+		publisher_flush(pub);
 
-	return resolve_handle(handle);
+		/* Holds no version while sleeping; do not stall QSBR */
+		atomsnap_thread_offline();
+
+		pthread_mutex_lock(&pub->lock);
+	}
+	pthread_mutex_unlock(&pub->lock);
+
+	publisher_flush(pub);
+
+	return NULL;
 }
 
 /**
- * @brief   Release a version previously acquired.
+ * @brief   Start a coalescing publisher thread for a gate slot.
  *
- * Increments the inner counter (upper 32 bits only).
- * If DETACHED is set and the counter becomes 0, the version is reclaimed.
+ * @param   pctx: Publisher configuration.
  *
- * @param   ver: Version to release.
+ * @return  New publisher, or NULL on failure.
  */
-void atomsnap_release_version(struct atomsnap_version *ver)
+struct atomsnap_publisher *atomsnap_publisher_create(
+	struct atomsnap_publisher_context *pctx)
 {
-	uint64_t prev, now;
+	struct atomsnap_publisher *pub;
+	pthread_condattr_t attr;
 
-	if (ver == NULL) {
-		return;
+	if (pctx->gate == NULL || pctx->apply == NULL ||
+			pctx->gate->object_size == 0 || pctx->period_ns == 0) {
+		errmsg("Invalid publisher configuration\n");
+		return NULL;
 	}
 
-	/*
-	 * Readers increment only the counter (upper 32 bits). Flags in the
-	 * lower 32 bits are never affected by carry/overflow.
-	 */
-	prev = atomic_fetch_add_explicit(&ver->inner_state, INNER_CNT_INC,
-		memory_order_acq_rel);
-	now = prev + INNER_CNT_INC;
+	pub = calloc(1, sizeof(struct atomsnap_publisher));
+	if (pub == NULL) {
+		errmsg("Publisher allocation failed\n");
+		return NULL;
+	}
 
-	try_finalize(ver, now);
+	pub->cfg = *pctx;
+	atomic_init(&pub->mailbox, NULL);
+	pub->stop = false;
+
+	/* The period deadlines are on the monotonic clock */
+	if (pthread_condattr_init(&attr) != 0) {
+		errmsg("Publisher condition attribute init failed\n");
+		free(pub);
+		return NULL;
+	}
+	if (pthread_condattr_setclock(&attr, CLOCK_MONOTONIC) != 0 ||
+			pthread_cond_init(&pub->wake, &attr) != 0) {
+		errmsg("Publisher condition init failed\n");
+		pthread_condattr_destroy(&attr);
+		free(pub);
+		return NULL;
+	}
+	pthread_condattr_destroy(&attr);
+	pthread_mutex_init(&pub->lock, NULL);
+
+	if (pthread_create(&pub->thread, NULL, publisher_thread, pub) != 0) {
+		errmsg("Publisher thread creation failed\n");
+		pthread_cond_destroy(&pub->wake);
+		pthread_mutex_destroy(&pub->lock);
+		free(pub);
+		return NULL;
+	}
+
+	return pub;
 }
 
 /**
- * @brief   Replace the version in the given slot unconditionally.
+ * @brief   Post a delta to a publisher.
  *
- * @param   gate:     Target gate.
- * @param   slot_idx: Control block slot index.
- * @param   new_ver:  New version to register.
+ * @param   pub:   Publisher.
+ * @param   delta: Delta to apply.
  */
-void atomsnap_exchange_version_slot(struct atomsnap_gate *gate, int slot_idx,
-	struct atomsnap_version *new_ver)
+void atomsnap_publisher_post(struct atomsnap_publisher *pub,
+	struct atomsnap_delta *delta)
 {
-	uint32_t new_handle = new_ver ? new_ver->self_handle : HANDLE_NULL;
-	_Atomic(uint64_t) *cb = get_cb_slot(gate, slot_idx);
-	uint64_t old_val;
-	uint32_t old_handle, old_refs;
-	struct atomsnap_version *old_ver;
-
-	/*
-	 * Swap the handle in the control block.
-	 * The new value will have 'new_handle' and 'RefCount = 0' (implicitly).
-	 */
-	old_val = atomic_exchange_explicit(cb, (uint64_t)new_handle,
-		memory_order_acq_rel);
-
-	old_handle = (uint32_t)(old_val & HANDLE_MASK_64);
-	old_refs = (uint32_t)((old_val & REF_COUNT_MASK) >> REF_COUNT_SHIFT);
+	struct atomsnap_delta *head;
 
-	old_ver = resolve_handle(old_handle);
-	if (old_ver) {
-		detach_and_adjust(old_ver, old_refs);
-	}
+	head = atomic_load_explicit(&pub->mailbox, memory_order_relaxed);
+	do {
+		delta->next = head;
+	} while (!atomic_compare_exchange_weak_explicit(&pub->mailbox, &head,
+			delta, memory_order_release, memory_order_relaxed));
 }
 
 /**
- * @brief   Conditionally replace the version if @old_ver matches.
- *
- * @param   gate:     Target gate.
- * @param   slot_idx: Control block slot index.
- * @param   expected: Expected current version.
- * @param   new_ver:  New version to register.
+ * @brief   Flush and stop a publisher.
  *
- * @return  true on successful exchange, false otherwise.
+ * @param   pub: Publisher.
  */
-bool atomsnap_compare_exchange_version_slot(struct atomsnap_gate *gate,
-	int slot_idx, struct atomsnap_version *expected,
-	struct atomsnap_version *new_ver)
+void atomsnap_publisher_destroy(struct atomsnap_publisher *pub)
 {
-	uint32_t new_handle = new_ver ? new_ver->self_handle : HANDLE_NULL;
-	uint32_t exp_handle = expected ? expected->self_handle : HANDLE_NULL;
-	_Atomic(uint64_t) *cb = get_cb_slot(gate, slot_idx);
-	uint64_t current_val, next_val;
-	uint32_t cur_handle, old_refs;
-	struct atomsnap_version *old_ver;
+	struct atomsnap_delta *delta, *next;
 
-	current_val = atomic_load_explicit(cb, memory_order_acquire);
-	cur_handle = (uint32_t)(current_val & HANDLE_MASK_64);
-
-	if (cur_handle != exp_handle) {
-		return false;
+	if (pub == NULL) {
+		return;
 	}
 
-	/*
-	 * CAS Loop:
-	 * Retry if RefCount changes but Handle is still expected.
-	 */
-	while (1) {
-		if ((uint32_t)(current_val & HANDLE_MASK_64) != exp_handle) {
-			return false;
-		}
+	pthread_mutex_lock(&pub->lock);
+	pub->stop = true;
+	pthread_cond_signal(&pub->wake);
+	pthread_mutex_unlock(&pub->lock);
 
-		next_val = (uint64_t)new_handle;
+	pthread_join(pub->thread, NULL);
+	pthread_cond_destroy(&pub->wake);
+	pthread_mutex_destroy(&pub->lock);
 
-		if (atomic_compare_exchange_weak_explicit(cb, &current_val,
-			next_val, memory_order_acq_rel,
-			memory_order_acquire)) {
-			break;
+	/* Only left over if the last version could not be allocated */
+	for (delta = pub->pending; delta != NULL; delta = next) {
+		next = delta->next;
+		if (pub->cfg.retire) {
+			pub->cfg.retire(delta, pub->cfg.ctx);
 		}
 	}
 
-	old_refs = (uint32_t)((current_val & REF_COUNT_MASK) >> REF_COUNT_SHIFT);
+	free(pub);
+}
 
-	old_ver = resolve_handle(exp_handle);
-	if (old_ver) {
-		detach_and_adjust(old_ver, old_refs);
-	}
+/**
+ * @brief   Report a quiescent state for the calling thread.
+ */
+void atomsnap_quiescent_state(void)
+{
+	struct thread_context *ctx = get_or_init_thread_context();
 
-	return true;
+	if (ctx) {
+		qsbr_report(ctx);
+	}
 }
 
+/**
+ * @brief   Take the calling thread offline for QSBR gates.
+ */
+void atomsnap_thread_offline(void)
+{
+	struct thread_context *ctx = get_or_init_thread_context();
+
+	if (ctx) {
+		atomic_store(&ctx->qsbr_epoch, 0);
+	}
+}
@@ -35,18 +35,166 @@ typedef struct atomsnap_version atomsnap_version;
  */
 typedef void (*atomsnap_free_func)(void *object, void *free_context);
 
+/*
+ * Gate flags (atomsnap_init_context.flags).
+ *
+ * ATOMSNAP_GATE_HAZARD: Readers publish the handle they hold in a per-thread
+ *                       hazard slot instead of incrementing the shared
+ *                       reference count. Writers scan the hazard slots before
+ *                       reclaiming a detached version.
+ *
+ * ATOMSNAP_GATE_QSBR:   Quiescent-state based reclamation. Readers only load
+ *                       the control block; replaced versions are kept on the
+ *                       writer's limbo list until every online thread has
+ *                       called atomsnap_quiescent_state().
+ *
+ * ATOMSNAP_GATE_REPLICATED: All 1 + num_extra_control_blocks control blocks
+ *                       replicate slot 0. A writer publishes one version into
+ *                       every replica in a single call, and readers acquire
+ *                       from the replica of the CPU they are running on.
+ *
+ * ATOMSNAP_GATE_PACKED_SLOTS: Pack the extra control blocks of a multi-slot
+ *                       gate into consecutive 8-byte words. By default each
+ *                       control block gets its own cache line so that slots
+ *                       do not false-share.
+ *
+ * ATOMSNAP_GATE_WIDE_LINES: Isolate the gate and its control blocks on
+ *                       128-byte instead of 64-byte lines, for CPUs that
+ *                       prefetch cache lines in adjacent pairs.
+ *
+ * ATOMSNAP_GATE_COMBINING: Enable atomsnap_combine(). Writers post update
+ *                       functions to the gate and one of them applies every
+ *                       pending update to a single inline copy of the object
+ *                       (object_size bytes) and publishes it once.
+ *
+ * ATOMSNAP_GATE_SINGLE_WRITER: Publishes to the gate never run concurrently
+ *                       (one writer thread, or writers serialized by the
+ *                       caller). The writer caches the current version of
+ *                       each slot and detaches replaced versions with a
+ *                       single atomic add. Cannot be combined with
+ *                       ATOMSNAP_GATE_COMBINING.
+ *
+ * ATOMSNAP_GATE_IN_PLACE: Let atomsnap_mutate_slot() modify the current
+ *                       object in place while no reader holds it. Readers
+ *                       that arrive meanwhile wait for the writer. Not
+ *                       available with HAZARD, QSBR or REPLICATED.
+ *
+ * ATOMSNAP_GATE_WRITE_SHARDED: Slots 0..num_extra_control_blocks-1 are
+ *                       writer shards (see atomsnap_shard_slot()) and the
+ *                       last slot caches their merge for
+ *                       atomsnap_acquire_merged(). Needs object_size and
+ *                       1 to ATOMSNAP_MAX_SHARDS shards. Not available with
+ *                       HAZARD, REPLICATED or SINGLE_WRITER (readers
+ *                       publish the merge).
+ *
+ * ATOMSNAP_GATE_STAMPED: Stamp every published version with a generation
+ *                       number (see atomsnap_get_generation()). The stamps
+ *                       live in a side table of each arena the gate's
+ *                       versions come from. Publishes from or to an empty
+ *                       slot take the gate's writer lock.
+ */
+#define ATOMSNAP_GATE_HAZARD    (1u << 0)
+#define ATOMSNAP_GATE_QSBR      (1u << 1)
+#define ATOMSNAP_GATE_REPLICATED (1u << 2)
+#define ATOMSNAP_GATE_PACKED_SLOTS (1u << 3)
+#define ATOMSNAP_GATE_WIDE_LINES (1u << 4)
+#define ATOMSNAP_GATE_COMBINING (1u << 5)
+#define ATOMSNAP_GATE_SINGLE_WRITER (1u << 6)
+#define ATOMSNAP_GATE_IN_PLACE  (1u << 7)
+#define ATOMSNAP_GATE_WRITE_SHARDED (1u << 8)
+#define ATOMSNAP_GATE_STAMPED   (1u << 9)
+
+/* Shards of a write-sharded gate, merged in one go */
+#define ATOMSNAP_MAX_SHARDS     (64)
+
+/* Replaced versions a gate can keep per slot */
+#define ATOMSNAP_MAX_HISTORY    (1024)
+
+/**
+ * @brief   Reader lease that keeps a version pinned between refreshes.
+ *
+ * Zero-initialize before first use. The fields are managed by
+ * atomsnap_lease_refresh() and atomsnap_lease_release().
+ *
+ * @version:  Version currently pinned by the lease (NULL if none).
+ */
+typedef struct atomsnap_lease {
+	struct atomsnap_version *version;
+} atomsnap_lease;
+
 /**
  * @brief   Initialization context for creating a new gate.
  *
  * @free_impl:        Required callback to free the user object.
  * @num_extra_slots:  Number of extra control block slots.
  *                    Set to 0 for a single slot.
+ * @flags:            Bitwise OR of ATOMSNAP_GATE_* flags (0 for default).
+ * @object_size:      Size of the inline objects built by
+ *                    atomsnap_update_slot() and atomsnap_combine()
+ *                    (0 to ATOMSNAP_INLINE_PAYLOAD_MAX). Required for
+ *                    ATOMSNAP_GATE_COMBINING.
+ * @history_depth:    Replaced versions kept per slot for
+ *                    atomsnap_acquire_version_at() (0 to
+ *                    ATOMSNAP_MAX_HISTORY). Not supported on hazard and
+ *                    QSBR gates.
  */
 typedef struct atomsnap_init_context {
 	atomsnap_free_func free_impl;
 	int num_extra_control_blocks;
+	uint32_t flags;
+	size_t object_size;
+	int history_depth;
 } atomsnap_init_context;
 
+/**
+ * @brief   Builds the next object of a slot for atomsnap_update_slot().
+ *
+ * May be called several times for one update if the publish races with
+ * another writer; every call must rebuild @new_obj from @old_obj.
+ *
+ * @param   old_obj: Current object (NULL if the slot is empty). Read-only.
+ * @param   new_obj: Storage for the next object (object_size bytes).
+ * @param   ctx:     Argument passed to atomsnap_update_slot().
+ *
+ * @return  true to publish @new_obj, false to leave the slot unchanged.
+ */
+typedef bool (*atomsnap_update_func)(const void *old_obj, void *new_obj,
+	void *ctx);
+
+/**
+ * @brief   Modifies an object for atomsnap_mutate_slot().
+ *
+ * @param   object: Object to modify; either the published object itself
+ *                  (no reader can see it meanwhile) or a private copy.
+ * @param   ctx:    Argument passed to atomsnap_mutate_slot().
+ */
+typedef void (*atomsnap_mutate_func)(void *object, void *ctx);
+
+/**
+ * @brief   Merges the shards of a write-sharded gate.
+ *
+ * @param   merged:     Zeroed storage for the merged object (object_size).
+ * @param   shards:     Current object of every shard (NULL if empty).
+ * @param   num_shards: Number of shards.
+ * @param   ctx:        Argument passed to atomsnap_acquire_merged().
+ */
+typedef void (*atomsnap_merge_func)(void *merged, const void *const *shards,
+	int num_shards, void *ctx);
+
+/**
+ * @brief   Update applied by the combiner of a combining gate.
+ *
+ * Modifies the object in place. The object is a private copy of the
+ * current object that is not visible to readers yet. Must not call
+ * atomsnap_combine() on the same gate.
+ *
+ * @param   object: Copy of the current object (zeroed if the slot is empty).
+ * @param   arg:    Argument passed to atomsnap_combine().
+ *
+ * @return  Value handed back to the posting writer.
+ */
+typedef int64_t (*atomsnap_combine_func)(void *object, void *arg);
+
 /**
  * @brief   Create a new atomsnap_gate instance.
  *
@@ -74,6 +222,24 @@ void atomsnap_destroy_gate(struct atomsnap_gate *gate);
  */
 struct atomsnap_version *atomsnap_make_version(struct atomsnap_gate *gate);
 
+/**
+ * @brief   Allocate a version with an inline payload of @size bytes.
+ *
+ * The payload lives in the same arena slot as the version metadata, so no
+ * separate allocation or free_impl call is needed for it. The version's
+ * object already points to the payload; fill it through
+ * atomsnap_get_object() before publishing. Payloads must not need a
+ * destructor. The payload is 16-byte aligned, enough for any type that
+ * malloc() memory can hold.
+ *
+ * @param   gate: Gate to associate with the version.
+ * @param   size: Payload size in bytes (1 to 256).
+ *
+ * @return  Pointer to the new version, or NULL on failure.
+ */
+struct atomsnap_version *atomsnap_make_version_inline(
+	struct atomsnap_gate *gate, size_t size);
+
 /**
  * @brief   Manually free a version that was created but NEVER exchanged.
  *
@@ -127,6 +293,124 @@ struct atomsnap_version *atomsnap_acquire_version_slot(
  */
 void atomsnap_release_version(struct atomsnap_version *ver);
 
+/**
+ * @brief   Acquire the current versions of many (gate, slot) pairs.
+ *
+ * Same result as atomsnap_acquire_version_slot() per entry, with the loads
+ * of all entries pipelined so their cache misses overlap. To read every
+ * slot of a multi-slot gate, pass the gate n times with slots 0..n-1.
+ *
+ * @param   gates: Gates to read.
+ * @param   slots: Slot index per gate, or NULL for slot 0 everywhere.
+ * @param   n:     Number of entries.
+ * @param   out:   Receives the acquired versions (NULL for empty slots).
+ */
+void atomsnap_acquire_many(struct atomsnap_gate *const *gates,
+	const int *slots, int n, struct atomsnap_version **out);
+
+/**
+ * @brief   Release many versions at once.
+ *
+ * Same result as atomsnap_release_version() per entry. NULL entries are
+ * skipped and repeated versions are released with a single atomic add.
+ *
+ * @param   vers: Versions to release.
+ * @param   n:    Number of entries.
+ */
+void atomsnap_release_many(struct atomsnap_version *const *vers, int n);
+
+/**
+ * @brief   Generation number of a published version.
+ *
+ * On an ATOMSNAP_GATE_STAMPED gate every publish stamps the new version
+ * with one more than the stamp of the version it replaces, before it
+ * becomes visible, so the stamp is a plain read of writer-owned memory.
+ * A slot's stamps strictly increase in publish order, also across
+ * racing writers and while the slot is empty.
+ *
+ * @param   ver: Acquired version.
+ *
+ * @return  Generation (from 1), or 0 if @ver is NULL, never published or
+ *          not from a stamped gate.
+ */
+uint64_t atomsnap_get_generation(struct atomsnap_version *ver);
+
+/**
+ * @brief   Acquire a current or recently replaced version of a slot.
+ *
+ * Gates created with a history_depth keep the last history_depth versions
+ * replaced in each slot alive. With concurrent writers, the history is in
+ * the order the versions were detached. Reads of the history take no lock
+ * and never delay writers; a read that overlaps a writer's push of the
+ * same slot is retried.
+ *
+ * @param   gate:      Target gate.
+ * @param   slot_idx:  Control block slot index.
+ * @param   back:      0 for the current version, k for the k-th most
+ *                     recently replaced one (up to history_depth).
+ *
+ * @return  Acquired version (release with atomsnap_release_version()), or
+ *          NULL if the slot or the history entry is empty.
+ */
+struct atomsnap_version *atomsnap_acquire_version_at(
+	struct atomsnap_gate *gate, int slot_idx, int back);
+
+/**
+ * @brief   Acquire several slots of a gate as one consistent snapshot.
+ *
+ * The returned versions were all current at the same moment with respect
+ * to atomsnap_exchange_slots(): a transaction is seen either completely
+ * or not at all. Release the versions with atomsnap_release_many().
+ *
+ * @param   gate:     Target gate.
+ * @param   slot_ids: Slots to read.
+ * @param   n:        Number of slots.
+ * @param   out:      Receives the acquired versions (NULL for empty slots).
+ */
+void atomsnap_acquire_slots_consistent(struct atomsnap_gate *gate,
+	const int *slot_ids, int n, struct atomsnap_version **out);
+
+/**
+ * @brief   Return the current version of a slot through a lease.
+ *
+ * If the slot still publishes the version pinned by @lease, it is returned
+ * after a single plain load of the control block. Otherwise the pinned
+ * version is released and the current one is acquired into the lease.
+ *
+ * @param   gate:     Target gate.
+ * @param   slot_idx: Control block slot index.
+ * @param   lease:    Lease owned by the calling thread.
+ *
+ * @return  Pointer to the current version (owned by the lease).
+ */
+struct atomsnap_version *atomsnap_lease_refresh(struct atomsnap_gate *gate,
+	int slot_idx, struct atomsnap_lease *lease);
+
+/**
+ * @brief   Release the version pinned by a lease.
+ *
+ * @param   lease: Lease to empty.
+ */
+void atomsnap_lease_release(struct atomsnap_lease *lease);
+
+/**
+ * @brief   Acquire the merge of all shards of a write-sharded gate.
+ *
+ * Returns the cached merged version if no shard has been published to
+ * since it was built. Otherwise acquires every shard, builds a new merged
+ * object with @fn and publishes it to the cache slot, so that other
+ * readers can share it.
+ *
+ * @param   gate: Gate created with ATOMSNAP_GATE_WRITE_SHARDED.
+ * @param   fn:   Merge function; must be the same for all readers.
+ * @param   ctx:  Argument passed to @fn.
+ *
+ * @return  Merged version (release with atomsnap_release_version()), or
+ *          NULL on failure.
+ */
+struct atomsnap_version *atomsnap_acquire_merged(struct atomsnap_gate *gate,
+	atomsnap_merge_func fn, void *ctx);
+
 /**
  * @brief   Replace the version in the given slot unconditionally.
  *
@@ -151,6 +435,262 @@ bool atomsnap_compare_exchange_version_slot(struct atomsnap_gate *gate,
 	int slot_idx, struct atomsnap_version *expected,
 	struct atomsnap_version *new_ver);
 
+/**
+ * @brief   Take a change-detection token of a slot.
+ *
+ * Reads a per-slot publish counter that lives apart from the control
+ * blocks, so pollers never touch refcounts or versions.
+ *
+ * @param   gate:     Target gate.
+ * @param   slot_idx: Control block slot index.
+ *
+ * @return  Opaque token for atomsnap_changed_since().
+ */
+uint64_t atomsnap_peek_generation(struct atomsnap_gate *gate, int slot_idx);
+
+/**
+ * @brief   Check whether a slot was published to since a token was taken.
+ *
+ * @param   gate:     Target gate.
+ * @param   slot_idx: Control block slot index.
+ * @param   token:    Token from atomsnap_peek_generation().
+ *
+ * @return  true if the slot has been exchanged since @token was taken.
+ */
+bool atomsnap_changed_since(struct atomsnap_gate *gate, int slot_idx,
+	uint64_t token);
+
+/**
+ * @brief   Shard of a write-sharded gate that the calling thread writes to.
+ *
+ * Threads are spread over the shards by thread ID, so writers only share
+ * a shard once there are more writers than shards.
+ *
+ * @param   gate: Gate created with ATOMSNAP_GATE_WRITE_SHARDED.
+ *
+ * @return  Slot index to publish to, or -1 on failure.
+ */
+int atomsnap_shard_slot(struct atomsnap_gate *gate);
+
+/**
+ * @brief   Publish a version only if its sequence is newer.
+ *
+ * For monotonic publishers (e.g. market data with exchange sequence
+ * numbers). The slot remembers the highest sequence claimed so far;
+ * publishers with an older or equal sequence fail after a single load,
+ * without acquiring or reading the current version. Sequences must be
+ * greater than 0.
+ *
+ * Like atomsnap_compare_exchange_version_slot(), a version that was not
+ * published still belongs to the caller (see atomsnap_free_version()).
+ * Writers that bypass this call (exchange/CAS) are not ordered against it.
+ *
+ * @param   gate:     Target gate.
+ * @param   slot_idx: Control block slot index.
+ * @param   new_ver:  Version to publish.
+ * @param   seq:      Sequence number of @new_ver.
+ *
+ * @return  true if @new_ver was published, false if the slot already saw
+ *          @seq or a newer sequence.
+ */
+bool atomsnap_publish_if_newer(struct atomsnap_gate *gate, int slot_idx,
+	struct atomsnap_version *new_ver, uint64_t seq);
+
+/**
+ * @brief   Publish versions to several slots of a gate as one transaction.
+ *
+ * Readers using atomsnap_acquire_slots_consistent() see either all of the
+ * previous versions or all of @vers. Transactions on a gate are
+ * serialized. Single-slot writers of the same slots bypass the transaction
+ * and are not covered by this guarantee.
+ *
+ * @param   gate:     Target gate.
+ * @param   slot_ids: Slots to publish to.
+ * @param   vers:     Version per slot (may contain NULL).
+ * @param   n:        Number of slots.
+ *
+ * @return  0 on success, -1 on an invalid slot index.
+ */
+int atomsnap_exchange_slots(struct atomsnap_gate *gate, const int *slot_ids,
+	struct atomsnap_version *const *vers, int n);
+
+/**
+ * @brief   Read-modify-publish a slot.
+ *
+ * Acquires the current version, lets @fn build the next object in the
+ * inline payload of a new version and publishes it with a CAS. On CAS
+ * failure the same version and payload are reused for the retry, so the
+ * loop neither allocates nor frees, and retries back off exponentially
+ * with contention. The old version is released after the CAS, as the
+ * protocol requires.
+ *
+ * @param   gate:     Gate created with a non-zero object_size.
+ * @param   slot_idx: Control block slot index.
+ * @param   fn:       Builds the next object from the current one.
+ * @param   ctx:      Argument passed to @fn.
+ *
+ * @return  1 if a new version was published, 0 if @fn declined, -1 if the
+ *          gate has no object_size or the version could not be allocated.
+ */
+int atomsnap_update_slot(struct atomsnap_gate *gate, int slot_idx,
+	atomsnap_update_func fn, void *ctx);
+
+/**
+ * @brief   Modify a slot's object, in place if no reader holds it.
+ *
+ * On an ATOMSNAP_GATE_IN_PLACE gate, if every reader that acquired the
+ * current version has released it, the writer parks the control block on
+ * a busy handle, runs @fn on the published object and restores the
+ * control block. No version is allocated or freed. Readers arriving in
+ * that window wait until the object is consistent again.
+ *
+ * Otherwise the object (object_size bytes, trivially copyable) is copied
+ * into a new inline version, @fn runs on the copy and the copy is
+ * published as with atomsnap_update_slot().
+ *
+ * @param   gate:     Gate created with a non-zero object_size.
+ * @param   slot_idx: Control block slot index.
+ * @param   fn:       Modification; may run on the copy more than once.
+ * @param   ctx:      Argument passed to @fn.
+ *
+ * @return  1 if the object was modified in place, 0 if a modified copy
+ *          was published, -1 on failure.
+ */
+int atomsnap_mutate_slot(struct atomsnap_gate *gate, int slot_idx,
+	atomsnap_mutate_func fn, void *ctx);
+
+/**
+ * @brief   Apply an update to a slot of a combining gate.
+ *
+ * Posts @fn to the gate's publication list and waits until it has been
+ * applied. Whichever waiting writer holds the combiner role copies the
+ * current object once, runs every pending update of the slot on the copy
+ * in posting order and publishes the result as a single version, so
+ * concurrent writers do not fight over the control block.
+ *
+ * If another thread publishes to the slot directly while the combiner is
+ * working, the combiner's CAS fails and the pending updates are re-run on
+ * a fresh copy.
+ *
+ * @param   gate:     Gate created with ATOMSNAP_GATE_COMBINING.
+ * @param   slot_idx: Control block slot index.
+ * @param   fn:       Update function.
+ * @param   arg:      Argument passed to @fn.
+ * @param   result:   Receives the return value of @fn (may be NULL).
+ *
+ * @return  0 on success, -1 if the gate is not a combining gate or the new
+ *          version could not be allocated (the update was not applied).
+ */
+int atomsnap_combine(struct atomsnap_gate *gate, int slot_idx,
+	atomsnap_combine_func fn, void *arg, int64_t *result);
+
+/**
+ * @brief   Report a quiescent state for the calling thread.
+ *
+ * Declares that the calling thread no longer uses any version acquired from
+ * an ATOMSNAP_GATE_QSBR gate. Threads that acquire from QSBR gates must call
+ * this periodically, otherwise replaced versions cannot be reclaimed.
+ */
+void atomsnap_quiescent_state(void);
+
+/**
+ * @brief   Take the calling thread offline for QSBR gates.
+ *
+ * An offline thread does not delay reclamation. The next acquire from a
+ * QSBR gate brings the thread back online.
+ */
+void atomsnap_thread_offline(void);
+
+/**
+ * @brief   Mailbox link embedded in a producer's delta.
+ *
+ * Embed it in the update message and post the message with
+ * atomsnap_publisher_post(). The publisher hands it back through the
+ * retire callback once the delta is part of a published version.
+ *
+ * @next:  Managed by the publisher.
+ */
+typedef struct atomsnap_delta {
+	struct atomsnap_delta *next;
+} atomsnap_delta;
+
+/**
+ * @brief   Applies one delta to the object being built by a publisher.
+ *
+ * May run more than once for the same delta if another writer publishes
+ * to the slot concurrently; every run starts from a fresh copy.
+ *
+ * @param   object: Copy of the current object (zeroed if the slot is empty).
+ * @param   delta:  Posted delta.
+ * @param   ctx:    Publisher context argument.
+ */
+typedef void (*atomsnap_apply_func)(void *object,
+	const struct atomsnap_delta *delta, void *ctx);
+
+/**
+ * @brief   Called once a delta has been published (or on destroy).
+ *
+ * @param   delta: Delta that is no longer referenced by the publisher.
+ * @param   ctx:   Publisher context argument.
+ */
+typedef void (*atomsnap_retire_func)(struct atomsnap_delta *delta, void *ctx);
+
+typedef struct atomsnap_publisher atomsnap_publisher;
+
+/**
+ * @brief   Configuration of a coalescing publisher.
+ *
+ * @gate:       Gate to publish to; needs an object_size.
+ * @slot_idx:   Slot to publish to.
+ * @apply:      Applies one delta.
+ * @retire:     Returns a published delta to its producer (may be NULL).
+ * @ctx:        Argument for @apply and @retire.
+ * @period_ns:  Publish at most once per period. A posted delta becomes
+ *              visible within about one period.
+ */
+typedef struct atomsnap_publisher_context {
+	struct atomsnap_gate *gate;
+	int slot_idx;
+	atomsnap_apply_func apply;
+	atomsnap_retire_func retire;
+	void *ctx;
+	uint64_t period_ns;
+} atomsnap_publisher_context;
+
+/**
+ * @brief   Start a coalescing publisher thread for a gate slot.
+ *
+ * Producers post deltas to a lock-free mailbox. Once per period the
+ * publisher copies the current object into one new inline version,
+ * applies every delta that arrived meanwhile in posting order and
+ * publishes it, so a burst of updates costs a single version.
+ *
+ * @param   pctx: Publisher configuration.
+ *
+ * @return  New publisher, or NULL on failure.
+ */
+struct atomsnap_publisher *atomsnap_publisher_create(
+	struct atomsnap_publisher_context *pctx);
+
+/**
+ * @brief   Post a delta to a publisher. Lock-free, callable from any thread.
+ *
+ * @param   pub:   Publisher.
+ * @param   delta: Delta to apply; owned by the publisher until retired.
+ */
+void atomsnap_publisher_post(struct atomsnap_publisher *pub,
+	struct atomsnap_delta *delta);
+
+/**
+ * @brief   Stop a publisher.
+ *
+ * Publishes the deltas posted so far, stops the thread and frees the
+ * publisher. Deltas must not be posted concurrently.
+ *
+ * @param   pub: Publisher from atomsnap_publisher_create().
+ */
+void atomsnap_publisher_destroy(struct atomsnap_publisher *pub);
+
 /*
  * Convenience wrappers for slot 0 (backward compatibility).
  */
@@ -166,4 +706,13 @@ bool atomsnap_compare_exchange_version_slot(struct atomsnap_gate *gate,
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
+
+/*
+ * Define ATOMSNAP_INLINE before including this header to inline the reader
+ * fast paths (acquire, release, get_object) into the caller.
+ */
+#ifdef ATOMSNAP_INLINE
+#include "atomsnap_inline.h"
+#endif /* ATOMSNAP_INLINE */
+
 #endif /* ATOMSNAP_H */
@@ -0,0 +1,508 @@
+#ifndef ATOMSNAP_INLINE_H
+#define ATOMSNAP_INLINE_H
+
+/**
+ * @file    atomsnap_inline.h
+ * @brief   Internal layout and header-inlined reader fast paths.
+ *
+ * This header is included by atomsnap.c for the layout of gates, versions
+ * and arenas. It is also included by atomsnap.h when ATOMSNAP_INLINE is
+ * defined, in which case atomsnap_acquire_version_slot(),
+ * atomsnap_release_version() and atomsnap_get_object() become static inline
+ * functions that avoid the call (and PLT) overhead of libatomsnap.so.
+ *
+ * Code built with ATOMSNAP_INLINE must use the same atomsnap version as the
+ * library it links against, since the layout below is not a stable ABI.
+ */
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "atomsnap.h"
+
+#ifdef __cplusplus
+/* Plain fields with the same layout; accessed with __atomic builtins */
+#define ATOMSNAP_ATOMIC(T)    T
+extern "C" {
+#else
+#include <stdatomic.h>
+#define ATOMSNAP_ATOMIC(T)    _Atomic(T)
+#endif /* __cplusplus */
+
+#if defined(__GNUC__)
+#define ATOMSNAP_LIKELY(x)    __builtin_expect(!!(x), 1)
+#define ATOMSNAP_UNLIKELY(x)  __builtin_expect(!!(x), 0)
+#else
+#define ATOMSNAP_LIKELY(x)    (x)
+#define ATOMSNAP_UNLIKELY(x)  (x)
+#endif
+
+/*
+ * ATOMSNAP_SLOT_SIZE: Size of a version slot in an arena, selected at build
+ * time (make SLOT_SIZE=32|40|64). Code built with ATOMSNAP_INLINE must use
+ * the same value as the library.
+ *
+ * - 40: Default. Versions are packed back to back, so a slot can straddle
+ *       two cache lines and share them with its neighbours.
+ * - 32: Compact. The gate pointer is replaced by a 32-bit gate index, and
+ *       two slots fill a cache line without straddling it.
+ * - 64: Padded. Every slot owns a cache line, so releasing a version (which
+ *       writes inner_state) never false-shares with a neighbouring slot.
+ */
+#ifndef ATOMSNAP_SLOT_SIZE
+#define ATOMSNAP_SLOT_SIZE           (40)
+#endif
+
+/*
+ * Arenas are always 32 pages (131,072 bytes). The number of slots and the
+ * width of the slot index in a handle follow from the slot size; slot 0 of
+ * every arena is the Sentinel.
+ *
+ * - 40: header 8B,  3,276 slots (131,048 bytes), 12-bit slot index.
+ * - 32: header 32B, 4,095 slots (131,072 bytes), 12-bit slot index.
+ * - 64: header 64B, 2,047 slots (131,072 bytes), 11-bit slot index.
+ *
+ * The header is padded to the slot size so that slots stay aligned to it.
+ */
+#if ATOMSNAP_SLOT_SIZE == 40
+#define ATOMSNAP_SLOTS_PER_ARENA     (3276)
+#define ATOMSNAP_HANDLE_SLOT_BITS    (12)
+#elif ATOMSNAP_SLOT_SIZE == 32
+#define ATOMSNAP_SLOTS_PER_ARENA     (4095)
+#define ATOMSNAP_HANDLE_SLOT_BITS    (12)
+#elif ATOMSNAP_SLOT_SIZE == 64
+#define ATOMSNAP_SLOTS_PER_ARENA     (2047)
+#define ATOMSNAP_HANDLE_SLOT_BITS    (11)
+#else
+#error "ATOMSNAP_SLOT_SIZE must be 32, 40 or 64"
+#endif
+
+/* Bit layout for the 32-bit handle: [ Arena | Slot ] */
+#define ATOMSNAP_HANDLE_ARENA_BITS   (32 - ATOMSNAP_HANDLE_SLOT_BITS)
+#define ATOMSNAP_HANDLE_SLOT_MASK    ((1u << ATOMSNAP_HANDLE_SLOT_BITS) - 1)
+
+/*
+ * ATOMSNAP_MAX_ARENAS: Corresponds to the arena part of a handle
+ * (1,048,576 arenas with a 12-bit slot index). The last arena index is
+ * never allocated; its top handles are reserved.
+ */
+#define ATOMSNAP_MAX_ARENAS          (1u << ATOMSNAP_HANDLE_ARENA_BITS)
+
+#define ATOMSNAP_HANDLE_NULL         (0xFFFFFFFFu)
+
+/* Control block handle while a writer mutates the version in place */
+#define ATOMSNAP_HANDLE_BUSY         (0xFFFFFFFEu)
+
+/* Arena size: 32 pages (131,072 bytes), page aligned */
+#define ATOMSNAP_ARENA_SIZE          (32 * 4096)
+
+/*
+ * Size classes of arenas. Class 0 arenas hold plain versions. Class c
+ * (1..5) arenas hold versions followed by an inline payload of (8 << c)
+ * bytes, i.e. 16, 32, 64, 128 and 256 bytes (atomsnap_make_version_inline).
+ *
+ * The class of an arena is stored in the low bits of its (page aligned)
+ * arena table entry, so resolving a handle needs no extra load.
+ */
+#define ATOMSNAP_SIZE_CLASSES        (6)
+#define ATOMSNAP_INLINE_PAYLOAD_MAX  (256)
+#define ATOMSNAP_ARENA_CLASS_MASK    ((uintptr_t)0x7)
+
+/*
+ * Inline payloads are aligned like malloc() memory on common ABIs: class
+ * strides are rounded up to this, and every slot layout puts the first
+ * payload of an arena on such a boundary.
+ */
+#define ATOMSNAP_PAYLOAD_ALIGN       (16)
+
+/*
+ * The arena table is two-level: a directory of chunks of
+ * ATOMSNAP_ARENA_CHUNK entries each. A chunk is allocated with the first
+ * arena it covers and never freed, so lookups need no lock.
+ */
+#define ATOMSNAP_ARENA_CHUNK_BITS    (10)
+#define ATOMSNAP_ARENA_CHUNK         (1u << ATOMSNAP_ARENA_CHUNK_BITS)
+#define ATOMSNAP_ARENA_DIR_SIZE      \
+	(ATOMSNAP_MAX_ARENAS >> ATOMSNAP_ARENA_CHUNK_BITS)
+
+/*
+ * ATOMSNAP_MAX_GATES: Gates that can exist at once with compact slots,
+ * which refer to their gate by index. The gate table is two-level like the
+ * arena table; a chunk of ATOMSNAP_GATE_CHUNK entries is allocated with
+ * the first index it covers and never freed.
+ */
+#define ATOMSNAP_MAX_GATES           (65536)
+#define ATOMSNAP_GATE_CHUNK_BITS     (10)
+#define ATOMSNAP_GATE_CHUNK          (1u << ATOMSNAP_GATE_CHUNK_BITS)
+#define ATOMSNAP_GATE_DIR_SIZE       \
+	(ATOMSNAP_MAX_GATES >> ATOMSNAP_GATE_CHUNK_BITS)
+
+/*
+ * Control Block (64-bit)
+ * Layout: [ 32-bit RefCount | 32-bit Handle ]
+ */
+#define ATOMSNAP_REF_COUNT_SHIFT     (32)
+#define ATOMSNAP_REF_COUNT_INC       (1ULL << ATOMSNAP_REF_COUNT_SHIFT)
+#define ATOMSNAP_REF_COUNT_MASK      (0xFFFFFFFF00000000ULL)
+#define ATOMSNAP_HANDLE_MASK_64      (0x00000000FFFFFFFFULL)
+
+/*
+ * Inner State (64-bit)
+ * Layout: [ 32-bit Counter | 32-bit Flags ]
+ */
+#define ATOMSNAP_INNER_CNT_SHIFT     (32)
+#define ATOMSNAP_INNER_CNT_INC       (1ULL << ATOMSNAP_INNER_CNT_SHIFT)
+#define ATOMSNAP_INNER_F_DETACHED    (1u << 0)
+#define ATOMSNAP_INNER_F_FINALIZED   (1u << 1)
+
+/* Gate flags that need the out-of-line reader paths */
+#define ATOMSNAP_GATE_SLOW_READ \
+	(ATOMSNAP_GATE_HAZARD | ATOMSNAP_GATE_QSBR | \
+	 ATOMSNAP_GATE_REPLICATED | ATOMSNAP_GATE_IN_PLACE)
+
+/*
+ * atomsnap_version - Internal representation of a version.
+ *
+ * This structure is allocated within memory arenas. It contains both the
+ * user-facing payload fields and internal management fields.
+ *
+ * @object:        Public-facing pointer to the user object.
+ * @free_context:  User-defined context for the free function.
+ * @gate:          Pointer to the gate this version belongs to.
+ * @gate_idx:      Index of the gate in the gate table (32B slots).
+ * @read_mode:     The gate's ATOMSNAP_GATE_HAZARD and ATOMSNAP_GATE_QSBR
+ *                 flags, copied when the version is made so that release
+ *                 never loads the gate (whose flags share the line
+ *                 readers increment) or walks the gate table.
+ * @inner_state:   [32-bit Counter | 32-bit Flags] for reclamation.
+ * @retire:        Overlays inner_state once the version is retired on a
+ *                 hazard or QSBR gate, whose readers never touch it.
+ *                 @epoch is the QSBR retire epoch, @next the next node in
+ *                 the retire stack or limbo list.
+ * @self_handle:   Handle identifying this version (when allocated).
+ * @next_handle:   Handle to the next node in the stack (when freed).
+ *
+ * [ Memory Layout ]
+ * 00-08: object (8B)
+ * 08-16: free_context (8B)
+ * 16-24: gate (8B)                  | 16-24: inner_state / retire (8B)
+ * 24-32: inner_state / retire (8B)  | 24-28: self_handle / next_handle (4B)
+ * 32-36: self_handle / next_handle  | 28-30: gate_idx (2B)
+ * 36-38: gate_idx (unused, 2B)      | 30-32: read_mode (2B)
+ * 38-40: read_mode (2B)             | (32B slots)
+ * 40-64: padding (64B slots only)   |
+ */
+struct atomsnap_version {
+	ATOMSNAP_ATOMIC(void *) object;
+	void *free_context;
+#if ATOMSNAP_SLOT_SIZE != 32
+	struct atomsnap_gate *gate;
+#endif
+	union {
+		ATOMSNAP_ATOMIC(uint64_t) inner_state;
+		struct {
+			uint32_t epoch;
+			uint32_t next;
+		} retire;
+	};
+	union {
+		uint32_t self_handle;
+		ATOMSNAP_ATOMIC(uint32_t) next_handle;
+	};
+	uint16_t gate_idx;
+	uint16_t read_mode;
+#if ATOMSNAP_SLOT_SIZE == 64
+	char pad[24];
+#endif
+};
+
+/*
+ * atomsnap_arena - Contiguous block of version slots.
+ *
+ * @top_handle: Handle of the top node in the shared stack.
+ * @pad:        Keeps the slots aligned to the slot size.
+ * @slots:      Array of version structures. Slot 0 is the Sentinel.
+ */
+struct atomsnap_arena {
+	ATOMSNAP_ATOMIC(uint64_t) top_handle;
+#if ATOMSNAP_SLOT_SIZE != 40
+	char pad[ATOMSNAP_SLOT_SIZE - 8];
+#endif
+	struct atomsnap_version slots[ATOMSNAP_SLOTS_PER_ARENA];
+};
+
+/*
+ * atomsnap_gate - Gate structure.
+ *
+ * @control_block:        64-bit atomic [RefCnt | Handle].
+ * @free_impl:            User callback for object cleanup.
+ * @extra_control_blocks: Array for multi-slot gates.
+ * @num_extra_slots:      Number of extra slots.
+ * @cb_stride:            Distance between extra control blocks (in words).
+ * @flags:                ATOMSNAP_GATE_* flags.
+ * @replica_lock:         Serializes writers of a replicated gate, and
+ *                        publishes from or to an empty slot of a stamped
+ *                        gate.
+ * @retired_head:         Top of the retire stack (hazard mode).
+ * @retired_cnt:          Number of versions in the retire stack.
+ * @qsbr_pending:         Versions in limbo lists | QSBR_GATE_DEAD.
+ * @gate_idx:             Index in the gate table (32B slots).
+ * @generations:          Publish counter per slot, one line apart so that
+ *                        pollers never read a control block line or
+ *                        another slot's counter.
+ * @sequences:            Highest sequence claimed per slot by
+ *                        atomsnap_publish_if_newer(), one line apart.
+ * @object_size:          Inline object size for update/combine.
+ * @fc_head:              Publication list of combining writers.
+ * @fc_lock:              Held by the current combiner.
+ * @sw_current:           Writer's copy of each slot's current version
+ *                        (ATOMSNAP_GATE_SINGLE_WRITER only).
+ * @stamp_base:           Last stamp of each emptied slot
+ *                        (ATOMSNAP_GATE_STAMPED only).
+ */
+struct atomsnap_gate {
+	ATOMSNAP_ATOMIC(uint64_t) control_block;
+	atomsnap_free_func free_impl;
+	ATOMSNAP_ATOMIC(uint64_t) *extra_control_blocks;
+	int num_extra_slots;
+	int cb_stride;
+	uint32_t flags;
+	ATOMSNAP_ATOMIC(bool) replica_lock;
+	ATOMSNAP_ATOMIC(uint32_t) retired_head;
+	ATOMSNAP_ATOMIC(uint32_t) retired_cnt;
+	ATOMSNAP_ATOMIC(uint32_t) qsbr_pending;
+	uint32_t gate_idx;
+	ATOMSNAP_ATOMIC(uint64_t) *generations;
+	/* Writer-side state; starts the second line, away from control_block */
+	ATOMSNAP_ATOMIC(uint64_t) *sequences;
+	size_t object_size;
+	ATOMSNAP_ATOMIC(struct atomsnap_combine_req *) fc_head;
+	ATOMSNAP_ATOMIC(bool) fc_lock;
+	struct atomsnap_version **sw_current;
+	ATOMSNAP_ATOMIC(uint64_t) txn_seq;
+	int history_depth;
+	struct atomsnap_history *history;
+	ATOMSNAP_ATOMIC(uint64_t) *stamp_base;
+};
+
+/*
+ * Directory of the global arena table, indexed by the upper bits of the
+ * arena part of a handle. Entries of a chunk are tagged with the size
+ * class of the arena (ATOMSNAP_ARENA_CLASS_MASK).
+ */
+extern struct atomsnap_arena **atomsnap_arena_dir[ATOMSNAP_ARENA_DIR_SIZE];
+
+#if ATOMSNAP_SLOT_SIZE == 32
+/* Directory of the global gate table, indexed by atomsnap_version.gate_idx */
+extern struct atomsnap_gate **atomsnap_gate_dir[ATOMSNAP_GATE_DIR_SIZE];
+#endif
+
+/**
+ * @brief   Reclaim a detached version whose inner counter reached zero.
+ *
+ * Slow path of atomsnap_release_version(). Not part of the public API.
+ *
+ * @param   ver:   Released version.
+ * @param   state: Inner state observed after the release.
+ */
+void atomsnap_release_slow(struct atomsnap_version *ver, uint64_t state);
+
+/**
+ * @brief   Distance between two version slots of a size class.
+ *
+ * @param   cls: Size class of the arena.
+ *
+ * @return  Slot stride in bytes.
+ */
+static inline size_t atomsnap_class_stride(unsigned int cls)
+{
+	return (cls == 0) ? ATOMSNAP_SLOT_SIZE :
+		(ATOMSNAP_SLOT_SIZE + ((size_t)8 << cls) +
+			ATOMSNAP_PAYLOAD_ALIGN - 1) &
+		~(size_t)(ATOMSNAP_PAYLOAD_ALIGN - 1);
+}
+
+/**
+ * @brief   Locate the arena table entry of an arena index.
+ *
+ * @param   arena_idx: Arena part of a handle.
+ *
+ * @return  Pointer to the entry, or NULL if its chunk does not exist.
+ */
+static inline struct atomsnap_arena **atomsnap_arena_ref(uint32_t arena_idx)
+{
+	struct atomsnap_arena **chunk;
+
+	chunk = __atomic_load_n(
+		&atomsnap_arena_dir[arena_idx >> ATOMSNAP_ARENA_CHUNK_BITS],
+		__ATOMIC_ACQUIRE);
+	if (ATOMSNAP_UNLIKELY(chunk == NULL)) {
+		return NULL;
+	}
+
+	return &chunk[arena_idx & (ATOMSNAP_ARENA_CHUNK - 1)];
+}
+
+/**
+ * @brief   Read the (class tagged) arena table entry of an arena index.
+ *
+ * @param   arena_idx: Arena part of a handle.
+ *
+ * @return  Tagged arena pointer, or 0 if the arena does not exist.
+ */
+static inline uintptr_t atomsnap_arena_entry(uint32_t arena_idx)
+{
+	struct atomsnap_arena **ref = atomsnap_arena_ref(arena_idx);
+
+	return ref ? (uintptr_t)*ref : 0;
+}
+
+/**
+ * @brief   Convert a raw handle to a version pointer.
+ *
+ * @param   handle_raw: The 32-bit handle.
+ *
+ * @return  Pointer to the atomsnap_version, or NULL if invalid.
+ */
+static inline struct atomsnap_version *atomsnap_resolve_handle(
+	uint32_t handle_raw)
+{
+	struct atomsnap_arena *arena;
+	uint32_t arena_idx, slot_idx;
+	unsigned int cls;
+	uintptr_t entry;
+
+	if (ATOMSNAP_UNLIKELY(handle_raw == ATOMSNAP_HANDLE_NULL)) {
+		return NULL;
+	}
+
+	arena_idx = handle_raw >> ATOMSNAP_HANDLE_SLOT_BITS;
+
+	/* Bounds check */
+	if (ATOMSNAP_UNLIKELY(arena_idx >= ATOMSNAP_MAX_ARENAS)) {
+		return NULL;
+	}
+
+	entry = atomsnap_arena_entry(arena_idx);
+	arena = (struct atomsnap_arena *)(entry & ~ATOMSNAP_ARENA_CLASS_MASK);
+
+	if (ATOMSNAP_UNLIKELY(arena == NULL)) {
+		return NULL;
+	}
+
+	cls = (unsigned int)(entry & ATOMSNAP_ARENA_CLASS_MASK);
+	slot_idx = handle_raw & ATOMSNAP_HANDLE_SLOT_MASK;
+
+	if (ATOMSNAP_LIKELY(cls == 0)) {
+		return &arena->slots[slot_idx];
+	}
+
+	/* Payload arena: versions are followed by their inline payload */
+	return (struct atomsnap_version *)((char *)arena +
+		offsetof(struct atomsnap_arena, slots) +
+		(size_t)slot_idx * atomsnap_class_stride(cls));
+}
+
+/**
+ * @brief   Get the gate a version belongs to.
+ *
+ * @param   ver: Target version.
+ *
+ * @return  Pointer to the gate.
+ */
+static inline struct atomsnap_gate *atomsnap_version_gate(
+	const struct atomsnap_version *ver)
+{
+#if ATOMSNAP_SLOT_SIZE == 32
+	/* The gate registered its index before it made the version */
+	struct atomsnap_gate **chunk = __atomic_load_n(
+		&atomsnap_gate_dir[ver->gate_idx >> ATOMSNAP_GATE_CHUNK_BITS],
+		__ATOMIC_ACQUIRE);
+
+	return chunk[ver->gate_idx & (ATOMSNAP_GATE_CHUNK - 1)];
+#else
+	return ver->gate;
+#endif
+}
+
+/**
+ * @brief   Get the control block of a slot.
+ *
+ * @param   gate: Target gate.
+ * @param   idx:  Control block slot index.
+ *
+ * @return  Pointer to the 64-bit control block.
+ */
+static inline ATOMSNAP_ATOMIC(uint64_t) *atomsnap_cb_slot(
+	struct atomsnap_gate *gate, int idx)
+{
+	return (idx == 0) ? &gate->control_block :
+		&gate->extra_control_blocks[(idx - 1) * gate->cb_stride];
+}
+
+#ifdef ATOMSNAP_INLINE
+
+static inline void *atomsnap_get_object_inline(
+	const struct atomsnap_version *ver)
+{
+	if (ver) {
+		return __atomic_load_n(&ver->object, __ATOMIC_ACQUIRE);
+	}
+	return NULL;
+}
+
+static inline struct atomsnap_version *atomsnap_acquire_version_slot_inline(
+	struct atomsnap_gate *gate, int slot_idx)
+{
+	uint64_t val;
+
+	if (ATOMSNAP_UNLIKELY(gate->flags & ATOMSNAP_GATE_SLOW_READ)) {
+		return (atomsnap_acquire_version_slot)(gate, slot_idx);
+	}
+
+	/* Increment Reference Count (Upper 32 bits) */
+	val = __atomic_fetch_add(atomsnap_cb_slot(gate, slot_idx),
+		ATOMSNAP_REF_COUNT_INC, __ATOMIC_ACQUIRE);
+
+	return atomsnap_resolve_handle(
+		(uint32_t)(val & ATOMSNAP_HANDLE_MASK_64));
+}
+
+static inline void atomsnap_release_version_inline(
+	struct atomsnap_version *ver)
+{
+	uint64_t now;
+
+	if (ver == NULL) {
+		return;
+	}
+
+	if (ATOMSNAP_UNLIKELY(ver->read_mode)) {
+		(atomsnap_release_version)(ver);
+		return;
+	}
+
+	now = __atomic_add_fetch(&ver->inner_state, ATOMSNAP_INNER_CNT_INC,
+		__ATOMIC_ACQ_REL);
+
+	if (ATOMSNAP_UNLIKELY((uint32_t)now & ATOMSNAP_INNER_F_DETACHED)) {
+		atomsnap_release_slow(ver, now);
+	}
+}
+
+#define atomsnap_get_object(v) \
+	atomsnap_get_object_inline((v))
+
+#define atomsnap_acquire_version_slot(g, s) \
+	atomsnap_acquire_version_slot_inline((g), (s))
+
+#define atomsnap_release_version(v) \
+	atomsnap_release_version_inline((v))
+
+#endif /* ATOMSNAP_INLINE */
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+#endif /* ATOMSNAP_INLINE_H */
@@ -19,6 +19,7 @@
 extern "C" {
 #include "atomsnap.h"
 }
+#include "atomsnap_inline.h"
 
 #include <urcu/urcu-memb.h>
 #include <urcu/uatomic.h>
@@ -32,6 +33,14 @@ struct Config {
 	int duration_sec;
 
 	int shards;
+	bool replicated;
+	bool multislot;
+	bool packed;
+	bool single_writer;
+	bool inline_obj;
+	int batch;
+	bool many;
+	bool lease;
 	bool pin;
 	int pin_base;
 
@@ -50,6 +59,14 @@ struct Config {
 		  writers(1),
 		  duration_sec(5),
 		  shards(1),
+		  replicated(false),
+		  multislot(false),
+		  packed(false),
+		  single_writer(false),
+		  inline_obj(false),
+		  batch(1),
+		  many(true),
+		  lease(false),
 		  pin(false),
 		  pin_base(0),
 		  cs_ns(0),
@@ -70,6 +87,14 @@ static void usage(const char *argv0)
 		<< "  --cs-ns=NS --payload=BYTES\n"
 		<< "  --updates-per-sec=U (0=unlimited)\n"
 		<< "  --shards=N\n"
+		<< "  --replicated=0|1 (atomsnap: one gate, shards=replicas)\n"
+		<< "  --multislot=0|1 (atomsnap: one gate, shards=slots)\n"
+		<< "  --packed=0|1 (atomsnap: pack multi-slot control blocks)\n"
+		<< "  --single-writer=0|1 (atomsnap: SPMC gates, needs --writers=1)\n"
+		<< "  --inline-obj=0|1 (atomsnap: object in the version slot)\n"
+		<< "  --batch=N (atomsnap: shards read per reader op)\n"
+		<< "  --many=0|1 (atomsnap: read a batch with acquire_many)\n"
+		<< "  --lease=0|1 (atomsnap: readers refresh a sticky lease)\n"
 		<< "  --reclaim=async|sync-batch (urcu)\n"
 		<< "  --sync-batch=N (urcu)\n"
 		<< "  --pin=0|1 --pin-base-cpu=N\n"
@@ -136,6 +161,22 @@ static bool parse_args(int argc, char **argv, Config &c)
 			c.sync_batch = (uint32_t)parse_u64(v);
 		} else if ((v = getv("--shards"))) {
 			c.shards = parse_i(v);
+		} else if ((v = getv("--replicated"))) {
+			c.replicated = (parse_i(v) != 0);
+		} else if ((v = getv("--multislot"))) {
+			c.multislot = (parse_i(v) != 0);
+		} else if ((v = getv("--packed"))) {
+			c.packed = (parse_i(v) != 0);
+		} else if ((v = getv("--single-writer"))) {
+			c.single_writer = (parse_i(v) != 0);
+		} else if ((v = getv("--inline-obj"))) {
+			c.inline_obj = (parse_i(v) != 0);
+		} else if ((v = getv("--batch"))) {
+			c.batch = parse_i(v);
+		} else if ((v = getv("--many"))) {
+			c.many = (parse_i(v) != 0);
+		} else if ((v = getv("--lease"))) {
+			c.lease = (parse_i(v) != 0);
 		} else if ((v = getv("--pin"))) {
 			c.pin = (parse_i(v) != 0);
 		} else if ((v = getv("--pin-base-cpu"))) {
@@ -159,6 +200,19 @@ static bool parse_args(int argc, char **argv, Config &c)
 	if (c.backend != "urcu" && c.backend != "atomsnap") {
 		return false;
 	}
+	if (c.replicated && c.multislot) {
+		return false;
+	}
+	if (c.single_writer && c.writers != 1) {
+		return false;
+	}
+	if (c.batch <= 0 || (c.batch > 1 && c.lease)) {
+		return false;
+	}
+	/* Inline objects (16B header + payload) must fit the largest class */
+	if (c.inline_obj && c.payload_bytes + 16 > ATOMSNAP_INLINE_PAYLOAD_MAX) {
+		return false;
+	}
 	if (c.backend == "urcu") {
 		if (c.reclaim != "async" && c.reclaim != "sync-batch") {
 			return false;
@@ -577,50 +631,106 @@ struct AtomSnapBackend : Backend {
 	TaggedFreeList *pool;
 	std::vector<atomsnap_gate *> gates;
 
+	/* Version chain of each shard: (gate, slot) */
+	std::vector<atomsnap_gate *> shard_gate;
+	std::vector<int> shard_slot;
+
 	std::atomic<uint64_t> created;
 
+	size_t block;
+
 	AtomSnapBackend()
 		: pool(nullptr),
-		  created(0)
+		  created(0),
+		  block(0)
 	{}
 
+	/*
+	 * Object is either taken from the pool and freed by atomsnap_free_cb,
+	 * or carved inline from the version slot (--inline-obj=1), in which
+	 * case no free callback runs.
+	 */
+	atomsnap_version *make_obj_version(atomsnap_gate *g, uint64_t seq)
+	{
+		atomsnap_version *ver;
+		AtomObj *o;
+
+		if (cfg.inline_obj) {
+			ver = atomsnap_make_version_inline(g, block);
+			o = (AtomObj *)atomsnap_get_object(ver);
+		} else {
+			ver = atomsnap_make_version(g);
+			o = (AtomObj *)pool->alloc();
+			atomsnap_set_object(ver, o, pool);
+		}
+
+		o->v1 = seq;
+		o->v2 = seq;
+
+		if (cfg.payload_bytes) {
+			uint8_t *pl = (uint8_t *)atom_payload_ptr(o);
+
+			pl[0] = (uint8_t)seq;
+			pl[cfg.payload_bytes - 1] = (uint8_t)(seq >> 8);
+		}
+
+		return ver;
+	}
+
 	void init(const Config &c) override
 	{
 		cfg = c;
 
-		size_t block;
 		block = sizeof(AtomObj) + cfg.payload_bytes;
 
 		pool = new TaggedFreeList(block, 64);
 
-		gates.resize((size_t)cfg.shards);
+		/*
+		 * Shards map to separate gates by default. Replicated uses a
+		 * single gate whose replicas play the shards, multislot uses
+		 * a single gate with one slot per shard.
+		 */
+		bool one_gate = cfg.replicated || cfg.multislot;
+		int ngates = one_gate ? 1 : cfg.shards;
 
-		for (int s = 0; s < cfg.shards; s++) {
+		gates.resize((size_t)ngates);
+
+		for (int s = 0; s < ngates; s++) {
 			struct atomsnap_init_context ictx;
 			std::memset(&ictx, 0, sizeof(ictx));
 
 			ictx.free_impl = atomsnap_free_func(atomsnap_free_cb);
 			ictx.num_extra_control_blocks = 0;
 
+			if (one_gate) {
+				ictx.num_extra_control_blocks = cfg.shards - 1;
+			}
+			if (cfg.replicated) {
+				ictx.flags |= ATOMSNAP_GATE_REPLICATED;
+			}
+			if (cfg.packed) {
+				ictx.flags |= ATOMSNAP_GATE_PACKED_SLOTS;
+			}
+			if (cfg.single_writer) {
+				ictx.flags |= ATOMSNAP_GATE_SINGLE_WRITER;
+			}
+
 			gates[(size_t)s] = atomsnap_init_gate(&ictx);
+		}
 
-			atomsnap_version *ver;
-			ver = atomsnap_make_version(gates[(size_t)s]);
+		int nshards = cfg.replicated ? 1 : cfg.shards;
 
-			void *obj = pool->alloc();
-			AtomObj *o = (AtomObj *)obj;
-			o->v1 = 0;
-			o->v2 = 0;
+		for (int s = 0; s < nshards; s++) {
+			shard_gate.push_back(one_gate ? gates[0] : gates[(size_t)s]);
+			shard_slot.push_back(cfg.multislot ? s : 0);
+		}
 
-			if (cfg.payload_bytes) {
-				uint8_t *p = (uint8_t *)atom_payload_ptr(o);
-				p[0] = 0;
-				p[cfg.payload_bytes - 1] = 0;
-			}
+		for (int s = 0; s < nshards; s++) {
+			atomsnap_version *ver;
+			ver = make_obj_version(shard_gate[(size_t)s], 0);
 
-			atomsnap_set_object(ver, obj, pool);
-			atomsnap_exchange_version_slot(
-				gates[(size_t)s], 0, ver);
+			atomsnap_exchange_version_slot(shard_gate[(size_t)s],
+				shard_slot[(size_t)s], ver);
 		}
 	}
 
@@ -630,11 +740,38 @@ struct AtomSnapBackend : Backend {
 			atomsnap_destroy_gate(g);
 		}
 		gates.clear();
+		shard_gate.clear();
+		shard_slot.clear();
 
 		delete pool;
 		pool = nullptr;
 	}
 
+	/* Validates and touches the object of an acquired version */
+	bool check_obj(atomsnap_version *ver)
+	{
+		AtomObj *o;
+
+		if (ver == nullptr) {
+			return false;
+		}
+
+		o = (AtomObj *)atomsnap_get_object(ver);
+		if (o == nullptr) {
+			return false;
+		}
+
+		if (o->v1 != o->v2) {
+			std::fprintf(stderr,
+				"ATOM mismatch: %" PRIu64 " != %" PRIu64 "\n",
+				o->v1, o->v2);
+			std::abort();
+		}
+
+		payload_touch(atom_payload_ptr(o), cfg.payload_bytes);
+		return true;
+	}
+
 	void reader_loop(
 		int rid,
 		std::barrier<> &br,
@@ -647,7 +784,9 @@ struct AtomSnapBackend : Backend {
 			pin_thread_to_cpu(cfg.pin_base + rid);
 		}
 
-		int shard = rid % cfg.shards;
+		int shard = rid % (int)shard_gate.size();
+		atomsnap_gate *g = shard_gate[(size_t)shard];
+		int slot = shard_slot[(size_t)shard];
 
 		uint32_t mask = 0;
 		if (cfg.sample_pow2) {
@@ -655,9 +794,57 @@ struct AtomSnapBackend : Backend {
 		}
 		uint32_t ctr = 0;
 
+		atomsnap_lease lease = {};
+
+		/* --batch: each op reads the next nb shards, wrapping around */
+		int nb = cfg.batch;
+		int nshards = (int)shard_gate.size();
+		std::vector<atomsnap_gate *> bgates((size_t)nb);
+		std::vector<int> bslots((size_t)nb);
+		std::vector<atomsnap_version *> bvers((size_t)nb);
+		int next = shard;
+
 		br.arrive_and_wait();
 
-		while (running.load(std::memory_order_relaxed)) {
+		while (running.load(std::memory_order_relaxed) && nb > 1) {
+			for (int i = 0; i < nb; i++) {
+				bgates[(size_t)i] = shard_gate[(size_t)next];
+				bslots[(size_t)i] = shard_slot[(size_t)next];
+				if (++next == nshards) {
+					next = 0;
+				}
+			}
+
+			if (cfg.many) {
+				atomsnap_acquire_many(bgates.data(),
+					bslots.data(), nb, bvers.data());
+			} else {
+				for (int i = 0; i < nb; i++) {
+					bvers[(size_t)i] =
+						atomsnap_acquire_version_slot(
+							bgates[(size_t)i],
+							bslots[(size_t)i]);
+				}
+			}
+
+			for (int i = 0; i < nb; i++) {
+				check_obj(bvers[(size_t)i]);
+			}
+
+			if (cfg.many) {
+				atomsnap_release_many(bvers.data(), nb);
+			} else {
+				for (int i = 0; i < nb; i++) {
+					atomsnap_release_version(
+						bvers[(size_t)i]);
+				}
+			}
+
+			rops.fetch_add((uint64_t)nb,
+				std::memory_order_relaxed);
+		}
+
+		while (running.load(std::memory_order_relaxed) && nb == 1) {
 			bool sample = (mask != 0) && ((ctr++ & mask) == 0);
 			uint64_t t0 = 0;
 
@@ -666,30 +853,20 @@ struct AtomSnapBackend : Backend {
 			}
 
 			atomsnap_version *ver;
-			ver = atomsnap_acquire_version_slot(
-				gates[(size_t)shard], 0);
+			if (cfg.lease) {
+				ver = atomsnap_lease_refresh(g, slot, &lease);
+			} else {
+				ver = atomsnap_acquire_version_slot(g, slot);
+			}
 
 			if (ver) {
-				void *obj = atomsnap_get_object(ver);
-				AtomObj *o = (AtomObj *)obj;
-
-				if (o) {
-					if (o->v1 != o->v2) {
-						std::fprintf(stderr,
-							"ATOM mismatch: %" PRIu64
-							" != %" PRIu64 "\n",
-							o->v1, o->v2);
-						std::abort();
-					}
-
-					volatile uint8_t *pl;
-					pl = atom_payload_ptr(o);
-
-					payload_touch(pl, cfg.payload_bytes);
+				if (check_obj(ver)) {
 					burner.burn_ns(cfg.cs_ns);
 				}
 
-				atomsnap_release_version(ver);
+				if (!cfg.lease) {
+					atomsnap_release_version(ver);
+				}
 			}
 
 			if (sample) {
@@ -698,6 +875,8 @@ struct AtomSnapBackend : Backend {
 
 			rops.fetch_add(1, std::memory_order_relaxed);
 		}
+
+		atomsnap_lease_release(&lease);
 	}
 
 	void writer_loop(
@@ -721,7 +900,7 @@ struct AtomSnapBackend : Backend {
 		uint64_t next_tick = now_ns();
 		uint64_t seq = 0;
 
-		int shard = wid % cfg.shards;
+		int shard = wid % (int)shard_gate.size();
 
 		while (running.load(std::memory_order_relaxed)) {
 			if (interval) {
@@ -733,34 +912,18 @@ struct AtomSnapBackend : Backend {
 				next_tick += interval;
 			}
 
-			atomsnap_gate *g = gates[(size_t)shard];
-
-			atomsnap_version *ver;
-			ver = atomsnap_make_version(g);
-
-			void *obj = pool->alloc();
-			AtomObj *o = (AtomObj *)obj;
+			atomsnap_gate *g = shard_gate[(size_t)shard];
+			int slot = shard_slot[(size_t)shard];
 
 			seq++;
-			o->v1 = seq;
-			o->v2 = seq;
 
-			if (cfg.payload_bytes) {
-				uint8_t *pl;
-				pl = (uint8_t *)atom_payload_ptr(o);
-
-				pl[0] = (uint8_t)seq;
-				pl[cfg.payload_bytes - 1] =
-					(uint8_t)(seq >> 8);
-			}
-
-			atomsnap_set_object(ver, obj, pool);
-			atomsnap_exchange_version_slot(g, 0, ver);
+			atomsnap_version *ver = make_obj_version(g, seq);
+			atomsnap_exchange_version_slot(g, slot, ver);
 
 			created.fetch_add(1, std::memory_order_relaxed);
 
 			shard++;
-			if (shard >= cfg.shards) {
+			if (shard >= (int)shard_gate.size()) {
 				shard = 0;
 			}
 
@@ -804,7 +967,7 @@ static void print_csv_header(void)
 		<< "backend,readers,writers,duration,cs_ns,payload,"
 		<< "updates_per_sec,shards,reclaim,sync_batch,"
 		<< "r_ops_s,w_ops_s,peak_rss_kb,pending,freed,"
-		<< "lat_samples,lat_avg_ns,lat_max_ns\n";
+		<< "lat_samples,lat_avg_ns,lat_max_ns,slot_size\n";
 }
 
 static void print_csv_line(const Config &c, const Results &r)
@@ -828,7 +991,8 @@ static void print_csv_line(const Config &c, const Results &r)
 		<< r.freed << ","
 		<< r.lat_samples << ","
 		<< std::setprecision(2) << r.lat_avg_ns << ","
-		<< r.lat_max_ns
+		<< r.lat_max_ns << ","
+		<< ATOMSNAP_SLOT_SIZE
 		<< "\n";
 }
 
@@ -842,6 +1006,9 @@ static void print_human(const Config &c, const Results &r)
 	std::cout << "Payload (B)     : " << c.payload_bytes << "\n";
 	std::cout << "Updates/sec     : " << c.updates_per_sec << "\n";
 	std::cout << "Shards          : " << c.shards << "\n";
+	if (c.backend == "atomsnap") {
+		std::cout << "Slot size (B)   : " << ATOMSNAP_SLOT_SIZE << "\n";
+	}
 	if (c.backend == "urcu") {
 		std::cout << "Reclaim         : " << c.reclaim << "\n";
 		if (c.reclaim == "sync-batch") {
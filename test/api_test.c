@@ -0,0 +1,1928 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/*
+ * Include the implementation directly so the test can check internal
+ * state (e.g., control block refcounts) behind the public API.
+ */
+#include "../atomsnap.c"
+
+#include "stress.h"
+
+static uint32_t outer_refs(struct atomsnap_gate *g, int slot)
+{
+	return (uint32_t)((atomic_load(get_cb_slot(g, slot)) &
+		REF_COUNT_MASK) >> REF_COUNT_SHIFT);
+}
+
+/*
+ * Lease:
+ * Refreshing an unchanged slot must not touch the control block. A changed
+ * slot re-acquires, and the previously pinned version is reclaimed.
+ */
+static void test_lease(void)
+{
+	struct atomsnap_gate *g;
+	struct atomsnap_version *v1, *v2, *r;
+	struct atomsnap_lease lease = { 0 };
+	int i;
+
+	fprintf(stderr, "[TEST] lease\n");
+
+	atomic_store_explicit(&g_free_calls, 0, memory_order_relaxed);
+
+	g = make_gate_flags(0, 0);
+	assert(g != NULL);
+
+	v1 = make_ver(g, 1);
+	atomsnap_exchange_version_slot(g, 0, v1);
+
+	for (i = 0; i < 100; i++) {
+		r = atomsnap_lease_refresh(g, 0, &lease);
+		assert(r == v1);
+	}
+	assert(outer_refs(g, 0) == 1);
+
+	v2 = make_ver(g, 2);
+	atomsnap_exchange_version_slot(g, 0, v2);
+	assert(atomic_load(&g_free_calls) == 0);
+
+	r = atomsnap_lease_refresh(g, 0, &lease);
+	assert(r == v2);
+	assert(*(int *)atomsnap_get_object(r) == 2);
+	assert(atomic_load(&g_free_calls) == 1);
+
+	atomsnap_lease_release(&lease);
+	assert(lease.version == NULL);
+
+	atomsnap_exchange_version_slot(g, 0, NULL);
+	assert(atomic_load(&g_free_calls) == 2);
+
+	atomsnap_destroy_gate(g);
+}
+
+/*
+ * Slot layout:
+ * Versions stay aligned to ATOMSNAP_SLOT_SIZE and resolve to their own
+ * gate, also after the gate of a neighbouring version has been destroyed.
+ */
+static void test_slot_layout(void)
+{
+	struct atomsnap_gate *g1, *g2;
+	struct atomsnap_version *v1, *v2;
+	uintptr_t off;
+#if ATOMSNAP_SLOT_SIZE == 32
+	uint32_t idx;
+#endif
+
+	fprintf(stderr, "[TEST] slot layout (%d bytes)\n", ATOMSNAP_SLOT_SIZE);
+
+	atomic_store_explicit(&g_free_calls, 0, memory_order_relaxed);
+
+	g1 = make_gate_flags(0, 0);
+	g2 = make_gate_flags(0, 0);
+	assert(g1 != NULL && g2 != NULL);
+
+	v1 = make_ver(g1, 1);
+	v2 = make_ver(g2, 2);
+	assert(version_gate(v1) == g1);
+	assert(version_gate(v2) == g2);
+	assert(resolve_handle(v1->self_handle) == v1);
+	/* The reserved last arena index has no table chunk behind it */
+	assert(atomsnap_arena_entry(MAX_ARENAS - 1) == 0);
+	assert(resolve_handle(ATOMSNAP_HANDLE_BUSY) == NULL);
+
+	if (ATOMSNAP_SLOT_SIZE != 40) {
+		off = (uintptr_t)v1 - atomsnap_arena_entry(
+			v1->self_handle >> HANDLE_SLOT_BITS);
+		assert(off % ATOMSNAP_SLOT_SIZE == 0);
+		assert((uintptr_t)v1 % ATOMSNAP_SLOT_SIZE == 0);
+	}
+
+	atomsnap_exchange_version_slot(g1, 0, v1);
+	atomsnap_exchange_version_slot(g2, 0, v2);
+
+	atomsnap_exchange_version_slot(g1, 0, NULL);
+#if ATOMSNAP_SLOT_SIZE == 32
+	idx = g1->gate_idx;
+#endif
+	atomsnap_destroy_gate(g1);
+
+	/* A new gate may reuse g1's table entry; v2 must still see g2 */
+	g1 = make_gate_flags(0, 0);
+	assert(g1 != NULL);
+	assert(version_gate(v2) == g2);
+#if ATOMSNAP_SLOT_SIZE == 32
+	/* Released indices are handed out again before fresh ones */
+	assert(g1->gate_idx == idx);
+	assert(g_gate_fresh >= 2 && g_gate_fresh <= ATOMSNAP_GATE_CHUNK);
+#endif
+
+	atomsnap_exchange_version_slot(g2, 0, NULL);
+	assert(atomic_load(&g_free_calls) == 2);
+
+	atomsnap_destroy_gate(g1);
+	atomsnap_destroy_gate(g2);
+}
+
+/*
+ * Control block layout:
+ * The gate starts a line of its own in every layout mode. Extra control
+ * blocks sit one line apart, 64 or 128 bytes with WIDE_LINES, unless
+ * PACKED_SLOTS packs them into consecutive words (ignored by replicated
+ * gates); either way the first one starts a line. Publish counters and
+ * publish_if_newer claim words are a line apart in every mode.
+ */
+static void test_cb_layout(void)
+{
+	static const uint32_t modes[] = {
+		0,
+		ATOMSNAP_GATE_PACKED_SLOTS,
+		ATOMSNAP_GATE_WIDE_LINES,
+		ATOMSNAP_GATE_PACKED_SLOTS | ATOMSNAP_GATE_WIDE_LINES,
+		ATOMSNAP_GATE_REPLICATED | ATOMSNAP_GATE_PACKED_SLOTS,
+		ATOMSNAP_GATE_REPLICATED | ATOMSNAP_GATE_WIDE_LINES,
+	};
+	struct atomsnap_gate *g;
+	uintptr_t line, stride, addr;
+	size_t m;
+	int i;
+
+	fprintf(stderr, "[TEST] control block layout\n");
+
+	for (m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+		g = make_gate_flags(modes[m], 5);
+		assert(g != NULL);
+
+		line = (modes[m] & ATOMSNAP_GATE_WIDE_LINES) ?
+			WIDE_LINE_SIZE : CACHE_LINE_SIZE;
+		stride = ((modes[m] & ATOMSNAP_GATE_PACKED_SLOTS) &&
+			!(modes[m] & ATOMSNAP_GATE_REPLICATED)) ?
+			sizeof(uint64_t) : line;
+
+		assert((uintptr_t)g % line == 0);
+		assert((uintptr_t)get_cb_slot(g, 0) == (uintptr_t)g);
+		assert((uintptr_t)&g->sequences % CACHE_LINE_SIZE == 0);
+		assert((uintptr_t)g->generations % line == 0);
+		assert((uintptr_t)g->cb_stride * sizeof(uint64_t) == stride);
+
+		for (i = 1; i <= g->num_extra_slots; i++) {
+			addr = (uintptr_t)get_cb_slot(g, i);
+			assert(addr % stride == 0);
+			assert(addr - (uintptr_t)get_cb_slot(g, 1) ==
+				(uintptr_t)(i - 1) * stride);
+			/* No extra control block shares the gate's line */
+			assert(addr / line != (uintptr_t)g / line);
+			/* Nor does a publish counter or claim word */
+			assert((uintptr_t)slot_generation(g, i) / line !=
+				(uintptr_t)slot_generation(g, i - 1) / line);
+			assert((uintptr_t)slot_sequence(g, i) / line !=
+				(uintptr_t)slot_sequence(g, i - 1) / line);
+		}
+		assert((uintptr_t)get_cb_slot(g, 1) % line == 0);
+
+		atomsnap_destroy_gate(g);
+	}
+}
+
+/*
+ * Inline payload:
+ * Payload versions resolve through their handles across arena boundaries,
+ * their object is the aligned payload behind the metadata, and reclaiming
+ * them never calls free_impl.
+ */
+static void test_inline_payload(void)
+{
+	static const size_t sizes[] = { 1, 16, 17, 64, 200, 256 };
+	struct atomsnap_gate *g;
+	struct atomsnap_version *ver, *r;
+	uint64_t *p;
+	size_t k;
+	int i;
+
+	fprintf(stderr, "[TEST] inline payload\n");
+
+	atomic_store_explicit(&g_free_calls, 0, memory_order_relaxed);
+
+	g = make_gate_flags(0, 0);
+	assert(g != NULL);
+
+	assert(atomsnap_make_version_inline(g, 0) == NULL);
+	assert(atomsnap_make_version_inline(g, 257) == NULL);
+
+	for (k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++) {
+		/* More than one arena of the largest class */
+		for (i = 0; i < 1000; i++) {
+			ver = atomsnap_make_version_inline(g, sizes[k]);
+			assert(ver != NULL);
+			assert(resolve_handle(ver->self_handle) == ver);
+
+			p = atomsnap_get_object(ver);
+			assert((char *)p == (char *)ver + ATOMSNAP_SLOT_SIZE);
+			assert((uintptr_t)p % _Alignof(max_align_t) == 0);
+			p[0] = (uint64_t)i;
+			atomsnap_exchange_version_slot(g, 0, ver);
+
+			r = atomsnap_acquire_version_slot(g, 0);
+			assert(r == ver);
+			assert(*(uint64_t *)atomsnap_get_object(r) ==
+				(uint64_t)i);
+			atomsnap_release_version(r);
+		}
+	}
+
+	/* Unpublished payload versions go back without free_impl too */
+	atomsnap_free_version(atomsnap_make_version_inline(g, 32));
+
+	/* A heap object set on a payload version still goes to free_impl */
+	ver = atomsnap_make_version_inline(g, 32);
+	atomsnap_set_object(ver, malloc(8), NULL);
+	atomsnap_exchange_version_slot(g, 0, ver);
+
+	atomsnap_exchange_version_slot(g, 0, NULL);
+	assert(atomic_load(&g_free_calls) == 1);
+
+	atomsnap_destroy_gate(g);
+}
+
+/*
+ * Batched acquire/release:
+ * acquire_many() takes one reference per entry, duplicates included, across
+ * several pipeline rounds and mixed gate modes. release_many() gives them
+ * all back, and detached versions are reclaimed exactly once.
+ */
+static void test_acquire_many(void)
+{
+	struct atomsnap_gate *g[3], *multi, *hz;
+	struct atomsnap_gate *gates[70];
+	struct atomsnap_version *out[70];
+	int slots[70];
+	int i;
+
+	fprintf(stderr, "[TEST] acquire_many / release_many\n");
+
+	atomic_store_explicit(&g_free_calls, 0, memory_order_relaxed);
+
+	multi = make_gate_flags(0, 3);
+	hz = make_gate_flags(ATOMSNAP_GATE_HAZARD, 0);
+	assert(multi != NULL && hz != NULL);
+
+	for (i = 0; i < 3; i++) {
+		g[i] = make_gate_flags(0, 0);
+		assert(g[i] != NULL);
+		atomsnap_exchange_version_slot(g[i], 0, make_ver(g[i], i));
+	}
+	for (i = 0; i < 3; i++) {
+		atomsnap_exchange_version_slot(multi, i, make_ver(multi, 10 + i));
+	}
+	atomsnap_exchange_version_slot(hz, 0, make_ver(hz, 20));
+
+	/* Slot 3 of the multi-slot gate stays empty */
+	for (i = 0; i < 70; i++) {
+		if (i % 10 == 9) {
+			gates[i] = hz;
+			slots[i] = 0;
+		} else if (i % 2 == 0) {
+			gates[i] = g[i % 3];
+			slots[i] = 0;
+		} else {
+			gates[i] = multi;
+			slots[i] = (i / 2) % 4;
+		}
+	}
+
+	atomsnap_acquire_many(gates, slots, 70, out);
+
+	for (i = 0; i < 70; i++) {
+		if (gates[i] == multi && slots[i] == 3) {
+			assert(out[i] == NULL);
+			continue;
+		}
+		assert(out[i] != NULL);
+		assert(version_gate(out[i]) == gates[i]);
+	}
+	assert(outer_refs(g[0], 0) == 12);
+	assert(outer_refs(multi, 1) == 7);
+
+	/* Detach everything while the references are held */
+	for (i = 0; i < 3; i++) {
+		atomsnap_exchange_version_slot(g[i], 0, NULL);
+		atomsnap_exchange_version_slot(multi, i, NULL);
+	}
+	assert(atomic_load(&g_free_calls) == 0);
+
+	/* Hazard slots are limited; release them before the rest */
+	for (i = 9; i < 70; i += 10) {
+		atomsnap_release_version(out[i]);
+		out[i] = NULL;
+	}
+
+	atomsnap_release_many(out, 70);
+	assert(atomic_load(&g_free_calls) == 6);
+
+	atomsnap_exchange_version_slot(hz, 0, NULL);
+	atomsnap_destroy_gate(hz);
+	assert(atomic_load(&g_free_calls) == 7);
+
+	for (i = 0; i < 3; i++) {
+		atomsnap_destroy_gate(g[i]);
+	}
+	atomsnap_destroy_gate(multi);
+}
+
+/*
+ * Change detection:
+ * Peeking leaves the control block alone, and every exchange or successful
+ * CAS (but not a failed one) changes the token of its slot only.
+ */
+static void test_peek_generation(void)
+{
+	struct atomsnap_gate *g;
+	struct atomsnap_version *v1, *v2;
+	uint64_t t0, t1, cb;
+
+	fprintf(stderr, "[TEST] peek generation\n");
+
+	g = make_gate_flags(0, 1);
+	assert(g != NULL);
+
+	t0 = atomsnap_peek_generation(g, 0);
+	t1 = atomsnap_peek_generation(g, 1);
+
+	v1 = make_ver(g, 1);
+	atomsnap_exchange_version_slot(g, 0, v1);
+	assert(atomsnap_changed_since(g, 0, t0));
+	assert(!atomsnap_changed_since(g, 1, t1));
+
+	cb = atomic_load(get_cb_slot(g, 0));
+	t0 = atomsnap_peek_generation(g, 0);
+	assert(!atomsnap_changed_since(g, 0, t0));
+	assert(atomic_load(get_cb_slot(g, 0)) == cb);
+
+	/* A failed CAS publishes nothing */
+	v2 = make_ver(g, 2);
+	assert(!atomsnap_compare_exchange_version_slot(g, 0, NULL, v2));
+	assert(!atomsnap_changed_since(g, 0, t0));
+
+	assert(atomsnap_compare_exchange_version_slot(g, 0, v1, v2));
+	assert(atomsnap_changed_since(g, 0, t0));
+
+	atomsnap_exchange_version_slot(g, 0, NULL);
+	atomsnap_destroy_gate(g);
+}
+
+struct seq_args {
+	struct atomsnap_gate *gate;
+	_Atomic(bool) stop;
+	int id;
+	int rounds;
+};
+
+static void *seq_writer(void *arg)
+{
+	struct seq_args *a = arg;
+	struct atomsnap_version *v;
+	int i;
+
+	for (i = 0; i < a->rounds; i++) {
+		v = make_ver(a->gate, i * 4 + a->id + 1);
+		if (!atomsnap_publish_if_newer(a->gate, 0, v,
+				(uint64_t)(i * 4 + a->id + 1))) {
+			atomsnap_free_version(v);
+		}
+	}
+
+	return NULL;
+}
+
+static void *seq_reader(void *arg)
+{
+	struct seq_args *a = arg;
+	struct atomsnap_version *v;
+	int last = 0, cur;
+
+	while (!atomic_load_explicit(&a->stop, memory_order_relaxed)) {
+		v = atomsnap_acquire_version_slot(a->gate, 0);
+		if (v != NULL) {
+			cur = *(int *)atomsnap_get_object(v);
+			assert(cur >= last);
+			last = cur;
+			atomsnap_release_version(v);
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Sequence-conditional publish:
+ * Older or equal sequences are refused without touching the slot, and
+ * racing publishers never move the slot backwards.
+ */
+static void test_publish_if_newer(void)
+{
+	struct seq_args a[4], r;
+	struct atomsnap_gate *g;
+	struct atomsnap_version *v;
+	pthread_t wr[4], rd;
+	uint64_t token;
+	int i, rounds = 50000;
+
+	fprintf(stderr, "[TEST] publish if newer\n");
+
+	g = make_gate_flags(0, 0);
+	assert(g != NULL);
+
+	v = make_ver(g, 5);
+	assert(atomsnap_publish_if_newer(g, 0, v, 5));
+
+	token = atomsnap_peek_generation(g, 0);
+	v = make_ver(g, 3);
+	assert(!atomsnap_publish_if_newer(g, 0, v, 3));
+	assert(!atomsnap_publish_if_newer(g, 0, v, 5));
+	assert(!atomsnap_changed_since(g, 0, token));
+	atomsnap_free_version(v);
+
+	v = make_ver(g, 6);
+	assert(atomsnap_publish_if_newer(g, 0, v, 6));
+	assert(atomsnap_changed_since(g, 0, token));
+	atomsnap_exchange_version_slot(g, 0, NULL);
+	atomsnap_destroy_gate(g);
+
+	g = make_gate_flags(0, 0);
+	memset(&r, 0, sizeof(r));
+	r.gate = g;
+	assert(pthread_create(&rd, NULL, seq_reader, &r) == 0);
+
+	for (i = 0; i < 4; i++) {
+		memset(&a[i], 0, sizeof(a[i]));
+		a[i].gate = g;
+		a[i].id = i;
+		a[i].rounds = rounds;
+		assert(pthread_create(&wr[i], NULL, seq_writer, &a[i]) == 0);
+	}
+
+	for (i = 0; i < 4; i++) {
+		assert(pthread_join(wr[i], NULL) == 0);
+	}
+
+	atomic_store(&r.stop, true);
+	assert(pthread_join(rd, NULL) == 0);
+
+	/* Whoever claimed the last sequence published it */
+	v = atomsnap_acquire_version_slot(g, 0);
+	assert(*(int *)atomsnap_get_object(v) == rounds * 4);
+	atomsnap_release_version(v);
+
+	atomsnap_exchange_version_slot(g, 0, NULL);
+	atomsnap_destroy_gate(g);
+}
+
+struct update_args {
+	struct atomsnap_gate *gate;
+	void *storage[4];
+	int calls;
+	bool race;
+};
+
+static bool update_inc(const void *old_obj, void *new_obj, void *ctx)
+{
+	struct update_args *a = ctx;
+	struct atomsnap_version *ver;
+	int64_t *p;
+
+	a->storage[a->calls++ & 3] = new_obj;
+
+	/* Make the first publish attempt lose against a plain writer */
+	if (a->race) {
+		a->race = false;
+		ver = atomsnap_make_version_inline(a->gate, sizeof(int64_t));
+		p = atomsnap_get_object(ver);
+		*p = 100;
+		atomsnap_exchange_version_slot(a->gate, 0, ver);
+	}
+
+	*(int64_t *)new_obj = old_obj ? *(const int64_t *)old_obj + 1 : 1;
+	return true;
+}
+
+static bool update_decline(const void *old_obj, void *new_obj, void *ctx)
+{
+	(void)old_obj;
+	(void)new_obj;
+	(void)ctx;
+	return false;
+}
+
+/*
+ * Read-modify-publish:
+ * A lost CAS re-runs the update on the same version, a declined update
+ * publishes nothing, and gates without object_size are refused.
+ */
+static void test_update_slot(void)
+{
+	struct atomsnap_init_context ictx;
+	struct update_args a;
+	struct atomsnap_gate *g;
+	struct atomsnap_version *v;
+	uint64_t token;
+
+	fprintf(stderr, "[TEST] update slot\n");
+
+	memset(&a, 0, sizeof(a));
+
+	g = make_gate_flags(0, 0);
+	assert(atomsnap_update_slot(g, 0, update_inc, &a) == -1);
+	assert(a.calls == 0);
+	atomsnap_destroy_gate(g);
+
+	init_ctx(&ictx, 0, 0, ATOMSNAP_INLINE_PAYLOAD_MAX + 1);
+	assert(atomsnap_init_gate(&ictx) == NULL);
+
+	ictx.object_size = sizeof(int64_t);
+	g = atomsnap_init_gate(&ictx);
+	assert(g != NULL);
+	a.gate = g;
+
+	/* Empty slot */
+	assert(atomsnap_update_slot(g, 0, update_inc, &a) == 1);
+	assert(a.calls == 1);
+
+	a.calls = 0;
+	a.race = true;
+	assert(atomsnap_update_slot(g, 0, update_inc, &a) == 1);
+	assert(a.calls == 2);
+	assert(a.storage[0] == a.storage[1]);
+
+	v = atomsnap_acquire_version_slot(g, 0);
+	assert(*(int64_t *)atomsnap_get_object(v) == 101);
+	assert(atomsnap_get_object(v) == a.storage[1]);
+	atomsnap_release_version(v);
+
+	token = atomsnap_peek_generation(g, 0);
+	assert(atomsnap_update_slot(g, 0, update_decline, NULL) == 0);
+	assert(!atomsnap_changed_since(g, 0, token));
+
+	atomsnap_exchange_version_slot(g, 0, NULL);
+	atomsnap_destroy_gate(g);
+}
+
+struct combine_obj {
+	int64_t counter;
+	int64_t shadow;
+};
+
+struct combine_args {
+	struct atomsnap_gate *gate;
+	_Atomic(uint8_t) *seen;
+	int ops;
+};
+
+static int64_t combine_inc(void *object, void *arg)
+{
+	struct combine_obj *o = object;
+
+	(void)arg;
+	o->shadow++;
+	return o->counter++;
+}
+
+static void *combine_writer(void *arg)
+{
+	struct combine_args *a = arg;
+	int64_t prev;
+	int i;
+
+	for (i = 0; i < a->ops; i++) {
+		assert(atomsnap_combine(a->gate, 0, combine_inc, NULL,
+			&prev) == 0);
+		assert(atomic_fetch_add(&a->seen[prev], 1) == 0);
+	}
+
+	return NULL;
+}
+
+/*
+ * Combining:
+ * Concurrent updates behave like a fetch-and-add on the object, every
+ * published version is consistent, and non-combining gates are refused.
+ */
+static void test_combine(void)
+{
+	struct atomsnap_init_context ictx;
+	struct combine_args a;
+	struct atomsnap_gate *g;
+	struct atomsnap_version *v;
+	struct combine_obj *o;
+	pthread_t wr[4];
+	int64_t prev;
+	int i, ops = 20000;
+
+	fprintf(stderr, "[TEST] combine\n");
+
+	atomic_store_explicit(&g_free_calls, 0, memory_order_relaxed);
+
+	g = make_gate_flags(0, 0);
+	assert(atomsnap_combine(g, 0, combine_inc, NULL, &prev) == -1);
+	atomsnap_destroy_gate(g);
+
+	init_ctx(&ictx, ATOMSNAP_GATE_COMBINING, 0, 0);
+	assert(atomsnap_init_gate(&ictx) == NULL);
+
+	ictx.object_size = sizeof(struct combine_obj);
+	g = atomsnap_init_gate(&ictx);
+	assert(g != NULL);
+
+	/* An empty slot starts from a zeroed object */
+	assert(atomsnap_combine(g, 0, combine_inc, NULL, &prev) == 0);
+	assert(prev == 0);
+
+	a.gate = g;
+	a.ops = ops;
+	a.seen = calloc((size_t)ops * 4 + 1, sizeof(*a.seen));
+	assert(a.seen != NULL);
+	a.seen[0] = 1;
+
+	for (i = 0; i < 4; i++) {
+		assert(pthread_create(&wr[i], NULL, combine_writer, &a) == 0);
+	}
+
+	for (i = 0; i < 4; i++) {
+		assert(pthread_join(wr[i], NULL) == 0);
+	}
+
+	v = atomsnap_acquire_version_slot(g, 0);
+	o = atomsnap_get_object(v);
+	assert(o->counter == (int64_t)ops * 4 + 1);
+	assert(o->shadow == o->counter);
+	atomsnap_release_version(v);
+
+	for (i = 0; i <= ops * 4; i++) {
+		assert(a.seen[i] == 1);
+	}
+	free(a.seen);
+
+	atomsnap_exchange_version_slot(g, 0, NULL);
+	atomsnap_destroy_gate(g);
+
+	/* Inline payloads never reach free_impl */
+	assert(atomic_load(&g_free_calls) == 0);
+}
+
+static void *sw_reader(void *arg)
+{
+	struct seq_args *a = arg;
+	struct atomsnap_version *v;
+	int last = 0, cur;
+
+	while (!atomic_load_explicit(&a->stop, memory_order_relaxed)) {
+		v = atomsnap_acquire_version_slot(a->gate, a->id);
+		if (v != NULL) {
+			cur = *(int *)atomsnap_get_object(v);
+			assert(cur >= last);
+			last = cur;
+			atomsnap_release_version(v);
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Single-writer gates:
+ * Replaced versions are reclaimed exactly once, only after their last
+ * reader is gone, for plain and replicated gates alike.
+ */
+static void test_single_writer(void)
+{
+	struct atomsnap_init_context ictx;
+	struct seq_args r[2];
+	struct atomsnap_gate *g;
+	struct atomsnap_version *v1, *r1;
+	pthread_t rd[2];
+	uint32_t modes[2] = { 0, ATOMSNAP_GATE_REPLICATED };
+	int m, i, n = 100000;
+
+	fprintf(stderr, "[TEST] single writer\n");
+
+	init_ctx(&ictx, ATOMSNAP_GATE_SINGLE_WRITER | ATOMSNAP_GATE_COMBINING, 0,
+		16);
+	assert(atomsnap_init_gate(&ictx) == NULL);
+
+	for (m = 0; m < 2; m++) {
+		atomic_store_explicit(&g_free_calls, 0, memory_order_relaxed);
+
+		g = make_gate_flags(ATOMSNAP_GATE_SINGLE_WRITER | modes[m], 1);
+		assert(g != NULL);
+
+		v1 = make_ver(g, 1);
+		atomsnap_exchange_version_slot(g, 0, v1);
+		r1 = atomsnap_acquire_version_slot(g, 0);
+		assert(r1 == v1);
+
+		atomsnap_exchange_version_slot(g, 0, make_ver(g, 2));
+		assert(atomic_load(&g_free_calls) == 0);
+		atomsnap_release_version(r1);
+		assert(atomic_load(&g_free_calls) == 1);
+
+		/* CAS keeps the writer's view in sync */
+		r1 = atomsnap_acquire_version_slot(g, 0);
+		assert(atomsnap_compare_exchange_version_slot(g, 0, r1,
+			make_ver(g, 3)));
+		atomsnap_release_version(r1);
+		assert(atomic_load(&g_free_calls) == 2);
+
+		/* So does a sequenced publish */
+		assert(atomsnap_publish_if_newer(g, 0, make_ver(g, 4), 1));
+		assert(atomic_load(&g_free_calls) == 3);
+		r1 = atomsnap_acquire_version_slot(g, 0);
+		assert(g->sw_current[0] == r1);
+		assert(*(int *)atomsnap_get_object(r1) == 4);
+		atomsnap_release_version(r1);
+
+		for (i = 0; i < 2; i++) {
+			memset(&r[i], 0, sizeof(r[i]));
+			r[i].gate = g;
+			r[i].id = i;
+			assert(pthread_create(&rd[i], NULL, sw_reader,
+				&r[i]) == 0);
+		}
+
+		for (i = 0; i < n; i++) {
+			atomsnap_exchange_version_slot(g, 0, make_ver(g, i + 5));
+		}
+
+		for (i = 0; i < 2; i++) {
+			atomic_store(&r[i].stop, true);
+			assert(pthread_join(rd[i], NULL) == 0);
+		}
+
+		atomsnap_exchange_version_slot(g, 0, NULL);
+		assert(atomic_load(&g_free_calls) == (uint64_t)n + 4);
+		atomsnap_destroy_gate(g);
+	}
+}
+
+static void pair_inc(void *object, void *ctx)
+{
+	struct combine_obj *o = object;
+
+	(void)ctx;
+	o->counter++;
+	o->shadow++;
+}
+
+static void *pair_reader(void *arg)
+{
+	struct seq_args *a = arg;
+	struct atomsnap_version *v;
+	struct combine_obj *o;
+	int64_t last = 0;
+
+	while (!atomic_load_explicit(&a->stop, memory_order_relaxed)) {
+		v = atomsnap_acquire_version_slot(a->gate, 0);
+		o = atomsnap_get_object(v);
+		assert(o->counter == o->shadow);
+		assert(o->counter >= last);
+		last = o->counter;
+		atomsnap_release_version(v);
+	}
+
+	return NULL;
+}
+
+/*
+ * In-place mutation:
+ * An unreferenced version is modified where it is, a referenced one is
+ * copied, and concurrent readers never see a half-updated object.
+ */
+static void test_mutate_slot(void)
+{
+	struct atomsnap_init_context ictx;
+	struct seq_args r[2];
+	struct atomsnap_gate *g;
+	struct atomsnap_version *v, *held;
+	struct combine_obj *o;
+	pthread_t rd[2];
+	uint64_t token;
+	int i, n = 100000, in_place = 0;
+
+	fprintf(stderr, "[TEST] mutate slot\n");
+
+	init_ctx(&ictx, ATOMSNAP_GATE_IN_PLACE | ATOMSNAP_GATE_HAZARD, 0,
+		sizeof(struct combine_obj));
+	assert(atomsnap_init_gate(&ictx) == NULL);
+
+	/* Without the flag every mutation is a copy */
+	ictx.flags = 0;
+	g = atomsnap_init_gate(&ictx);
+	assert(atomsnap_mutate_slot(g, 0, pair_inc, NULL) == 0);
+	assert(atomsnap_mutate_slot(g, 0, pair_inc, NULL) == 0);
+	atomsnap_exchange_version_slot(g, 0, NULL);
+	atomsnap_destroy_gate(g);
+
+	ictx.flags = ATOMSNAP_GATE_IN_PLACE;
+	g = atomsnap_init_gate(&ictx);
+	assert(g != NULL);
+
+	/* Empty slot: copy of a zeroed object */
+	assert(atomsnap_mutate_slot(g, 0, pair_inc, NULL) == 0);
+
+	v = atomsnap_acquire_version_slot(g, 0);
+	atomsnap_release_version(v);
+
+	token = atomsnap_peek_generation(g, 0);
+	assert(atomsnap_mutate_slot(g, 0, pair_inc, NULL) == 1);
+	assert(atomsnap_changed_since(g, 0, token));
+
+	held = atomsnap_acquire_version_slot(g, 0);
+	assert(held == v);
+	o = atomsnap_get_object(held);
+	assert(o->counter == 2);
+
+	/* A held version is never touched */
+	assert(atomsnap_mutate_slot(g, 0, pair_inc, NULL) == 0);
+	assert(o->counter == 2);
+	atomsnap_release_version(held);
+
+	v = atomsnap_acquire_version_slot(g, 0);
+	assert(v != held);
+	assert(((struct combine_obj *)atomsnap_get_object(v))->counter == 3);
+	atomsnap_release_version(v);
+
+	for (i = 0; i < 2; i++) {
+		memset(&r[i], 0, sizeof(r[i]));
+		r[i].gate = g;
+		assert(pthread_create(&rd[i], NULL, pair_reader, &r[i]) == 0);
+	}
+
+	for (i = 0; i < n; i++) {
+		if (atomsnap_mutate_slot(g, 0, pair_inc, NULL) == 1) {
+			in_place++;
+		}
+	}
+
+	for (i = 0; i < 2; i++) {
+		atomic_store(&r[i].stop, true);
+		assert(pthread_join(rd[i], NULL) == 0);
+	}
+
+	v = atomsnap_acquire_version_slot(g, 0);
+	o = atomsnap_get_object(v);
+	assert(o->counter == n + 3 && o->shadow == n + 3);
+	atomsnap_release_version(v);
+
+	fprintf(stderr, "in_place=%d of %d\n", in_place, n);
+
+	atomsnap_exchange_version_slot(g, 0, NULL);
+	atomsnap_destroy_gate(g);
+}
+
+struct mutate_race {
+	struct atomsnap_gate *gate;
+	_Atomic(bool) stop;
+	int copies;
+};
+
+static void *pair_mutator(void *arg)
+{
+	struct mutate_race *a = arg;
+
+	while (!atomic_load_explicit(&a->stop, memory_order_relaxed)) {
+		if (atomsnap_mutate_slot(a->gate, 0, pair_inc, NULL) == 0) {
+			a->copies++;
+		}
+	}
+
+	return NULL;
+}
+
+static struct atomsnap_version *make_pair(struct atomsnap_gate *g)
+{
+	struct atomsnap_version *v;
+
+	v = atomsnap_make_version_inline(g, sizeof(struct combine_obj));
+	assert(v != NULL);
+	memset(atomsnap_get_object(v), 0, sizeof(struct combine_obj));
+
+	return v;
+}
+
+/*
+ * CAS vs in-place mutation:
+ * A mutation in place leaves the slot at the same version, so a CAS that
+ * finds the control block parked waits for it instead of failing. Only a
+ * copy published by the mutator can make the CAS writer miss.
+ */
+static void test_cas_vs_mutate(void)
+{
+	struct atomsnap_version *cur, *nv;
+	struct mutate_race a;
+	struct combine_obj *o;
+	pthread_t th;
+	int i, n = 100000, failures = 0;
+
+	fprintf(stderr, "[TEST] cas vs mutate\n");
+
+	memset(&a, 0, sizeof(a));
+	a.gate = make_gate_sized(ATOMSNAP_GATE_IN_PLACE, 0,
+		sizeof(struct combine_obj));
+	assert(a.gate != NULL);
+
+	cur = make_pair(a.gate);
+	atomsnap_exchange_version_slot(a.gate, 0, cur);
+
+	assert(pthread_create(&th, NULL, pair_mutator, &a) == 0);
+
+	/* No reader holds anything, so the mutator rarely has to copy */
+	nv = make_pair(a.gate);
+	for (i = 0; i < n; i++) {
+		if (atomsnap_compare_exchange_version_slot(a.gate, 0, cur, nv)) {
+			cur = nv;
+			nv = make_pair(a.gate);
+			continue;
+		}
+
+		failures++;
+		cur = atomsnap_acquire_version_slot(a.gate, 0);
+		atomsnap_release_version(cur);
+	}
+
+	atomic_store(&a.stop, true);
+	assert(pthread_join(th, NULL) == 0);
+
+	fprintf(stderr, "failures=%d copies=%d of %d\n", failures, a.copies, n);
+	assert(failures <= a.copies);
+
+	cur = atomsnap_acquire_version_slot(a.gate, 0);
+	o = atomsnap_get_object(cur);
+	assert(o->counter == o->shadow);
+	atomsnap_release_version(cur);
+
+	atomsnap_free_version(nv);
+	atomsnap_exchange_version_slot(a.gate, 0, NULL);
+	atomsnap_destroy_gate(a.gate);
+}
+
+static bool shard_inc(const void *old_obj, void *new_obj, void *ctx)
+{
+	(void)ctx;
+	*(int64_t *)new_obj = old_obj ? *(const int64_t *)old_obj + 1 : 1;
+	return true;
+}
+
+static void shard_sum(void *merged, const void *const *shards,
+	int num_shards, void *ctx)
+{
+	int64_t *sum = merged;
+	int i;
+
+	(void)ctx;
+	for (i = 0; i < num_shards; i++) {
+		if (shards[i] != NULL) {
+			*sum += *(const int64_t *)shards[i];
+		}
+	}
+}
+
+static void *shard_writer(void *arg)
+{
+	struct seq_args *a = arg;
+	int i, slot = atomsnap_shard_slot(a->gate);
+
+	assert(slot >= 0 && slot < 4);
+	for (i = 0; i < a->rounds; i++) {
+		assert(atomsnap_update_slot(a->gate, slot, shard_inc,
+			NULL) == 1);
+	}
+
+	return NULL;
+}
+
+static void *merged_reader(void *arg)
+{
+	struct seq_args *a = arg;
+	struct atomsnap_version *v;
+	int64_t last = 0, cur;
+
+	while (!atomic_load_explicit(&a->stop, memory_order_relaxed)) {
+		v = atomsnap_acquire_merged(a->gate, shard_sum, NULL);
+		assert(v != NULL);
+		cur = *(int64_t *)atomsnap_get_object(v);
+		assert(cur >= last);
+		last = cur;
+		atomsnap_release_version(v);
+	}
+
+	return NULL;
+}
+
+/*
+ * Write-sharded gates:
+ * The merged view is cached while no shard changes, rebuilt when one does,
+ * and adds up every shard update made by concurrent writers. Shard
+ * counters never share a line.
+ */
+static void test_write_sharded(void)
+{
+	struct atomsnap_init_context ictx;
+	struct seq_args w[4], r;
+	struct atomsnap_gate *g;
+	struct atomsnap_version *m1, *m2;
+	pthread_t wr[4], rd;
+	int i, rounds = 20000;
+
+	fprintf(stderr, "[TEST] write sharded\n");
+
+	init_ctx(&ictx, ATOMSNAP_GATE_WRITE_SHARDED, 0, sizeof(int64_t));
+	assert(atomsnap_init_gate(&ictx) == NULL);
+
+	/* Readers publish the merge */
+	ictx.num_extra_control_blocks = 4;
+	ictx.flags |= ATOMSNAP_GATE_SINGLE_WRITER;
+	assert(atomsnap_init_gate(&ictx) == NULL);
+	ictx.flags = ATOMSNAP_GATE_WRITE_SHARDED;
+
+	g = atomsnap_init_gate(&ictx);
+	assert(g != NULL);
+
+	/* Shard writers never bump a counter on another shard's line */
+	for (i = 1; i <= g->num_extra_slots; i++) {
+		assert((uintptr_t)slot_generation(g, i) / CACHE_LINE_SIZE !=
+			(uintptr_t)slot_generation(g, i - 1) / CACHE_LINE_SIZE);
+	}
+
+	m1 = atomsnap_acquire_merged(g, shard_sum, NULL);
+	assert(*(int64_t *)atomsnap_get_object(m1) == 0);
+	m2 = atomsnap_acquire_merged(g, shard_sum, NULL);
+	assert(m1 == m2);
+	atomsnap_release_version(m2);
+
+	assert(atomsnap_update_slot(g, 2, shard_inc, NULL) == 1);
+	m2 = atomsnap_acquire_merged(g, shard_sum, NULL);
+	assert(m1 != m2);
+	assert(*(int64_t *)atomsnap_get_object(m1) == 0);
+	assert(*(int64_t *)atomsnap_get_object(m2) == 1);
+	atomsnap_release_version(m1);
+	atomsnap_release_version(m2);
+
+	memset(&r, 0, sizeof(r));
+	r.gate = g;
+	assert(pthread_create(&rd, NULL, merged_reader, &r) == 0);
+
+	for (i = 0; i < 4; i++) {
+		memset(&w[i], 0, sizeof(w[i]));
+		w[i].gate = g;
+		w[i].rounds = rounds;
+		assert(pthread_create(&wr[i], NULL, shard_writer, &w[i]) == 0);
+	}
+
+	for (i = 0; i < 4; i++) {
+		assert(pthread_join(wr[i], NULL) == 0);
+	}
+
+	atomic_store(&r.stop, true);
+	assert(pthread_join(rd, NULL) == 0);
+
+	m1 = atomsnap_acquire_merged(g, shard_sum, NULL);
+	assert(*(int64_t *)atomsnap_get_object(m1) == (int64_t)rounds * 4 + 1);
+	atomsnap_release_version(m1);
+
+	for (i = 0; i <= 4; i++) {
+		atomsnap_exchange_version_slot(g, i, NULL);
+	}
+	atomsnap_destroy_gate(g);
+}
+
+struct pub_delta {
+	struct atomsnap_delta link;
+	int64_t amount;
+};
+
+struct pub_args {
+	struct atomsnap_publisher *pub;
+	struct pub_delta *deltas;
+	int rounds;
+};
+
+static _Atomic(uint64_t) g_pub_retired;
+
+static void pub_apply(void *object, const struct atomsnap_delta *delta,
+	void *ctx)
+{
+	const struct pub_delta *d = (const struct pub_delta *)delta;
+
+	(void)ctx;
+	*(int64_t *)object += d->amount;
+}
+
+static void pub_retire(struct atomsnap_delta *delta, void *ctx)
+{
+	(void)delta;
+	(void)ctx;
+	atomic_fetch_add_explicit(&g_pub_retired, 1, memory_order_relaxed);
+}
+
+static void *pub_producer(void *arg)
+{
+	struct pub_args *a = arg;
+	int i;
+
+	for (i = 0; i < a->rounds; i++) {
+		a->deltas[i].amount = 1;
+		atomsnap_publisher_post(a->pub, &a->deltas[i].link);
+	}
+
+	return NULL;
+}
+
+/*
+ * Deltas from several producers are all applied, each is retired exactly
+ * once, and bursts are coalesced into far fewer versions than deltas.
+ */
+static void test_publisher(void)
+{
+	struct atomsnap_publisher_context pctx;
+	struct pub_args a[4];
+	struct atomsnap_gate *g;
+	struct atomsnap_version *v;
+	pthread_t th[4];
+	struct timespec t0, t1;
+	uint64_t token;
+	int i, rounds = 50000;
+
+	fprintf(stderr, "[TEST] publisher\n");
+
+	atomic_store(&g_pub_retired, 0);
+
+	memset(&pctx, 0, sizeof(pctx));
+	pctx.apply = pub_apply;
+	pctx.retire = pub_retire;
+	pctx.period_ns = 1000000;
+
+	pctx.gate = make_gate_flags(0, 0);
+	assert(atomsnap_publisher_create(&pctx) == NULL);
+	atomsnap_destroy_gate(pctx.gate);
+
+	g = make_gate_sized(0, 0, sizeof(int64_t));
+	assert(g != NULL);
+
+	pctx.gate = g;
+	token = atomsnap_peek_generation(g, 0);
+
+	/* Destroy wakes the thread instead of waiting out a long period */
+	pctx.period_ns = 10ULL * 1000000000ULL;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < 4; i++) {
+		a[i].pub = atomsnap_publisher_create(&pctx);
+		assert(a[i].pub != NULL);
+		atomsnap_publisher_destroy(a[i].pub);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	assert(t1.tv_sec - t0.tv_sec < 5);
+	assert(atomsnap_peek_generation(g, 0) == token);
+	pctx.period_ns = 1000000;
+
+	a[0].pub = atomsnap_publisher_create(&pctx);
+	assert(a[0].pub != NULL);
+
+	for (i = 0; i < 4; i++) {
+		a[i].pub = a[0].pub;
+		a[i].rounds = rounds;
+		a[i].deltas = calloc(rounds, sizeof(struct pub_delta));
+		assert(a[i].deltas != NULL);
+		assert(pthread_create(&th[i], NULL, pub_producer, &a[i]) == 0);
+	}
+
+	for (i = 0; i < 4; i++) {
+		assert(pthread_join(th[i], NULL) == 0);
+	}
+
+	atomsnap_publisher_destroy(a[0].pub);
+
+	assert(atomic_load(&g_pub_retired) == (uint64_t)rounds * 4);
+	assert(atomsnap_peek_generation(g, 0) - token < (uint64_t)rounds);
+
+	v = atomsnap_acquire_version_slot(g, 0);
+	assert(v != NULL);
+	assert(*(int64_t *)atomsnap_get_object(v) == (int64_t)rounds * 4);
+	atomsnap_release_version(v);
+
+	for (i = 0; i < 4; i++) {
+		free(a[i].deltas);
+	}
+
+	atomsnap_exchange_version_slot(g, 0, NULL);
+	atomsnap_destroy_gate(g);
+}
+
+static void *txn_reader(void *arg)
+{
+	static const int ids[4] = { 3, 1, 0, 2 };
+	struct seq_args *a = arg;
+	struct atomsnap_version *v[4];
+	int i, last = 0, cur;
+
+	while (!atomic_load_explicit(&a->stop, memory_order_relaxed)) {
+		atomsnap_acquire_slots_consistent(a->gate, ids, 4, v);
+		if (v[0] != NULL) {
+			cur = *(int *)atomsnap_get_object(v[0]);
+			assert(cur >= last);
+			last = cur;
+			for (i = 1; i < 4; i++) {
+				assert(v[i] != NULL);
+				assert(*(int *)atomsnap_get_object(v[i]) == cur);
+			}
+		} else {
+			for (i = 1; i < 4; i++) {
+				assert(v[i] == NULL);
+			}
+		}
+		atomsnap_release_many(v, 4);
+	}
+
+	return NULL;
+}
+
+/*
+ * Multi-slot transaction:
+ * Consistent readers never see a mix of two transactions.
+ */
+static void test_exchange_slots(void)
+{
+	static const int ids[4] = { 0, 1, 2, 3 };
+	struct atomsnap_version *vers[4];
+	struct seq_args r[2];
+	struct atomsnap_gate *g;
+	pthread_t rd[2];
+	int i, j, bad = 4, rounds = 20000;
+
+	fprintf(stderr, "[TEST] exchange slots\n");
+
+	g = make_gate_flags(0, 3);
+	assert(g != NULL);
+
+	vers[0] = NULL;
+	assert(atomsnap_exchange_slots(g, &bad, vers, 1) == -1);
+	assert(atomic_load(&g->txn_seq) == 0);
+
+	for (i = 0; i < 2; i++) {
+		memset(&r[i], 0, sizeof(r[i]));
+		r[i].gate = g;
+		assert(pthread_create(&rd[i], NULL, txn_reader, &r[i]) == 0);
+	}
+
+	for (i = 1; i <= rounds; i++) {
+		for (j = 0; j < 4; j++) {
+			vers[j] = make_ver(g, i);
+		}
+		assert(atomsnap_exchange_slots(g, ids, vers, 4) == 0);
+	}
+
+	for (i = 0; i < 2; i++) {
+		atomic_store(&r[i].stop, true);
+		assert(pthread_join(rd[i], NULL) == 0);
+	}
+
+	assert(atomic_load(&g->txn_seq) == (uint64_t)rounds * 2);
+
+	for (j = 0; j < 4; j++) {
+		vers[j] = NULL;
+	}
+	assert(atomsnap_exchange_slots(g, ids, vers, 4) == 0);
+	atomsnap_destroy_gate(g);
+}
+
+static void *history_reader(void *arg)
+{
+	struct seq_args *a = arg;
+	struct atomsnap_version *v;
+	int back = 0;
+
+	while (!atomic_load_explicit(&a->stop, memory_order_relaxed)) {
+		v = atomsnap_acquire_version_at(a->gate, 0, back);
+		if (v != NULL) {
+			assert(*(int *)atomsnap_get_object(v) > 0);
+			atomsnap_release_version(v);
+		}
+		back = (back + 1) % 4;
+	}
+
+	return NULL;
+}
+
+static void *history_writer(void *arg)
+{
+	struct seq_args *a = arg;
+	int i;
+
+	for (i = 0; i < a->rounds; i++) {
+		atomsnap_exchange_version_slot(a->gate, 0, make_ver(a->gate, 1));
+	}
+
+	return NULL;
+}
+
+/*
+ * History:
+ * The last history_depth replaced versions stay readable, the one pushed
+ * out is reclaimed once its last reader releases it, and destroying the
+ * gate drops the rest. Racing writers push to the ring one at a time
+ * while readers keep reading it.
+ */
+static void test_history(void)
+{
+	struct atomsnap_init_context ictx;
+	struct atomsnap_version *v, *held;
+	struct seq_args r, w[2];
+	struct atomsnap_gate *g;
+	pthread_t rd, wr[2];
+	int i;
+
+	fprintf(stderr, "[TEST] history\n");
+
+	init_ctx(&ictx, ATOMSNAP_GATE_HAZARD, 0, 0);
+	ictx.history_depth = 3;
+	assert(atomsnap_init_gate(&ictx) == NULL);
+
+	ictx.flags = 0;
+	ictx.history_depth = ATOMSNAP_MAX_HISTORY + 1;
+	assert(atomsnap_init_gate(&ictx) == NULL);
+
+	ictx.history_depth = 3;
+	ictx.num_extra_control_blocks = 1;
+	g = atomsnap_init_gate(&ictx);
+	assert(g != NULL);
+
+	atomic_store(&g_free_calls, 0);
+
+	assert(atomsnap_acquire_version_at(g, 0, 1) == NULL);
+
+	for (i = 1; i <= 5; i++) {
+		atomsnap_exchange_version_slot(g, 0, make_ver(g, i));
+	}
+
+	/* 5 is current, 4..2 in the history, 1 pushed out */
+	for (i = 0; i <= 3; i++) {
+		v = atomsnap_acquire_version_at(g, 0, i);
+		assert(v != NULL);
+		assert(*(int *)atomsnap_get_object(v) == 5 - i);
+		atomsnap_release_version(v);
+	}
+	assert(atomsnap_acquire_version_at(g, 0, 4) == NULL);
+	assert(atomsnap_acquire_version_at(g, 1, 1) == NULL);
+	assert(atomic_load(&g_free_calls) == 1);
+
+	/* A reader keeps an evicted entry alive */
+	held = atomsnap_acquire_version_at(g, 0, 3);
+	atomsnap_exchange_version_slot(g, 0, make_ver(g, 6));
+	assert(atomic_load(&g_free_calls) == 1);
+	assert(*(int *)atomsnap_get_object(held) == 2);
+	atomsnap_release_version(held);
+	assert(atomic_load(&g_free_calls) == 2);
+
+	memset(&r, 0, sizeof(r));
+	r.gate = g;
+	assert(pthread_create(&rd, NULL, history_reader, &r) == 0);
+
+	for (i = 7; i <= 20000; i++) {
+		atomsnap_exchange_version_slot(g, 0, make_ver(g, i));
+	}
+
+	atomic_store(&r.stop, true);
+	assert(pthread_join(rd, NULL) == 0);
+
+	assert(atomic_load(&g_free_calls) == 20000 - 4);
+
+	atomic_store(&r.stop, false);
+	assert(pthread_create(&rd, NULL, history_reader, &r) == 0);
+
+	for (i = 0; i < 2; i++) {
+		memset(&w[i], 0, sizeof(w[i]));
+		w[i].gate = g;
+		w[i].rounds = 10000;
+		assert(pthread_create(&wr[i], NULL, history_writer,
+			&w[i]) == 0);
+	}
+	for (i = 0; i < 2; i++) {
+		assert(pthread_join(wr[i], NULL) == 0);
+	}
+
+	atomic_store(&r.stop, true);
+	assert(pthread_join(rd, NULL) == 0);
+
+	assert(atomic_load(&g_free_calls) == 40000 - 4);
+
+	atomsnap_exchange_version_slot(g, 0, NULL);
+	atomsnap_destroy_gate(g);
+	assert(atomic_load(&g_free_calls) == 40000);
+}
+
+static void *gen_writer(void *arg)
+{
+	struct seq_args *a = arg;
+	int i;
+
+	for (i = 0; i < a->rounds; i++) {
+		assert(atomsnap_update_slot(a->gate, 0, shard_inc, NULL) == 1);
+	}
+
+	return NULL;
+}
+
+/* Racing exchanges, emptying the slot every fourth round */
+static void *gen_xchg_writer(void *arg)
+{
+	struct seq_args *a = arg;
+	int i;
+
+	for (i = 0; i < a->rounds; i++) {
+		atomsnap_exchange_version_slot(a->gate, 0,
+			(i % 4 == 3) ? NULL : make_ver(a->gate, i));
+	}
+
+	return NULL;
+}
+
+static void *gen_reader(void *arg)
+{
+	struct seq_args *a = arg;
+	struct atomsnap_version *v;
+	uint64_t gen, last_gen = 0;
+	int64_t cur, last = 0;
+
+	while (!atomic_load_explicit(&a->stop, memory_order_relaxed)) {
+		v = atomsnap_acquire_version_slot(a->gate, 0);
+		if (v != NULL) {
+			gen = atomsnap_get_generation(v);
+			assert(gen >= last_gen);
+			/* id 1: exchange writers, objects are not counters */
+			cur = (a->id == 1) ? 0 : *(int64_t *)atomsnap_get_object(v);
+			assert(a->id == 1 || (gen > last_gen) == (cur > last));
+			last_gen = gen;
+			last = cur;
+			atomsnap_release_version(v);
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Generation:
+ * Every publish path stamps a per-slot number that grows with each
+ * install, CAS writers keep it in step with the object, and racing
+ * exchanges never move it backwards.
+ */
+static void test_version_generation(void)
+{
+	struct atomsnap_version *v, *cur;
+	struct seq_args w[2], r;
+	struct atomsnap_gate *g;
+	pthread_t wr[2], rd;
+	uint64_t last;
+	int i;
+
+	fprintf(stderr, "[TEST] version generation\n");
+
+	g = make_gate_sized(ATOMSNAP_GATE_IN_PLACE, 1,
+		sizeof(struct combine_obj));
+	assert(g != NULL);
+
+	/* Gates without ATOMSNAP_GATE_STAMPED leave versions unstamped */
+	v = make_ver(g, 1);
+	atomsnap_exchange_version_slot(g, 0, v);
+	assert(atomsnap_get_generation(v) == 0);
+	atomsnap_exchange_version_slot(g, 0, NULL);
+	atomsnap_destroy_gate(g);
+
+	g = make_gate_sized(ATOMSNAP_GATE_IN_PLACE | ATOMSNAP_GATE_STAMPED, 1,
+		sizeof(struct combine_obj));
+	assert(g != NULL);
+
+	assert(atomsnap_get_generation(NULL) == 0);
+	v = make_ver(g, 1);
+	assert(atomsnap_get_generation(v) == 0);
+
+	atomsnap_exchange_version_slot(g, 0, v);
+	assert(atomsnap_get_generation(v) == 1);
+
+	/* Slots count separately */
+	atomsnap_exchange_version_slot(g, 1, make_ver(g, 1));
+	cur = atomsnap_acquire_version_slot(g, 1);
+	assert(atomsnap_get_generation(cur) == 1);
+	atomsnap_release_version(cur);
+
+	cur = atomsnap_acquire_version_slot(g, 0);
+	v = make_ver(g, 2);
+	assert(atomsnap_compare_exchange_version_slot(g, 0, cur, v));
+	assert(atomsnap_get_generation(v) == 2);
+	/* The replaced version keeps its number */
+	assert(atomsnap_get_generation(cur) == 1);
+	atomsnap_release_version(cur);
+
+	assert(atomsnap_publish_if_newer(g, 0, make_ver(g, 3), 1));
+	cur = atomsnap_acquire_version_slot(g, 0);
+	assert(atomsnap_get_generation(cur) == 3);
+	atomsnap_release_version(cur);
+
+	/* Emptying the slot does not reset the counter */
+	atomsnap_exchange_version_slot(g, 0, NULL);
+	assert(atomsnap_update_slot(g, 0, shard_inc, NULL) == 1);
+	assert(atomsnap_mutate_slot(g, 0, pair_inc, NULL) == 1);
+	cur = atomsnap_acquire_version_slot(g, 0);
+	assert(atomsnap_get_generation(cur) == 5);
+	last = 5;
+	atomsnap_release_version(cur);
+
+	memset(&r, 0, sizeof(r));
+	r.gate = g;
+	assert(pthread_create(&rd, NULL, gen_reader, &r) == 0);
+
+	for (i = 0; i < 2; i++) {
+		memset(&w[i], 0, sizeof(w[i]));
+		w[i].gate = g;
+		w[i].rounds = 20000;
+		assert(pthread_create(&wr[i], NULL, gen_writer, &w[i]) == 0);
+	}
+
+	for (i = 0; i < 2; i++) {
+		assert(pthread_join(wr[i], NULL) == 0);
+	}
+
+	atomic_store(&r.stop, true);
+	assert(pthread_join(rd, NULL) == 0);
+
+	cur = atomsnap_acquire_version_slot(g, 0);
+	assert(atomsnap_get_generation(cur) == last + 40000);
+	last += 40000;
+	atomsnap_release_version(cur);
+
+	/* 2 x 20000 exchanges, a quarter of them to NULL */
+	r.id = 1;
+	atomic_store(&r.stop, false);
+	assert(pthread_create(&rd, NULL, gen_reader, &r) == 0);
+
+	for (i = 0; i < 2; i++) {
+		assert(pthread_create(&wr[i], NULL, gen_xchg_writer, &w[i]) == 0);
+	}
+
+	for (i = 0; i < 2; i++) {
+		assert(pthread_join(wr[i], NULL) == 0);
+	}
+
+	atomic_store(&r.stop, true);
+	assert(pthread_join(rd, NULL) == 0);
+
+	v = make_ver(g, 0);
+	atomsnap_exchange_version_slot(g, 0, v);
+	assert(atomsnap_get_generation(v) == last + 30000 + 1);
+
+	atomsnap_exchange_version_slot(g, 0, NULL);
+	atomsnap_exchange_version_slot(g, 1, NULL);
+	atomsnap_destroy_gate(g);
+}
+
+static void *tid_thread(void *arg)
+{
+	struct seq_args *a = arg;
+	struct atomsnap_version *v;
+
+	v = atomsnap_make_version(a->gate);
+	assert(v != NULL);
+	a->id = g_tls_ctx->thread_id;
+	atomsnap_free_version(v);
+
+	return NULL;
+}
+
+/*
+ * Thread IDs:
+ * An exiting thread's ID is handed to the next thread, so churning
+ * threads neither consume fresh IDs nor scan for free ones.
+ */
+static void test_thread_ids(void)
+{
+	struct seq_args a[4];
+	struct atomsnap_gate *g;
+	pthread_t th[4];
+	int i, j, fresh, first;
+
+	fprintf(stderr, "[TEST] thread ids\n");
+
+	g = make_gate_flags(0, 0);
+	assert(g != NULL);
+
+	memset(a, 0, sizeof(a));
+	a[0].gate = g;
+	assert(pthread_create(&th[0], NULL, tid_thread, &a[0]) == 0);
+	assert(pthread_join(th[0], NULL) == 0);
+	first = a[0].id;
+	fresh = atomic_load(&g_tid_fresh);
+
+	/* Sequential churn reuses the same (warm) ID */
+	for (i = 0; i < 100; i++) {
+		assert(pthread_create(&th[0], NULL, tid_thread, &a[0]) == 0);
+		assert(pthread_join(th[0], NULL) == 0);
+		assert(a[0].id == first);
+	}
+	assert(atomic_load(&g_tid_fresh) == fresh);
+
+	/* Concurrent churn needs at most one fresh ID per extra thread */
+	for (i = 0; i < 100; i++) {
+		for (j = 0; j < 4; j++) {
+			a[j].gate = g;
+			assert(pthread_create(&th[j], NULL, tid_thread,
+				&a[j]) == 0);
+		}
+		for (j = 0; j < 4; j++) {
+			assert(pthread_join(th[j], NULL) == 0);
+		}
+	}
+	assert(atomic_load(&g_tid_fresh) <= fresh + 3);
+
+	atomsnap_destroy_gate(g);
+}
+
+struct orphan_args {
+	struct atomsnap_gate *gate;
+	struct atomsnap_version *ver;
+	uint32_t arena_idx;
+	struct arena_pool *pool;
+	uint32_t ready_top;
+};
+
+static void *orphan_thread(void *arg)
+{
+	struct orphan_args *a = arg;
+	atomsnap_handle_t h;
+
+	a->ver = make_ver(a->gate, 1);
+	h.raw = a->ver->self_handle;
+	a->arena_idx = h.arena_idx;
+	a->pool = &g_tls_ctx->pools[0];
+	a->ready_top = atomic_load(&a->pool->ready_top);
+
+	return NULL;
+}
+
+/*
+ * Orphaned arenas:
+ * An exiting thread that still has live versions donates its arena, and
+ * the next thread needing a slot adopts it instead of a new arena.
+ */
+static void test_orphan_arenas(void)
+{
+	struct orphan_args a, b;
+	struct atomsnap_gate *g;
+	pthread_t th;
+	size_t arenas;
+
+	fprintf(stderr, "[TEST] orphan arenas\n");
+
+	g = make_gate_flags(0, 0);
+	assert(g != NULL);
+
+	memset(&a, 0, sizeof(a));
+	a.gate = g;
+	assert(pthread_create(&th, NULL, orphan_thread, &a) == 0);
+	assert(pthread_join(th, NULL) == 0);
+
+	/* The arena still holds a live version, so it was donated */
+	assert((uint32_t)atomic_load(&g_orphan_top[0]) == a.arena_idx + 1);
+	assert(atomic_load(&a.pool->ready_top) == READY_CLOSED);
+
+	/*
+	 * A free that queued the arena before the donation links it only
+	 * now: the closed list makes it release the arena itself.
+	 */
+	assert(arena_stack_pop(&g_orphan_top[0]) == a.arena_idx);
+	atomic_store(&arena_meta_of(a.arena_idx)->owner,
+		(uintptr_t)a.pool | ARENA_QUEUED | ARENA_LEAVING);
+	assert(!ready_push(a.pool, a.arena_idx));
+	assert(!ready_settle(a.arena_idx));
+	assert(atomic_load(&arena_meta_of(a.arena_idx)->owner) == 0);
+	assert((uint32_t)atomic_load(&g_orphan_top[0]) == a.arena_idx + 1);
+
+	/* Remote free onto the orphan */
+	atomsnap_free_version(a.ver);
+
+	arenas = atomic_load(&g_global_arena_cnt);
+
+	memset(&b, 0, sizeof(b));
+	b.gate = g;
+	assert(pthread_create(&th, NULL, orphan_thread, &b) == 0);
+	assert(pthread_join(th, NULL) == 0);
+
+	assert(b.arena_idx == a.arena_idx);
+	assert(atomic_load(&g_global_arena_cnt) == arenas);
+
+	/* The adopting thread reopened the list */
+	assert(b.pool == a.pool && b.ready_top != READY_CLOSED);
+
+	atomsnap_free_version(b.ver);
+	atomsnap_destroy_gate(g);
+}
+
+/*
+ * Ready list:
+ * Freeing into an empty arena stack links the arena into its owner's
+ * ready list, and the next refill steals from it without a scan.
+ */
+static void test_ready_list(void)
+{
+	struct atomsnap_gate *g;
+	struct atomsnap_version **vers, *v;
+	struct arena_pool *pool;
+	atomsnap_handle_t h;
+	uint32_t first, freed;
+	size_t arenas;
+	int i, n = (int)class_slots(0) * 3;
+
+	fprintf(stderr, "[TEST] ready list\n");
+
+	g = make_gate_flags(0, 0);
+	assert(g != NULL);
+
+	vers = calloc((size_t)n * 2, sizeof(*vers));
+	assert(vers != NULL);
+
+	/* Spread live versions over several arenas */
+	for (i = 0; i < n; i++) {
+		vers[i] = atomsnap_make_version(g);
+		assert(vers[i] != NULL);
+	}
+
+	h.raw = vers[0]->self_handle;
+	first = h.arena_idx;
+	freed = vers[0]->self_handle;
+	pool = &g_tls_ctx->pools[0];
+
+	atomsnap_free_version(vers[0]);
+	vers[0] = NULL;
+	assert(atomic_load(&pool->ready_top) == first + 1);
+	assert(atomic_load(&arena_meta_of(first)->owner) ==
+		((uintptr_t)pool | ARENA_QUEUED));
+
+	/* Drain the local stack; the refill takes the freed slot */
+	arenas = atomic_load(&g_global_arena_cnt);
+	for (i = n; i < n * 2; i++) {
+		v = atomsnap_make_version(g);
+		assert(v != NULL);
+		vers[i] = v;
+		if (v->self_handle == freed) {
+			break;
+		}
+	}
+	assert(i < n * 2);
+	assert(atomic_load(&g_global_arena_cnt) == arenas);
+	assert(atomic_load(&arena_meta_of(first)->owner) == (uintptr_t)pool);
+
+	for (i = 0; i < n * 2; i++) {
+		if (vers[i] != NULL) {
+			atomsnap_free_version(vers[i]);
+		}
+	}
+	free(vers);
+	atomsnap_destroy_gate(g);
+}
+
+/*
+ * Arena reclamation:
+ * A fully free arena in the middle of the vector is reclaimed, and its
+ * index is reused by the next arena instead of growing the table.
+ */
+static void test_arena_reclaim(void)
+{
+	struct atomsnap_gate *g;
+	struct atomsnap_version **vers, **more;
+	struct arena_pool *pool;
+	atomsnap_handle_t h;
+	uint32_t mid = HANDLE_NULL, cur;
+	size_t i, j, cnt, arenas;
+	size_t n = class_slots(0) * 3;
+
+	fprintf(stderr, "[TEST] arena reclaim\n");
+
+	g = make_gate_flags(0, 0);
+	assert(g != NULL);
+
+	vers = calloc(n, sizeof(*vers));
+	more = calloc(n, sizeof(*more));
+	assert(vers != NULL && more != NULL);
+
+	for (i = 0; i < n; i++) {
+		vers[i] = atomsnap_make_version(g);
+		assert(vers[i] != NULL);
+	}
+
+	/* Find an arena whose slots are all ours, other than the last one */
+	h.raw = vers[n - 1]->self_handle;
+	cur = h.arena_idx;
+	for (i = 0; i < n && mid == HANDLE_NULL; i++) {
+		h.raw = vers[i]->self_handle;
+		if (h.arena_idx == cur) {
+			continue;
+		}
+		for (j = 0, cnt = 0; j < n; j++) {
+			if (vers[j]->self_handle >> HANDLE_SLOT_BITS ==
+					h.arena_idx) {
+				cnt++;
+			}
+		}
+		if (cnt == class_slots(0) - 1) {
+			mid = h.arena_idx;
+		}
+	}
+	assert(mid != HANDLE_NULL);
+
+	for (i = 0; i < n; i++) {
+		if (vers[i]->self_handle >> HANDLE_SLOT_BITS == mid) {
+			atomsnap_free_version(vers[i]);
+			vers[i] = NULL;
+		}
+	}
+
+	/* The last free reported the arena */
+	pool = &g_tls_ctx->pools[0];
+	assert(atomic_load(&pool->empty_hint));
+	assert(atomic_load(&pool->ready_top) == mid + 1);
+
+	/* A partly free arena stays linked */
+	h.raw = vers[n - 1]->self_handle;
+	atomsnap_free_version(vers[n - 1]);
+	vers[n - 1] = NULL;
+	assert(atomic_load(&pool->ready_top) == (uint32_t)h.arena_idx + 1);
+
+	assert(reclaim_empty_arenas(pool) == 1);
+	for (i = 0; i < pool->active_arena_count; i++) {
+		assert(pool->arena_indices[i] != mid);
+		assert(arena_meta_of(pool->arena_indices[i])->pool_pos == i);
+	}
+	assert(atomic_load(&arena_meta_of(mid)->owner) == 0);
+	assert((uint32_t)atomic_load(&g_free_arena_top) == mid + 1);
+	assert(atomic_load(&pool->ready_top) == (uint32_t)h.arena_idx + 1);
+
+	/* No hint, no walk */
+	assert(!atomic_load(&pool->empty_hint));
+	assert(reclaim_empty_arenas(pool) == 0);
+
+	/* The next arena reuses the index */
+	arenas = atomic_load(&g_global_arena_cnt);
+	for (i = 0; i < n; i++) {
+		more[i] = atomsnap_make_version(g);
+		assert(more[i] != NULL);
+		h.raw = more[i]->self_handle;
+		if (h.arena_idx == mid) {
+			break;
+		}
+	}
+	assert(i < n);
+	assert(atomic_load(&g_global_arena_cnt) == arenas);
+
+	for (i = 0; i < n; i++) {
+		if (vers[i] != NULL) {
+			atomsnap_free_version(vers[i]);
+		}
+		if (more[i] != NULL) {
+			atomsnap_free_version(more[i]);
+		}
+	}
+	free(vers);
+	free(more);
+	atomsnap_destroy_gate(g);
+}
+
+int main(void)
+{
+	test_lease();
+	test_slot_layout();
+	test_cb_layout();
+	test_inline_payload();
+	test_acquire_many();
+	test_peek_generation();
+	test_update_slot();
+	test_combine();
+	test_publish_if_newer();
+	test_single_writer();
+	test_mutate_slot();
+	test_cas_vs_mutate();
+	test_write_sharded();
+	test_publisher();
+	test_exchange_slots();
+	test_history();
+	test_version_generation();
+	test_thread_ids();
+	test_orphan_arenas();
+	test_ready_list();
+	test_arena_reclaim();
+
+	fprintf(stderr, "ALL TESTS PASSED\n");
+	return 0;
+}
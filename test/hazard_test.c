@@ -0,0 +1,117 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/*
+ * Include the implementation directly so the test can inspect hazard slots
+ * and the retire stack of a gate.
+ */
+#include "../atomsnap.c"
+
+#include "stress.h"
+
+static struct atomsnap_gate *make_gate(void)
+{
+	return make_gate_flags(ATOMSNAP_GATE_HAZARD, 0);
+}
+
+/*
+ * Test 1:
+ * Readers must not touch the control block reference count, and a version
+ * protected by a hazard slot must survive any number of scans.
+ */
+static void test_protected_not_reclaimed(void)
+{
+	struct atomsnap_gate *g;
+	struct atomsnap_version *ver, *r;
+	uint64_t cb;
+	int i;
+
+	fprintf(stderr, "[TEST] protected version not reclaimed\n");
+
+	atomic_store_explicit(&g_free_calls, 0, memory_order_relaxed);
+
+	g = make_gate();
+	assert(g != NULL);
+
+	ver = make_ver(g, 1);
+	atomsnap_exchange_version_slot(g, 0, ver);
+
+	r = atomsnap_acquire_version_slot(g, 0);
+	assert(r == ver);
+
+	cb = atomic_load(&g->control_block);
+	assert((cb & REF_COUNT_MASK) == 0);
+
+	/* Push enough versions to force several scans */
+	for (i = 0; i < ATOMSNAP_HAZARD_SCAN_THRESHOLD * 4; i++) {
+		atomsnap_exchange_version_slot(g, 0, make_ver(g, i + 2));
+	}
+
+	assert(*(int *)atomsnap_get_object(r) == 1);
+	assert(atomic_load(&g_free_calls) <
+		(uint64_t)ATOMSNAP_HAZARD_SCAN_THRESHOLD * 4);
+
+	atomsnap_release_version(r);
+
+	atomsnap_exchange_version_slot(g, 0, NULL);
+	atomsnap_destroy_gate(g);
+
+	assert(atomic_load(&g_free_calls) ==
+		(uint64_t)ATOMSNAP_HAZARD_SCAN_THRESHOLD * 4 + 1);
+}
+
+/*
+ * Test 2:
+ * Readers observe monotonically increasing values and every published
+ * version is reclaimed exactly once by the time the gate is destroyed.
+ */
+static void test_stress(void)
+{
+	struct stress_mode m;
+	uint64_t frees, wops;
+
+	fprintf(stderr, "[TEST] stress\n");
+
+	memset(&m, 0, sizeof(m));
+	m.readers = 4;
+	m.rounds = 200000;
+	m.monotonic = true;
+
+	atomic_store_explicit(&g_free_calls, 0, memory_order_relaxed);
+
+	m.gate = make_gate();
+	assert(m.gate != NULL);
+
+	stress_run(&m);
+
+	atomsnap_exchange_version_slot(m.gate, 0, NULL);
+
+	/* Retired versions are bounded by the scan threshold */
+	assert(atomic_load(&m.gate->retired_cnt) <=
+		ATOMSNAP_HAZARD_SCAN_THRESHOLD);
+
+	atomsnap_destroy_gate(m.gate);
+
+	frees = atomic_load_explicit(&g_free_calls, memory_order_relaxed);
+	wops = atomic_load_explicit(&m.writer_ops, memory_order_relaxed);
+
+	fprintf(stderr, "writer_ops=%" PRIu64 " free_calls=%" PRIu64 "\n",
+		wops, frees);
+
+	assert(frees == wops);
+}
+
+int main(void)
+{
+	test_protected_not_reclaimed();
+	test_stress();
+
+	fprintf(stderr, "ALL TESTS PASSED\n");
+	return 0;
+}
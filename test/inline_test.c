@@ -0,0 +1,310 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Unlike the other tests, this one sees only the public headers and links
+ * the library, so the reader calls below expand to the inlined fast paths
+ * of atomsnap_inline.h and reach the library only through its fallbacks.
+ */
+#ifndef ATOMSNAP_INLINE
+#error "inline_test must be built with -DATOMSNAP_INLINE"
+#endif
+#include "atomsnap.h"
+
+#define NUM_READERS           (4)
+#define STRESS_VERSIONS       (200000)
+
+static _Atomic(uint64_t) g_free_calls;
+
+static void test_free_impl(void *obj, void *ctx)
+{
+	(void)ctx;
+
+	if (obj != NULL) {
+		free(obj);
+	}
+
+	atomic_fetch_add_explicit(&g_free_calls, 1,
+		memory_order_relaxed);
+}
+
+static struct atomsnap_gate *make_gate(uint32_t flags)
+{
+	struct atomsnap_init_context ictx;
+
+	memset(&ictx, 0, sizeof(ictx));
+	ictx.free_impl = test_free_impl;
+	ictx.num_extra_control_blocks = 0;
+	ictx.flags = flags;
+
+	return atomsnap_init_gate(&ictx);
+}
+
+static struct atomsnap_version *make_ver(struct atomsnap_gate *g, int v)
+{
+	struct atomsnap_version *ver;
+	int *p;
+
+	ver = atomsnap_make_version(g);
+	assert(ver != NULL);
+
+	p = malloc(sizeof(*p));
+	assert(p != NULL);
+	*p = v;
+
+	atomsnap_set_object(ver, p, NULL);
+	return ver;
+}
+
+static uint32_t outer_refs(struct atomsnap_gate *g, int slot)
+{
+	return (uint32_t)(__atomic_load_n(atomsnap_cb_slot(g, slot),
+		__ATOMIC_ACQUIRE) >> 32);
+}
+
+/*
+ * Test 1:
+ * The inlined acquire takes its reference in the control block and the
+ * inlined release returns it to the version without reclaiming anything
+ * while the version is still published.
+ */
+static void test_fast_path(void)
+{
+	struct atomsnap_gate *g;
+	struct atomsnap_version *v1, *r;
+
+	fprintf(stderr, "[TEST] inline fast path\n");
+
+	atomic_store_explicit(&g_free_calls, 0, memory_order_relaxed);
+
+	g = make_gate(0);
+	assert(g != NULL);
+	assert((g->flags & ATOMSNAP_GATE_SLOW_READ) == 0);
+
+	/* Empty slot */
+	r = atomsnap_acquire_version_slot(g, 0);
+	assert(r == NULL);
+	assert(atomsnap_get_object(r) == NULL);
+	atomsnap_release_version(r);
+
+	v1 = make_ver(g, 1);
+	atomsnap_exchange_version_slot(g, 0, v1);
+	assert(outer_refs(g, 0) == 0);
+
+	r = atomsnap_acquire_version_slot(g, 0);
+	assert(r == v1);
+	assert(atomsnap_version_gate(r) == g);
+	assert(*(int *)atomsnap_get_object(r) == 1);
+	assert(outer_refs(g, 0) == 1);
+
+	atomsnap_release_version(r);
+	assert(atomic_load(&g_free_calls) == 0);
+
+	/* The writer settles the reader's reference and reclaims v1 */
+	atomsnap_exchange_version_slot(g, 0, make_ver(g, 2));
+	assert(atomic_load(&g_free_calls) == 1);
+	assert(outer_refs(g, 0) == 0);
+
+	atomsnap_exchange_version_slot(g, 0, NULL);
+	assert(atomic_load(&g_free_calls) == 2);
+
+	atomsnap_destroy_gate(g);
+}
+
+/*
+ * Test 2:
+ * A reader that outlives the publish of its version is the last one to
+ * release it, so the inlined release reclaims it through
+ * atomsnap_release_slow().
+ */
+static void test_release_slow(void)
+{
+	struct atomsnap_gate *g;
+	struct atomsnap_version *r1, *r2;
+
+	fprintf(stderr, "[TEST] inline release slow path\n");
+
+	atomic_store_explicit(&g_free_calls, 0, memory_order_relaxed);
+
+	g = make_gate(0);
+	assert(g != NULL);
+
+	atomsnap_exchange_version_slot(g, 0, make_ver(g, 1));
+	r1 = atomsnap_acquire_version_slot(g, 0);
+	r2 = atomsnap_acquire_version_slot(g, 0);
+	assert(r1 != NULL && r1 == r2);
+
+	atomsnap_exchange_version_slot(g, 0, make_ver(g, 2));
+	assert(atomic_load(&g_free_calls) == 0);
+
+	atomsnap_release_version(r1);
+	assert(atomic_load(&g_free_calls) == 0);
+	assert(*(int *)atomsnap_get_object(r2) == 1);
+
+	atomsnap_release_version(r2);
+	assert(atomic_load(&g_free_calls) == 1);
+
+	atomsnap_exchange_version_slot(g, 0, NULL);
+	assert(atomic_load(&g_free_calls) == 2);
+
+	atomsnap_destroy_gate(g);
+}
+
+/*
+ * Test 3:
+ * Gates with ATOMSNAP_GATE_SLOW_READ flags are read through the library.
+ * Hazard and QSBR readers leave the control block alone, in-place readers
+ * wait for a busy handle before they count themselves in, and replicated
+ * readers pick a replica the inlined path does not know about.
+ */
+static void test_slow_read_fallback(void)
+{
+	static const uint32_t flags[] = {
+		ATOMSNAP_GATE_HAZARD,
+		ATOMSNAP_GATE_QSBR,
+		ATOMSNAP_GATE_REPLICATED,
+		ATOMSNAP_GATE_IN_PLACE,
+	};
+	struct atomsnap_gate *g;
+	struct atomsnap_version *v, *r;
+	size_t i;
+
+	fprintf(stderr, "[TEST] inline slow read fallback\n");
+
+	for (i = 0; i < sizeof(flags) / sizeof(flags[0]); i++) {
+		atomic_store_explicit(&g_free_calls, 0, memory_order_relaxed);
+
+		g = make_gate(flags[i]);
+		assert(g != NULL);
+		assert(g->flags & ATOMSNAP_GATE_SLOW_READ);
+
+		v = make_ver(g, (int)i);
+		atomsnap_exchange_version_slot(g, 0, v);
+
+		r = atomsnap_acquire_version_slot(g, 0);
+		assert(r == v);
+		assert(*(int *)atomsnap_get_object(r) == (int)i);
+
+		if (flags[i] & (ATOMSNAP_GATE_HAZARD | ATOMSNAP_GATE_QSBR)) {
+			assert(outer_refs(g, 0) == 0);
+		} else if (flags[i] & ATOMSNAP_GATE_IN_PLACE) {
+			assert(outer_refs(g, 0) == 1);
+		}
+
+		atomsnap_release_version(r);
+		atomsnap_exchange_version_slot(g, 0, NULL);
+
+		if (flags[i] & ATOMSNAP_GATE_QSBR) {
+			/* Reclaimed at a later scan point of this thread */
+			atomsnap_quiescent_state();
+			atomsnap_thread_offline();
+		} else if (flags[i] & ATOMSNAP_GATE_HAZARD) {
+			/* The final scan of the gate reclaims the retired version */
+			atomsnap_destroy_gate(g);
+			assert(atomic_load(&g_free_calls) == 1);
+			continue;
+		} else {
+			assert(atomic_load(&g_free_calls) == 1);
+		}
+
+		atomsnap_destroy_gate(g);
+	}
+}
+
+struct stress_args {
+	struct atomsnap_gate *gate;
+	_Atomic(bool) *stop;
+	uint64_t reads;
+};
+
+static void *stress_reader(void *arg)
+{
+	struct stress_args *a = arg;
+	struct atomsnap_version *ver;
+	int last = 0, v;
+
+	while (!atomic_load_explicit(a->stop, memory_order_acquire)) {
+		ver = atomsnap_acquire_version_slot(a->gate, 0);
+		assert(ver != NULL);
+
+		/* Versions are published in increasing order */
+		v = *(int *)atomsnap_get_object(ver);
+		assert(v >= last);
+		last = v;
+
+		atomsnap_release_version(ver);
+		a->reads++;
+	}
+
+	return NULL;
+}
+
+/*
+ * Test 4:
+ * Inlined readers racing a writer: every replaced version is reclaimed
+ * exactly once, whether by the writer or by a reader's release.
+ */
+static void test_stress(void)
+{
+	struct stress_args args[NUM_READERS];
+	pthread_t th[NUM_READERS];
+	_Atomic(bool) stop = false;
+	struct atomsnap_gate *g;
+	uint64_t reads = 0;
+	int i;
+
+	fprintf(stderr, "[TEST] inline readers vs writer\n");
+
+	atomic_store_explicit(&g_free_calls, 0, memory_order_relaxed);
+
+	g = make_gate(0);
+	assert(g != NULL);
+
+	atomsnap_exchange_version_slot(g, 0, make_ver(g, 0));
+
+	for (i = 0; i < NUM_READERS; i++) {
+		args[i].gate = g;
+		args[i].stop = &stop;
+		args[i].reads = 0;
+		assert(pthread_create(&th[i], NULL, stress_reader,
+			&args[i]) == 0);
+	}
+
+	for (i = 1; i <= STRESS_VERSIONS; i++) {
+		atomsnap_exchange_version_slot(g, 0, make_ver(g, i));
+	}
+
+	atomic_store_explicit(&stop, true, memory_order_release);
+	for (i = 0; i < NUM_READERS; i++) {
+		assert(pthread_join(th[i], NULL) == 0);
+		reads += args[i].reads;
+	}
+
+	assert(atomic_load(&g_free_calls) == (uint64_t)STRESS_VERSIONS);
+
+	atomsnap_exchange_version_slot(g, 0, NULL);
+	assert(atomic_load(&g_free_calls) == (uint64_t)STRESS_VERSIONS + 1);
+
+	fprintf(stderr, "  reads: %" PRIu64 "\n", reads);
+
+	atomsnap_destroy_gate(g);
+}
+
+int main(void)
+{
+	test_fast_path();
+	test_release_slow();
+	test_slow_read_fallback();
+	test_stress();
+
+	fprintf(stderr, "ALL TESTS PASSED\n");
+	return 0;
+}
@@ -0,0 +1,269 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/*
+ * Include the implementation directly so the test can inspect limbo lists
+ * and epochs.
+ */
+#include "../atomsnap.c"
+
+#include "stress.h"
+
+static struct atomsnap_gate *make_gate(void)
+{
+	return make_gate_flags(ATOMSNAP_GATE_QSBR, 0);
+}
+
+struct pin_args {
+	struct atomsnap_gate *gate;
+	struct atomsnap_version *held;
+	_Atomic(int) phase;
+};
+
+static void *pinning_reader(void *arg)
+{
+	struct pin_args *a = arg;
+
+	a->held = atomsnap_acquire_version_slot(a->gate, 0);
+	atomic_store(&a->phase, 1);
+
+	while (atomic_load(&a->phase) != 2) {
+		sched_yield();
+	}
+
+	/* The writer replaced it many times, but it must still be intact */
+	assert(*(int *)atomsnap_get_object(a->held) == 1);
+	atomsnap_release_version(a->held);
+
+	atomsnap_quiescent_state();
+	atomic_store(&a->phase, 3);
+
+	while (atomic_load(&a->phase) != 4) {
+		sched_yield();
+	}
+
+	return NULL;
+}
+
+/*
+ * Test 1:
+ * A version read by a thread that has not reported a quiescent state must
+ * not be reclaimed. Once the thread reports one, the limbo list drains.
+ */
+static void test_grace_period(void)
+{
+	struct pin_args a;
+	struct thread_context *ctx;
+	pthread_t th;
+	int i, n = ATOMSNAP_QSBR_SCAN_INTERVAL * 2;
+
+	fprintf(stderr, "[TEST] grace period\n");
+
+	atomic_store_explicit(&g_free_calls, 0, memory_order_relaxed);
+
+	memset(&a, 0, sizeof(a));
+	a.gate = make_gate();
+	assert(a.gate != NULL);
+
+	atomsnap_exchange_version_slot(a.gate, 0, make_ver(a.gate, 1));
+
+	assert(pthread_create(&th, NULL, pinning_reader, &a) == 0);
+	while (atomic_load(&a.phase) != 1) {
+		sched_yield();
+	}
+
+	for (i = 0; i < n; i++) {
+		atomsnap_exchange_version_slot(a.gate, 0,
+			make_ver(a.gate, i + 2));
+	}
+
+	ctx = get_or_init_thread_context();
+	assert(atomic_load(&g_free_calls) == 0);
+	assert(ctx->limbo_cnt == (uint32_t)n);
+
+	atomic_store(&a.phase, 2);
+	while (atomic_load(&a.phase) != 3) {
+		sched_yield();
+	}
+
+	/* Next scan point reclaims everything retired before */
+	for (i = 0; i < ATOMSNAP_QSBR_SCAN_INTERVAL; i++) {
+		atomsnap_exchange_version_slot(a.gate, 0,
+			make_ver(a.gate, n + i + 2));
+	}
+	assert(atomic_load(&g_free_calls) >= (uint64_t)n);
+
+	atomic_store(&a.phase, 4);
+	assert(pthread_join(th, NULL) == 0);
+
+	atomsnap_exchange_version_slot(a.gate, 0, NULL);
+	qsbr_reclaim(ctx, false);
+	assert(ctx->limbo_cnt == 0);
+	assert(atomic_load(&g_free_calls) ==
+		(uint64_t)(n + ATOMSNAP_QSBR_SCAN_INTERVAL + 1));
+
+	atomsnap_destroy_gate(a.gate);
+}
+
+struct hold_args {
+	struct atomsnap_gate *gate;
+	_Atomic(int) phase;
+};
+
+static void *retiring_writer(void *arg)
+{
+	struct hold_args *a = arg;
+	struct thread_context *ctx = get_or_init_thread_context();
+
+	/* Retires the version the other thread holds */
+	atomsnap_exchange_version_slot(a->gate, 0, make_ver(a->gate, 2));
+	atomic_store(&a->phase, 1);
+
+	while (atomic_load(&a->phase) != 2) {
+		sched_yield();
+	}
+	qsbr_reclaim(ctx, false);
+	atomic_store(&a->phase, 3);
+
+	while (atomic_load(&a->phase) != 4) {
+		sched_yield();
+	}
+	qsbr_reclaim(ctx, false);
+	assert(ctx->limbo_cnt == 0);
+
+	return NULL;
+}
+
+/*
+ * Test 2:
+ * An online thread keeps a version it acquired across its own publish,
+ * while another writer retires that version. The publish is not a
+ * quiescent state, so the version survives until the thread reports one.
+ */
+static void test_hold_across_publish(void)
+{
+	struct atomsnap_version *held;
+	struct hold_args a;
+	pthread_t th;
+
+	fprintf(stderr, "[TEST] hold across publish\n");
+
+	atomic_store_explicit(&g_free_calls, 0, memory_order_relaxed);
+
+	memset(&a, 0, sizeof(a));
+	a.gate = make_gate_flags(ATOMSNAP_GATE_QSBR, 1);
+	assert(a.gate != NULL);
+
+	atomsnap_exchange_version_slot(a.gate, 0, make_ver(a.gate, 1));
+	held = atomsnap_acquire_version_slot(a.gate, 0);
+	assert(held != NULL);
+
+	assert(pthread_create(&th, NULL, retiring_writer, &a) == 0);
+	while (atomic_load(&a.phase) != 1) {
+		sched_yield();
+	}
+
+	/* Publish (and retire) on another slot while still holding */
+	atomsnap_exchange_version_slot(a.gate, 1, make_ver(a.gate, 10));
+	atomsnap_exchange_version_slot(a.gate, 1, make_ver(a.gate, 11));
+
+	atomic_store(&a.phase, 2);
+	while (atomic_load(&a.phase) != 3) {
+		sched_yield();
+	}
+
+	assert(atomic_load(&g_free_calls) == 0);
+	assert(*(int *)atomsnap_get_object(held) == 1);
+	atomsnap_release_version(held);
+
+	atomsnap_quiescent_state();
+	atomic_store(&a.phase, 4);
+	assert(pthread_join(th, NULL) == 0);
+	assert(atomic_load(&g_free_calls) == 1);
+
+	/* The version retired by our own publish drains the same way */
+	qsbr_reclaim(get_or_init_thread_context(), false);
+	assert(atomic_load(&g_free_calls) == 2);
+
+	atomsnap_thread_offline();
+	atomsnap_exchange_version_slot(a.gate, 0, NULL);
+	atomsnap_exchange_version_slot(a.gate, 1, NULL);
+	qsbr_reclaim(get_or_init_thread_context(), false);
+	assert(atomic_load(&g_free_calls) == 4);
+
+	atomsnap_destroy_gate(a.gate);
+}
+
+static void qsbr_read(struct stress_mode *m, int id)
+{
+	(void)m;
+	(void)id;
+
+	atomsnap_quiescent_state();
+}
+
+static void qsbr_write(struct stress_mode *m)
+{
+	struct thread_context *ctx = get_or_init_thread_context();
+
+	(void)m;
+
+	/* Limbo list never exceeds its bound */
+	assert(ctx->limbo_cnt < ATOMSNAP_QSBR_LIMBO_MAX);
+}
+
+/*
+ * Test 3:
+ * Readers observe monotonically increasing values while the writer keeps
+ * its limbo list bounded.
+ */
+static void test_stress(void)
+{
+	struct stress_mode m;
+	uint64_t frees, wops;
+
+	fprintf(stderr, "[TEST] stress\n");
+
+	memset(&m, 0, sizeof(m));
+	m.readers = 4;
+	m.rounds = 200000;
+	m.monotonic = true;
+	m.read = qsbr_read;
+	m.reader_exit = atomsnap_thread_offline;
+	m.write = qsbr_write;
+
+	atomic_store_explicit(&g_free_calls, 0, memory_order_relaxed);
+
+	m.gate = make_gate();
+	assert(m.gate != NULL);
+
+	stress_run(&m);
+
+	frees = atomic_load_explicit(&g_free_calls, memory_order_relaxed);
+	wops = atomic_load_explicit(&m.writer_ops, memory_order_relaxed);
+
+	fprintf(stderr, "writer_ops=%" PRIu64 " free_calls=%" PRIu64 "\n",
+		wops, frees);
+
+	/* The exited writer may leave at most one limbo list behind */
+	assert(frees <= wops);
+	assert(wops - frees <= ATOMSNAP_QSBR_LIMBO_MAX);
+
+	atomsnap_destroy_gate(m.gate);
+}
+
+int main(void)
+{
+	test_grace_period();
+	test_hold_across_publish();
+	test_stress();
+
+	fprintf(stderr, "ALL TESTS PASSED\n");
+	return 0;
+}
@@ -0,0 +1,144 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/*
+ * Include the implementation directly so the test can acquire from a
+ * specific replica regardless of the CPU it runs on.
+ */
+#include "../atomsnap.c"
+
+#define NUM_REPLICAS (4)
+
+#include "stress.h"
+
+static struct atomsnap_gate *make_gate(void)
+{
+	return make_gate_flags(ATOMSNAP_GATE_REPLICATED, NUM_REPLICAS - 1);
+}
+
+/*
+ * Acquire from a specific replica, as a reader on that CPU would.
+ */
+static struct atomsnap_version *acquire_replica(struct atomsnap_gate *g,
+	int replica)
+{
+	uint64_t val;
+
+	val = atomic_fetch_add(get_cb_slot(g, replica), REF_COUNT_INC);
+	return resolve_handle((uint32_t)(val & HANDLE_MASK_64));
+}
+
+/*
+ * Test 1:
+ * A version held through several replicas is reclaimed exactly once, after
+ * the last reader on any replica releases it.
+ */
+static void test_refs_summed_across_replicas(void)
+{
+	struct atomsnap_gate *g;
+	struct atomsnap_version *ver, *held[NUM_REPLICAS * 2];
+	int i;
+
+	fprintf(stderr, "[TEST] refs summed across replicas\n");
+
+	atomic_store_explicit(&g_free_calls, 0, memory_order_relaxed);
+
+	g = make_gate();
+	assert(g != NULL);
+
+	ver = make_ver(g, 1);
+	atomsnap_exchange_version_slot(g, 0, ver);
+
+	for (i = 0; i < NUM_REPLICAS; i++) {
+		assert((uint32_t)(atomic_load(get_cb_slot(g, i)) &
+			HANDLE_MASK_64) == ver->self_handle);
+	}
+
+	for (i = 0; i < NUM_REPLICAS * 2; i++) {
+		held[i] = acquire_replica(g, i % NUM_REPLICAS);
+		assert(held[i] == ver);
+	}
+
+	/* Publish through CAS, then release from every replica */
+	assert(atomsnap_compare_exchange_version_slot(g, 0, ver,
+		make_ver(g, 2)));
+	assert(!atomsnap_compare_exchange_version_slot(g, 0, ver, NULL));
+
+	for (i = 0; i < NUM_REPLICAS * 2; i++) {
+		assert(atomic_load(&g_free_calls) == 0);
+		atomsnap_release_version(held[i]);
+	}
+	assert(atomic_load(&g_free_calls) == 1);
+
+	atomsnap_exchange_version_slot(g, 0, NULL);
+	assert(atomic_load(&g_free_calls) == 2);
+
+	atomsnap_destroy_gate(g);
+}
+
+/* Read the reader's own replica too, as if it ran on that CPU */
+static void replica_read(struct stress_mode *m, int id)
+{
+	struct atomsnap_version *v;
+
+	v = acquire_replica(m->gate, id % NUM_REPLICAS);
+	if (v != NULL) {
+		assert(atomsnap_get_object(v) != NULL);
+		atomsnap_release_version(v);
+	}
+}
+
+/*
+ * Test 2:
+ * Readers spread over all replicas while a single writer publishes.
+ * Every published version is reclaimed exactly once.
+ */
+static void test_stress(void)
+{
+	struct stress_mode m;
+	uint64_t frees, wops;
+
+	fprintf(stderr, "[TEST] stress\n");
+
+	memset(&m, 0, sizeof(m));
+	m.readers = NUM_REPLICAS;
+	m.rounds = 100000;
+	m.cas = true;
+	m.read = replica_read;
+
+	atomic_store_explicit(&g_free_calls, 0, memory_order_relaxed);
+
+	m.gate = make_gate();
+	assert(m.gate != NULL);
+
+	atomsnap_exchange_version_slot(m.gate, 0, make_ver(m.gate, 0));
+
+	stress_run(&m);
+
+	atomsnap_exchange_version_slot(m.gate, 0, NULL);
+
+	frees = atomic_load_explicit(&g_free_calls, memory_order_relaxed);
+	wops = atomic_load_explicit(&m.writer_ops, memory_order_relaxed);
+
+	fprintf(stderr, "writer_ops=%" PRIu64 " free_calls=%" PRIu64 "\n",
+		wops, frees);
+
+	assert(frees == wops + 1);
+
+	atomsnap_destroy_gate(m.gate);
+}
+
+int main(void)
+{
+	test_refs_summed_across_replicas();
+	test_stress();
+
+	fprintf(stderr, "ALL TESTS PASSED\n");
+	return 0;
+}
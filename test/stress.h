@@ -0,0 +1,199 @@
+#ifndef ATOMSNAP_TEST_STRESS_H
+#define ATOMSNAP_TEST_STRESS_H
+
+/*
+ * Gate and version factories, and the reader/writer stress harness shared
+ * by the per-mode tests.
+ *
+ * Include after ../atomsnap.c. Readers acquire and release slot 0 of a gate
+ * while one writer publishes versions holding increasing ints; a mode
+ * adds what is specific to its gate (replica reads, quiescent states,
+ * limbo bounds) through hooks. Each test checks its reclamation
+ * guarantees on the counts afterwards.
+ */
+
+#define STRESS_MAX_READERS (8)
+
+static _Atomic(uint64_t) g_free_calls;
+
+static inline void test_free_impl(void *obj, void *ctx)
+{
+	(void)ctx;
+
+	if (obj != NULL) {
+		free(obj);
+	}
+
+	atomic_fetch_add_explicit(&g_free_calls, 1,
+		memory_order_relaxed);
+}
+
+static inline void init_ctx(struct atomsnap_init_context *ictx,
+	uint32_t flags, int num_extra, size_t object_size)
+{
+	memset(ictx, 0, sizeof(*ictx));
+	ictx->free_impl = test_free_impl;
+	ictx->num_extra_control_blocks = num_extra;
+	ictx->flags = flags;
+	ictx->object_size = object_size;
+}
+
+static inline struct atomsnap_gate *make_gate_sized(uint32_t flags,
+	int num_extra, size_t object_size)
+{
+	struct atomsnap_init_context ictx;
+
+	init_ctx(&ictx, flags, num_extra, object_size);
+	return atomsnap_init_gate(&ictx);
+}
+
+static inline struct atomsnap_gate *make_gate_flags(uint32_t flags,
+	int num_extra)
+{
+	return make_gate_sized(flags, num_extra, 0);
+}
+
+static inline struct atomsnap_version *make_ver(struct atomsnap_gate *g,
+	int v)
+{
+	struct atomsnap_version *ver;
+	int *p;
+
+	ver = atomsnap_make_version(g);
+	assert(ver != NULL);
+
+	p = malloc(sizeof(*p));
+	assert(p != NULL);
+	*p = v;
+
+	atomsnap_set_object(ver, p, NULL);
+	return ver;
+}
+
+/*
+ * stress_mode - How stress_run() drives a gate.
+ *
+ * @gate:        Gate under test, already holding its first version if the
+ *               writer publishes with compare-exchange.
+ * @readers:     Reader threads (up to STRESS_MAX_READERS).
+ * @rounds:      Versions the writer publishes.
+ * @monotonic:   Readers check that the values they see never decrease.
+ * @cas:         The writer replaces the version it acquired with
+ *               compare-exchange instead of exchanging blindly.
+ * @read:        Called by reader @id after each read (may be NULL).
+ * @reader_exit: Called by each reader before it exits (may be NULL).
+ * @write:       Called by the writer after each publish (may be NULL).
+ * @stop:        Set by the writer when it is done.
+ * @writer_ops:  Versions published so far.
+ */
+struct stress_mode {
+	struct atomsnap_gate *gate;
+	int readers;
+	int rounds;
+	bool monotonic;
+	bool cas;
+	void (*read)(struct stress_mode *m, int id);
+	void (*reader_exit)(void);
+	void (*write)(struct stress_mode *m);
+	_Atomic(bool) stop;
+	_Atomic(uint64_t) writer_ops;
+};
+
+struct stress_reader {
+	struct stress_mode *m;
+	int id;
+};
+
+static inline void *stress_reader_thread(void *arg)
+{
+	struct stress_reader *r = arg;
+	struct stress_mode *m = r->m;
+	struct atomsnap_version *v;
+	int *p, last = -1;
+
+	while (!atomic_load_explicit(&m->stop, memory_order_relaxed)) {
+		v = atomsnap_acquire_version_slot(m->gate, 0);
+		if (v != NULL) {
+			p = atomsnap_get_object(v);
+			assert(p != NULL);
+			assert(!m->monotonic || *p >= last);
+			last = *p;
+			atomsnap_release_version(v);
+		}
+
+		if (m->read) {
+			m->read(m, r->id);
+		}
+	}
+
+	if (m->reader_exit) {
+		m->reader_exit();
+	}
+
+	return NULL;
+}
+
+static inline void *stress_writer_thread(void *arg)
+{
+	struct stress_mode *m = arg;
+	struct atomsnap_version *v;
+	int i;
+
+	for (i = 0; i < m->rounds; i++) {
+		if (m->cas) {
+			v = atomsnap_acquire_version_slot(m->gate, 0);
+			if (!atomsnap_compare_exchange_version_slot(m->gate, 0,
+					v, make_ver(m->gate, i))) {
+				abort();
+			}
+			atomsnap_release_version(v);
+		} else {
+			atomsnap_exchange_version_slot(m->gate, 0,
+				make_ver(m->gate, i));
+		}
+		atomic_fetch_add_explicit(&m->writer_ops, 1,
+			memory_order_relaxed);
+
+		if (m->write) {
+			m->write(m);
+		}
+	}
+
+	atomic_store_explicit(&m->stop, true, memory_order_relaxed);
+	return NULL;
+}
+
+/**
+ * @brief   Run the readers and the writer of a mode to completion.
+ *
+ * @param   m: Mode; the gate and the parameters are set by the caller.
+ */
+static inline void stress_run(struct stress_mode *m)
+{
+	struct stress_reader r[STRESS_MAX_READERS];
+	pthread_t rd[STRESS_MAX_READERS];
+	pthread_t wr;
+	int i;
+
+	assert(m->readers > 0 && m->readers <= STRESS_MAX_READERS);
+
+	atomic_store_explicit(&m->stop, false, memory_order_relaxed);
+	atomic_store_explicit(&m->writer_ops, 0, memory_order_relaxed);
+
+	for (i = 0; i < m->readers; i++) {
+		r[i].m = m;
+		r[i].id = i;
+		assert(pthread_create(&rd[i], NULL, stress_reader_thread,
+			&r[i]) == 0);
+	}
+
+	assert(pthread_create(&wr, NULL, stress_writer_thread, m) == 0);
+
+	assert(pthread_join(wr, NULL) == 0);
+
+	for (i = 0; i < m->readers; i++) {
+		assert(pthread_join(rd[i], NULL) == 0);
+	}
+}
+
+#endif /* ATOMSNAP_TEST_STRESS_H */